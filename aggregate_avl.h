@@ -0,0 +1,251 @@
+#ifndef AGGREGATE_AVL_H
+#define AGGREGATE_AVL_H
+
+#include <cstddef>
+#include <limits>
+#include "avlbst.h"
+
+/*
+  A monoid tells AggregateAVLTree what to keep in every node:
+
+    typedef ... value_type;
+    static value_type identity();
+    static value_type lift(const Key& key, const Value& value);
+    static value_type combine(const value_type& a, const value_type& b);
+
+  combine must be associative. It is always called with the left operand
+  holding smaller keys, so it does not need to be commutative.
+*/
+
+/**
+* Sum of the values.
+*/
+template <typename Key, typename Value>
+struct SumMonoid
+{
+    typedef Value value_type;
+    static Value identity() { return Value(); }
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return a + b; }
+};
+
+/**
+* Smallest value; identity() is the largest representable value.
+*/
+template <typename Key, typename Value>
+struct MinMonoid
+{
+    typedef Value value_type;
+    static Value identity() { return std::numeric_limits<Value>::max(); }
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return (b < a) ? b : a; }
+};
+
+/**
+* Largest value; identity() is the lowest representable value.
+*/
+template <typename Key, typename Value>
+struct MaxMonoid
+{
+    typedef Value value_type;
+    static Value identity() { return std::numeric_limits<Value>::lowest(); }
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return (a < b) ? b : a; }
+};
+
+/**
+* Number of items.
+*/
+template <typename Key, typename Value>
+struct CountMonoid
+{
+    typedef size_t value_type;
+    static size_t identity() { return 0; }
+    static size_t lift(const Key&, const Value&) { return 1; }
+    static size_t combine(size_t a, size_t b) { return a + b; }
+};
+
+/**
+* An AVL node that also stores the monoid value of its whole subtree.
+*/
+template <typename Key, typename Value, typename Monoid>
+class AggregateAVLNode : public AVLNode<Key, Value>
+{
+public:
+    typedef typename Monoid::value_type Aggregate;
+
+    AggregateAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+        AVLNode<Key, Value>(key, value, parent), aggregate_(Monoid::lift(key, value))
+    {
+
+    }
+
+    const Aggregate& getAggregate() const { return aggregate_; }
+    void setAggregate(const Aggregate& aggregate) { aggregate_ = aggregate; }
+
+protected:
+    Aggregate aggregate_;
+};
+
+/**
+* An AVL tree whose nodes carry a subtree aggregate, so that the monoid
+* over any key range can be answered in O(log n) instead of walking it.
+* Aggregates are kept current by rotations, nodeSwap and the insert/remove
+* paths. Values changed in place through operator[] or an iterator are not
+* seen by the tree; change them with insert() instead.
+*/
+template <typename Key, typename Value, typename Monoid>
+class AggregateAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename Monoid::value_type Aggregate;
+
+    Aggregate aggregate(const Key& lo, const Key& hi) const;
+    Aggregate total() const;
+
+protected:
+    typedef AggregateAVLNode<Key, Value, Monoid> AggNode;
+
+    virtual AVLNode<Key,Value>* createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent) override;
+    virtual void refreshNode(AVLNode<Key,Value>* n) override;
+    virtual void refreshPath(AVLNode<Key,Value>* n) override;
+    virtual void rotateRight(AVLNode<Key,Value>* g) override;
+    virtual void rotateLeft(AVLNode<Key,Value>* g) override;
+    virtual void nodeSwap(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2) override;
+    virtual size_t nodeBytes() const override;
+    virtual AVLNode<Key,Value>* relocateNode(AVLNode<Key,Value>* n, void* where) override;
+
+    static Aggregate aggregateOf(Node<Key, Value>* n);
+    Aggregate aggregateHelper(Node<Key, Value>* current, const Key* lo, const Key* hi) const;
+};
+
+/**
+* Combines the items with lo <= key < hi in key order.
+*/
+template<class Key, class Value, class Monoid>
+typename AggregateAVLTree<Key, Value, Monoid>::Aggregate
+AggregateAVLTree<Key, Value, Monoid>::aggregate(const Key& lo, const Key& hi) const
+{
+    return aggregateHelper(this->root_, &lo, &hi);
+}
+
+/**
+* Combines every item in the tree in O(1).
+*/
+template<class Key, class Value, class Monoid>
+typename AggregateAVLTree<Key, Value, Monoid>::Aggregate
+AggregateAVLTree<Key, Value, Monoid>::total() const
+{
+    return aggregateOf(this->root_);
+}
+
+/**
+* A NULL bound means that side is unbounded. Once the search splits, each
+* side follows a single path and takes whole subtrees off the other side,
+* so at most O(log n) nodes are touched.
+*/
+template<class Key, class Value, class Monoid>
+typename AggregateAVLTree<Key, Value, Monoid>::Aggregate
+AggregateAVLTree<Key, Value, Monoid>::aggregateHelper(Node<Key, Value>* current, const Key* lo, const Key* hi) const
+{
+    while (current != nullptr) {
+        if (lo == nullptr && hi == nullptr) {
+            return aggregateOf(current);
+        }
+        if (lo != nullptr && current->getKey() < *lo) {
+            current = current->getRight();
+        }
+        else if (hi != nullptr && !(current->getKey() < *hi)) {
+            current = current->getLeft();
+        }
+        else {
+            Aggregate left = aggregateHelper(current->getLeft(), lo, nullptr);
+            Aggregate right = aggregateHelper(current->getRight(), nullptr, hi);
+            return Monoid::combine(Monoid::combine(left, Monoid::lift(current->getKey(), current->getValue())), right);
+        }
+    }
+    return Monoid::identity();
+}
+
+template<class Key, class Value, class Monoid>
+typename AggregateAVLTree<Key, Value, Monoid>::Aggregate
+AggregateAVLTree<Key, Value, Monoid>::aggregateOf(Node<Key, Value>* n)
+{
+    if (n == nullptr) {
+        return Monoid::identity();
+    }
+    return static_cast<AggNode*>(n)->getAggregate();
+}
+
+template<class Key, class Value, class Monoid>
+AVLNode<Key,Value>* AggregateAVLTree<Key, Value, Monoid>::createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent)
+{
+    return new AggNode(key, value, parent);
+}
+
+/**
+* Recomputes n's aggregate from its children, which must be current.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::refreshNode(AVLNode<Key,Value>* n)
+{
+    Aggregate agg = Monoid::combine(aggregateOf(n->getLeft()), Monoid::lift(n->getKey(), n->getValue()));
+    static_cast<AggNode*>(n)->setAggregate(Monoid::combine(agg, aggregateOf(n->getRight())));
+}
+
+/**
+* Every node whose subtree changed lies on the path from n to the root,
+* so refreshing that path bottom-up restores all aggregates.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::refreshPath(AVLNode<Key,Value>* n)
+{
+    while (n != nullptr) {
+        refreshNode(n);
+        n = n->getParent();
+    }
+}
+
+/**
+* After a rotation g sits below its old child, so g is refreshed first.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::rotateRight(AVLNode<Key,Value>* g)
+{
+    AVLTree<Key, Value>::rotateRight(g);
+    refreshNode(g);
+    refreshNode(g->getParent());
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::rotateLeft(AVLNode<Key,Value>* g)
+{
+    AVLTree<Key, Value>::rotateLeft(g);
+    refreshNode(g);
+    refreshNode(g->getParent());
+}
+
+/**
+* Swapping moves items between positions, so both paths are refreshed.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLTree<Key, Value, Monoid>::nodeSwap(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+{
+    AVLTree<Key, Value>::nodeSwap(n1, n2);
+    refreshPath(n1);
+    refreshPath(n2);
+}
+
+template<class Key, class Value, class Monoid>
+size_t AggregateAVLTree<Key, Value, Monoid>::nodeBytes() const
+{
+    return sizeof(AggNode);
+}
+
+template<class Key, class Value, class Monoid>
+AVLNode<Key,Value>* AggregateAVLTree<Key, Value, Monoid>::relocateNode(AVLNode<Key,Value>* n, void* where)
+{
+    return new (where) AggNode(*static_cast<AggNode*>(n));
+}
+
+#endif
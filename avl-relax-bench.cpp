@@ -0,0 +1,122 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "avlbst.h"
+
+using namespace std;
+
+// Exposes the shape of the tree so lookup depth can be reported.
+class DepthAVLTree : public AVLTree<int, int>
+{
+public:
+    int height() const
+    {
+        return getHeight(root_);
+    }
+    double averageDepth() const
+    {
+        long long total = 0;
+        long long count = 0;
+        depthHelper(root_, 1, total, count);
+        return count == 0 ? 0.0 : (double)total / count;
+    }
+private:
+    static void depthHelper(Node<int, int>* current, int depth, long long& total, long long& count)
+    {
+        if (current == nullptr) {
+            return;
+        }
+        total += depth;
+        count++;
+        depthHelper(current->getLeft(), depth + 1, total, count);
+        depthHelper(current->getRight(), depth + 1, total, count);
+    }
+};
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void runWorkload(const char* name, const vector<int>& keys, mt19937& rng)
+{
+    int n = keys.size();
+    vector<int> probes(n);
+    for (int i = 0; i < n; i++) {
+        probes[i] = keys[rng() % n];
+    }
+
+    cout << name << " keys=" << n << endl;
+    cout << setw(3) << "k" << setw(14) << "insert Mop/s" << setw(14) << "remove Mop/s"
+         << setw(14) << "find Mop/s" << setw(12) << "rotations" << setw(12) << "avoided"
+         << setw(8) << "height" << setw(11) << "avg depth" << endl;
+
+    int thresholds[] = {1, 2, 3, 4, 6, 8};
+    for (int k : thresholds) {
+        DepthAVLTree tree;
+        tree.setBalanceThreshold(k);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            tree.insert(make_pair(keys[i], i));
+        }
+        double insertSecs = secondsSince(start);
+
+        int height = tree.height();
+        double depth = tree.averageDepth();
+
+        long long found = 0;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            found += (tree.find(probes[i]) != tree.end());
+        }
+        double findSecs = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i += 2) {
+            tree.remove(keys[i]);
+        }
+        double removeSecs = secondsSince(start);
+
+        cout << setw(3) << k << fixed << setprecision(2)
+             << setw(14) << n / insertSecs / 1e6
+             << setw(14) << (n / 2) / removeSecs / 1e6
+             << setw(14) << n / findSecs / 1e6
+             << setw(12) << tree.rotationCount()
+             << setw(12) << tree.avoidedRotationCount()
+             << setw(8) << height
+             << setw(11) << depth << endl;
+        if (found != n) {
+            cerr << "lookup mismatch" << endl;
+        }
+    }
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    mt19937 rng(104);
+
+    // random writes, then bursty writes: runs of ascending keys at random offsets
+    vector<int> randomKeys(n);
+    for (int i = 0; i < n; i++) {
+        randomKeys[i] = rng() % (n * 8);
+    }
+    vector<int> burstKeys;
+    burstKeys.reserve(n);
+    while ((int)burstKeys.size() < n) {
+        int start = rng() % (n * 8);
+        for (int i = 0; i < 64 && (int)burstKeys.size() < n; i++) {
+            burstKeys.push_back(start + i);
+        }
+    }
+
+    runWorkload("random", randomKeys, rng);
+    runWorkload("bursty", burstKeys, rng);
+    return 0;
+}
+
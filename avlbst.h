@@ -5,8 +5,15 @@
 #include <exception>
 #include <cstdlib>
 #include <cstdint>
+#include <cstddef>
+#include <new>
 #include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <fstream>
 #include "bst.h"
+#include "snapshot.h"
 
 struct KeyError { };
 
@@ -131,8 +138,44 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
+    AVLTree();
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    using BinarySearchTree<Key, Value>::find;
+    using BinarySearchTree<Key, Value>::lower_bound;
+
+    // Finger search: start from a caller-held iterator instead of the root
+    iterator find(const Key& key, const iterator& hint) const;
+    iterator lower_bound(const Key& key, const iterator& hint) const;
+    iterator insert(const iterator& hint, const std::pair<const Key, Value> &new_item);
+
+    // Range erase by split/join: O(k + log n), rebalancing once
+    virtual iterator erase(iterator first, iterator last) override;
+    virtual void erase_range(const Key& lo, const Key& hi) override;
+    using BinarySearchTree<Key, Value>::erase;
+
+    // Relaxed balancing: rotate only once |balance| exceeds k (k = 1 is plain AVL)
+    void setBalanceThreshold(int k);
+    int getBalanceThreshold() const;
+    void tighten();
+    virtual void rebalance() override;
+    size_t rotationCount() const;
+    size_t avoidedRotationCount() const;
+    void resetRotationCounts();
+
+    // Moves every node into one contiguous block in van Emde Boas order.
+    // Iterators and node pointers are invalidated.
+    void compact();
+
+    // Binary snapshot of the exact shape; load() replaces the contents.
+    // Keys and values go through SnapshotTraits (see snapshot.h).
+    void save(const std::string& path) const;
+    void save(std::ostream& out) const;
+    void load(const std::string& path);
+    void load(std::istream& in);
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
@@ -141,8 +184,159 @@ protected:
     virtual void removeFix(AVLNode<Key,Value>* n, int diff);
     virtual void rotateRight(AVLNode<Key,Value>* g);
     virtual void rotateLeft(AVLNode<Key,Value>* g);
+    virtual void eraseNode(Node<Key,Value>* n) override;
+
+    // Hooks for trees that keep extra per-node data (see aggregate_avl.h)
+    virtual AVLNode<Key,Value>* createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent);
+    virtual void refreshNode(AVLNode<Key,Value>* n);
+    virtual void refreshPath(AVLNode<Key,Value>* n);
+
+    AVLNode<Key,Value>* insertLeaf(AVLNode<Key,Value>* parent, const std::pair<const Key, Value> &new_item);
+    AVLNode<Key,Value>* fingerSearch(AVLNode<Key,Value>* start, const Key& key) const;
+
+    // Relaxed balancing helpers
+    int relaxedFix(AVLNode<Key,Value>* p, int side, int delta);
+
+    // Split/join on detached subtrees with known heights
+    void eraseRange(const Key* lo, const Key* hi);
+    static int subtreeHeight(AVLNode<Key,Value>* n);
+    void splitTree(AVLNode<Key,Value>* t, int h, const Key& key,
+                   AVLNode<Key,Value>*& less, int& hLess, AVLNode<Key,Value>*& rest, int& hRest);
+    AVLNode<Key,Value>* joinTrees(AVLNode<Key,Value>* l, int hl, AVLNode<Key,Value>* k,
+                                  AVLNode<Key,Value>* r, int hr, int& h);
+    AVLNode<Key,Value>* unlinkMin(AVLNode<Key,Value>*& t, int& h);
+    void freeDetached(AVLNode<Key,Value>* n);
+    int relaxedRebalance(AVLNode<Key,Value>* n);
+    int rotateLeftRelaxed(AVLNode<Key,Value>* g);
+    int rotateRightRelaxed(AVLNode<Key,Value>* g);
+    int restoreBalances(AVLNode<Key,Value>* n);
+
+    // Node storage for compact(); derived node types override these
+    virtual size_t nodeBytes() const;
+    virtual AVLNode<Key,Value>* relocateNode(AVLNode<Key,Value>* n, void* where);
+    virtual void destroyNode(Node<Key,Value>* n) override;
+    void vebOrder(AVLNode<Key,Value>* n, int h, std::vector<AVLNode<Key,Value>*>& out);
+    void vebBottoms(AVLNode<Key,Value>* n, int depth, int h, std::vector<AVLNode<Key,Value>*>& out);
+
+    // Snapshot helpers
+    void saveHelper(std::ostream& out, AVLNode<Key,Value>* n) const;
+    int loadHelper(std::istream& in, AVLNode<Key,Value>* parent, int side,
+                   int depth, int maxDepth, uint64_t& remaining);
+    static int maxHeightFor(uint64_t count, int k);
+
+    int threshold_;
+    size_t rotations_;
+    size_t avoidedRotations_;
+
+    // Blocks made by compact(); a block is freed once its last node is
+    struct NodeArena
+    {
+        char* base;
+        size_t bytes;
+        size_t live;
+    };
+    std::vector<NodeArena> arenas_;
 };
 
+/**
+* Default constructor, which starts out as a strict AVL tree.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree() :
+    BinarySearchTree<Key, Value>(), threshold_(1), rotations_(0), avoidedRotations_(0)
+{
+
+}
+
+/**
+* Clears here rather than in the base destructor so that nodes living in
+* compact() blocks go through destroyNode().
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::~AVLTree()
+{
+  this->clear();
+}
+
+/**
+* Sets the imbalance a node may carry before it gets rotated.
+* k = 1 is a regular AVL tree; larger k trades extra height for fewer
+* rotations. Lowering k runs tighten() so that no node is left above
+* the new threshold.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setBalanceThreshold(int k)
+{
+    if (k < 1 || k > 64) throw std::invalid_argument("Balance threshold must be in [1, 64]");
+    bool lowered = k < threshold_;
+    threshold_ = k;
+    if (lowered) {
+        tighten();
+    }
+}
+
+template<class Key, class Value>
+int AVLTree<Key, Value>::getBalanceThreshold() const
+{
+    return threshold_;
+}
+
+/**
+* Number of single rotations performed since the last reset.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::rotationCount() const
+{
+    return rotations_;
+}
+
+/**
+* Number of times a node went past a balance of +/-1 without being
+* rotated because of the relaxed threshold.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::avoidedRotationCount() const
+{
+    return avoidedRotations_;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::resetRotationCounts()
+{
+    rotations_ = 0;
+    avoidedRotations_ = 0;
+}
+
+/**
+* Allocates the node for a new item. Derived trees override this to
+* allocate their own node type.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent)
+{
+    return new AVLNode<Key, Value>(key, value, parent);
+}
+
+/**
+* Called when n's children were relinked and any data derived from its
+* subtree must be recomputed. Plain AVL nodes carry none.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::refreshNode(AVLNode<Key,Value>* n)
+{
+
+}
+
+/**
+* Called after insert/remove with the lowest node whose subtree changed;
+* everything from n up to the root may need refreshNode(). No-op here.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::refreshPath(AVLNode<Key,Value>* n)
+{
+
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
@@ -152,9 +346,12 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 {
     // TODO
     // if empty -> set n as root, b(n) = 0
+    BST_STAT(inserts);
     if (this->root_ == nullptr) {
-      this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
+      this->root_ = createNode(new_item.first, new_item.second, nullptr);
+      BST_STAT(allocations);
       static_cast<AVLNode<Key, Value>*>(this->root_)->setBalance(0);
+      this->noteInserted(this->root_);
       return;
     }
 
@@ -163,21 +360,37 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
     AVLNode<Key, Value>* parent = nullptr;
     while (current != nullptr) {
       parent = current;
+      BST_STAT(nodesVisited);
       if (new_item.first == current->getKey()) {
+        BST_STAT(comparisons);
         current->setValue(new_item.second);
+        refreshPath(current);
         return;
       }
       else if (new_item.first > current->getKey()) {
         // go right
+        BST_STAT_ADD(comparisons, 2);
         current = current->getRight();
       }
       else {
         // go left
+        BST_STAT_ADD(comparisons, 2);
         current = current->getLeft();
       }    
     }
 
-    AVLNode<Key, Value>* temp = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+    insertLeaf(parent, new_item);
+}
+
+/**
+* Hangs a new node for new_item under parent, which must have an empty
+* child slot on the new key's side, and rebalances. Returns the new node.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::insertLeaf(AVLNode<Key,Value>* parent, const std::pair<const Key, Value> &new_item)
+{
+    AVLNode<Key, Value>* temp = createNode(new_item.first, new_item.second, parent);
+    BST_STAT(allocations);
     // insert new child
     if (new_item.first > parent->getKey()) {
       // AVLNode<Key, Value>* temp = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
@@ -189,10 +402,14 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
       temp->setBalance(0);
       parent->setLeft(temp);
     }
+    this->noteInserted(temp);
 
+    if (threshold_ > 1) {
+      relaxedFix(parent, (temp == parent->getLeft()) ? -1 : 1, 1);
+    }
     // if b(p) was -1, then = 0
     // if b(p) was 1, then = 0
-    if (parent->getBalance() == -1 || parent->getBalance() == 1) {
+    else if (parent->getBalance() == -1 || parent->getBalance() == 1) {
       parent->setBalance(0);
     }
     // if was 0, call insertFix
@@ -209,10 +426,14 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
     }
     
     // cout << "HERERERE" << endl;
+    refreshPath(temp);
+    return temp;
 }
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n) {
+  BST_STAT(insertFixCalls);
+  BST_STAT_DEPTH(insertFixDepth, maxInsertFixDepth);
   if (p == nullptr || p->getParent() == nullptr) {
     return;
   }
@@ -315,6 +536,8 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* g) {
+  rotations_++;
+  BST_STAT(rotateRights);
   // cout << "in here" << endl;
   AVLNode<Key, Value>* p = g->getLeft();
   // cout << g->getKey() << endl;
@@ -368,6 +591,8 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* g) {
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* g) {
+  rotations_++;
+  BST_STAT(rotateLefts);
   AVLNode<Key, Value>* p = g->getRight();
   // AVLNode<Key, Value>* n = p->getRight();
 
@@ -428,18 +653,30 @@ template<class Key, class Value>
 void AVLTree<Key, Value>:: remove(const Key& key)
 {
     // TODO
+    BST_STAT(removes);
     if ((this->root_) == nullptr) {
       return;
     }
     // internalFind to get the node
-    AVLNode<Key, Value>* removeNode = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key,Value>::internalFind(key));
+    Node<Key, Value>* found = BinarySearchTree<Key,Value>::internalFind(key);
+    if (found == nullptr) {
+      return;
+    }
+    eraseNode(found);
+}
+
+/**
+* Unlinks and frees a node that is known to be in the tree, then rebalances.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::eraseNode(Node<Key,Value>* n)
+{
+    AVLNode<Key, Value>* removeNode = static_cast<AVLNode<Key, Value>*>(n);
     AVLNode<Key, Value>* parent;
-    int diff;
+    int diff = 0;
     // AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::root_);
 
-    if (removeNode == nullptr) {
-      return;
-    }
+    this->noteRemoving(removeNode);
 
     // if removeNode has 2 child, swape with pred first
     // now removeNode can ONLY have 0 or 1 child
@@ -469,6 +706,7 @@ void AVLTree<Key, Value>:: remove(const Key& key)
         // removeNode is root
         // cast to AVL
         (this->root_) = nullptr;
+        this->destroyNode(removeNode);
         return;
       }
       if (removeNode == parent->getLeft()) {
@@ -511,13 +749,23 @@ void AVLTree<Key, Value>:: remove(const Key& key)
       }
     }
   
-  delete removeNode;
-  removeFix(parent, diff);
+  this->destroyNode(removeNode);
+  if (threshold_ > 1) {
+    if (parent != nullptr) {
+      relaxedFix(parent, -diff, -1);
+    }
+  }
+  else {
+    removeFix(parent, diff);
+  }
+  refreshPath(parent);
 }
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* n, int diff) {
-  int ndiff;
+  int ndiff = 0;
+  BST_STAT(removeFixCalls);
+  BST_STAT_DEPTH(removeFixDepth, maxRemoveFixDepth);
 
   if (n == nullptr) {
     return;
@@ -649,5 +897,865 @@ void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>*
     n2->setBalance(tempB);
 }
 
+/**
+* Finger search. Climbs from start until the key falls inside the key
+* range of the current subtree, then descends from there. Returns the
+* node holding key, or the last node on the search path (whose child slot
+* on the key's side is empty). The climb stops at the first ancestor
+* whose subtree bounds the key, which for neighbouring keys is often
+* close to start. There is no O(log d) bound, though: two adjacent keys
+* on either side of the root still climb all the way up, so the worst
+* case is the same O(log n) as a root descent, done twice.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::fingerSearch(AVLNode<Key,Value>* start, const Key& key) const
+{
+  AVLNode<Key, Value>* current = start;
+  if (current == nullptr) {
+    current = static_cast<AVLNode<Key, Value>*>(this->root_);
+  }
+  if (current == nullptr) {
+    return nullptr;
+  }
+
+  // climb while the key lies outside the range of current's subtree
+  while (current->getParent() != nullptr) {
+    AVLNode<Key, Value>* p = current->getParent();
+    if (key == current->getKey()) {
+      return current;
+    }
+    else if (key > current->getKey()) {
+      if (current == p->getLeft() && key < p->getKey()) {
+        break;
+      }
+    }
+    else {
+      if (current == p->getRight() && key > p->getKey()) {
+        break;
+      }
+    }
+    current = p;
+  }
+
+  // ordinary descent inside that subtree
+  AVLNode<Key, Value>* last = current;
+  while (current != nullptr) {
+    last = current;
+    if (key == current->getKey()) {
+      return current;
+    }
+    else if (key > current->getKey()) {
+      current = current->getRight();
+    }
+    else {
+      current = current->getLeft();
+    }
+  }
+  return last;
+}
+
+/**
+* find() starting from hint. Falls back to a root descent for end().
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::find(const Key& key, const iterator& hint) const
+{
+  AVLNode<Key, Value>* start = static_cast<AVLNode<Key, Value>*>(this->iteratorNode(hint));
+  AVLNode<Key, Value>* n = fingerSearch(start, key);
+  if (n != nullptr && n->getKey() == key) {
+    return this->makeIterator(n);
+  }
+  return this->end();
+}
+
+/**
+* lower_bound() starting from hint.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::lower_bound(const Key& key, const iterator& hint) const
+{
+  AVLNode<Key, Value>* start = static_cast<AVLNode<Key, Value>*>(this->iteratorNode(hint));
+  AVLNode<Key, Value>* n = fingerSearch(start, key);
+  if (n == nullptr || !(n->getKey() < key)) {
+    return this->makeIterator(n);
+  }
+  return this->makeIterator(this->successor(n));
+}
+
+/**
+* insert() starting from hint. Returns an iterator to the inserted
+* (or overwritten) item, which makes a good hint for the next call.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::insert(const iterator& hint, const std::pair<const Key, Value> &new_item)
+{
+  AVLNode<Key, Value>* start = static_cast<AVLNode<Key, Value>*>(this->iteratorNode(hint));
+  AVLNode<Key, Value>* n = fingerSearch(start, new_item.first);
+  if (n == nullptr) {
+    insert(new_item);
+    return this->makeIterator(this->root_);
+  }
+  if (n->getKey() == new_item.first) {
+    n->setValue(new_item.second);
+    refreshPath(n);
+    return this->makeIterator(n);
+  }
+  return this->makeIterator(insertLeaf(n, new_item));
+}
+
+/**
+* Erases [first, last). Node positions are preserved by split/join, so
+* the returned iterator (to what last pointed at) stays valid.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::erase(iterator first, iterator last)
+{
+  if (first == last) {
+    return last;
+  }
+  Key lo = first->first;
+  if (last == this->end()) {
+    eraseRange(&lo, nullptr);
+    return this->end();
+  }
+  Node<Key, Value>* stop = this->iteratorNode(last);
+  eraseRange(&lo, &stop->getKey());
+  return this->makeIterator(stop);
+}
+
+/**
+* Erases every key with lo <= key < hi.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::erase_range(const Key& lo, const Key& hi)
+{
+  if (lo < hi) {
+    eraseRange(&lo, &hi);
+  }
+}
+
+/**
+* Splits the tree into [.., lo), [lo, hi) and [hi, ..), frees the middle
+* piece and joins the outer two. A NULL bound means unbounded. Splitting
+* and joining touch O(log n) nodes in total, so erasing k keys costs
+* O(k + log n) rather than k separate removals and fix-ups.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::eraseRange(const Key* lo, const Key* hi)
+{
+  AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+  if (root == nullptr) {
+    return;
+  }
+  int h = subtreeHeight(root);
+
+  AVLNode<Key, Value>* left = nullptr;
+  int hLeft = 0;
+  AVLNode<Key, Value>* middle = root;
+  int hMiddle = h;
+  if (lo != nullptr) {
+    splitTree(root, h, *lo, left, hLeft, middle, hMiddle);
+  }
+  AVLNode<Key, Value>* right = nullptr;
+  int hRight = 0;
+  if (hi != nullptr) {
+    AVLNode<Key, Value>* rest = middle;
+    splitTree(rest, hMiddle, *hi, middle, hMiddle, right, hRight);
+  }
+  freeDetached(middle);
+
+  if (left == nullptr) {
+    this->root_ = right;
+  }
+  else if (right == nullptr) {
+    this->root_ = left;
+  }
+  else {
+    // the smallest key on the right becomes the pivot of the join
+    AVLNode<Key, Value>* pivot = unlinkMin(right, hRight);
+    this->root_ = joinTrees(left, hLeft, pivot, right, hRight, h);
+  }
+  if (this->root_ != nullptr) {
+    this->root_->setParent(nullptr);
+  }
+  this->leftmost_ = this->findMostLeft(this->root_);
+  this->rightmost_ = this->findMostRight(this->root_);
+}
+
+/**
+* Height of the subtree at n, following the taller child. O(height).
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(AVLNode<Key,Value>* n)
+{
+  int h = 0;
+  while (n != nullptr) {
+    h++;
+    n = (n->getBalance() > 0) ? n->getRight() : n->getLeft();
+  }
+  return h;
+}
+
+/**
+* Splits the detached subtree t of height h into the keys < key and the
+* keys >= key, returning both roots and heights. Child heights come from
+* the balance factors, so no subtree is ever measured.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::splitTree(AVLNode<Key,Value>* t, int h, const Key& key,
+                                    AVLNode<Key,Value>*& less, int& hLess,
+                                    AVLNode<Key,Value>*& rest, int& hRest)
+{
+  if (t == nullptr) {
+    less = rest = nullptr;
+    hLess = hRest = 0;
+    return;
+  }
+  int b = t->getBalance();
+  int hl = h - 1 - std::max(0, b);
+  int hr = h - 1 - std::max(0, -b);
+  AVLNode<Key, Value>* l = t->getLeft();
+  AVLNode<Key, Value>* r = t->getRight();
+  if (l != nullptr) {
+    l->setParent(nullptr);
+  }
+  if (r != nullptr) {
+    r->setParent(nullptr);
+  }
+
+  if (t->getKey() < key) {
+    AVLNode<Key, Value>* mid;
+    int hMid;
+    splitTree(r, hr, key, mid, hMid, rest, hRest);
+    less = joinTrees(l, hl, t, mid, hMid, hLess);
+  }
+  else {
+    AVLNode<Key, Value>* mid;
+    int hMid;
+    splitTree(l, hl, key, less, hLess, mid, hMid);
+    rest = joinTrees(mid, hMid, t, r, hr, hRest);
+  }
+}
+
+/**
+* Joins detached trees l < k < r into one balanced tree and returns its
+* root and height. The shorter tree hangs off the spine of the taller one
+* with k on top, then the usual retracing runs from there. Costs
+* O(|hl - hr| + 1). root_ is borrowed as the working tree so rotations at
+* the top land in the right place.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::joinTrees(AVLNode<Key,Value>* l, int hl, AVLNode<Key,Value>* k,
+                                                   AVLNode<Key,Value>* r, int hr, int& h)
+{
+  if (abs(hl - hr) <= 1) {
+    k->setParent(nullptr);
+    k->setLeft(l);
+    k->setRight(r);
+    if (l != nullptr) {
+      l->setParent(k);
+    }
+    if (r != nullptr) {
+      r->setParent(k);
+    }
+    k->setBalance(hr - hl);
+    this->refreshNode(k);
+    h = 1 + std::max(hl, hr);
+    return k;
+  }
+
+  bool leftTaller = hl > hr;
+  AVLNode<Key, Value>* c = leftTaller ? l : r;
+  int hc = leftTaller ? hl : hr;
+  int hShort = leftTaller ? hr : hl;
+  AVLNode<Key, Value>* p = nullptr;
+  // walk down the inner spine of the taller tree
+  while (hc > hShort + 1) {
+    int b = c->getBalance();
+    p = c;
+    if (leftTaller) {
+      hc = hc - 1 - std::max(0, -b);
+      c = c->getRight();
+    }
+    else {
+      hc = hc - 1 - std::max(0, b);
+      c = c->getLeft();
+    }
+  }
+
+  this->root_ = leftTaller ? l : r;
+  k->setParent(p);
+  if (leftTaller) {
+    p->setRight(k);
+    k->setLeft(c);
+    k->setRight(r);
+    k->setBalance(hShort - hc);
+  }
+  else {
+    p->setLeft(k);
+    k->setLeft(l);
+    k->setRight(c);
+    k->setBalance(hc - hShort);
+  }
+  if (c != nullptr) {
+    c->setParent(k);
+  }
+  AVLNode<Key, Value>* shortRoot = leftTaller ? r : l;
+  if (shortRoot != nullptr) {
+    shortRoot->setParent(k);
+  }
+
+  int grow = 1 + std::max(hc, hShort) - hc;
+  int d = relaxedFix(p, leftTaller ? 1 : -1, grow);
+  h = (leftTaller ? hl : hr) + d;
+  this->refreshPath(k);
+  return static_cast<AVLNode<Key, Value>*>(this->root_);
+}
+
+/**
+* Removes the smallest node from the detached tree t without freeing it.
+* t and h are updated to the remaining tree.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::unlinkMin(AVLNode<Key,Value>*& t, int& h)
+{
+  AVLNode<Key, Value>* m = t;
+  while (m->getLeft() != nullptr) {
+    m = m->getLeft();
+  }
+  AVLNode<Key, Value>* p = m->getParent();
+  AVLNode<Key, Value>* r = m->getRight();
+  if (r != nullptr) {
+    r->setParent(p);
+  }
+  if (p == nullptr) {
+    t = r;
+    h = h - 1;
+  }
+  else {
+    p->setLeft(r);
+    this->root_ = t;
+    h += relaxedFix(p, -1, -1);
+    this->refreshPath(p);
+    t = static_cast<AVLNode<Key, Value>*>(this->root_);
+  }
+  m->setParent(nullptr);
+  m->setLeft(nullptr);
+  m->setRight(nullptr);
+  return m;
+}
+
+/**
+* Frees a detached subtree, keeping size and the lookup cache in step.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::freeDetached(AVLNode<Key,Value>* n)
+{
+  if (n == nullptr) {
+    return;
+  }
+  freeDetached(n->getLeft());
+  freeDetached(n->getRight());
+  this->forgetNode(n);
+  this->size_--;
+  this->destroyNode(n);
+}
+
+/**
+* Retracing for the relaxed mode. The child of p on the given side
+* (-1 left, 1 right) changed height by delta. Walks up while subtree
+* heights keep changing, rotating only nodes whose |balance| exceeds
+* the threshold. Heights are tracked relative to p's left subtree, so
+* no node needs more than its balance factor. Returns how much the height
+* of the whole tree changed.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::relaxedFix(AVLNode<Key,Value>* p, int side, int delta) {
+  while (p != nullptr) {
+    int b = p->getBalance();
+    int hl = 0;
+    int hr = b;
+    if (side < 0) {
+      hl += delta;
+    }
+    else {
+      hr += delta;
+    }
+    int nb = hr - hl;
+    int d = std::max(hl, hr) - std::max(0, b);
+    p->setBalance(nb);
+
+    AVLNode<Key, Value>* top = p;
+    if (abs(nb) > threshold_) {
+      d += relaxedRebalance(p);
+      top = p->getParent();
+    }
+    else if (abs(nb) == 2 && abs(b) == 1) {
+      // a strict AVL tree would have rotated here
+      avoidedRotations_++;
+    }
+
+    if (d == 0) {
+      return 0;
+    }
+    p = top->getParent();
+    if (p != nullptr) {
+      side = (top == p->getLeft()) ? -1 : 1;
+      delta = d;
+    }
+    else {
+      return d;
+    }
+  }
+  return 0;
+}
+
+/**
+* Rotates n (single or double) once its balance is one past the threshold.
+* Returns the resulting change in height of the subtree n used to root.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::relaxedRebalance(AVLNode<Key,Value>* n) {
+  int b = n->getBalance();
+  if (b > 0) {
+    AVLNode<Key, Value>* c = n->getRight();
+    if (c->getBalance() < 0) {
+      // zig-zag: the right subtree of n changes height first
+      int d1 = rotateRightRelaxed(c);
+      n->setBalance(b + d1);
+      return std::max(0, b + d1) - std::max(0, b) + rotateLeftRelaxed(n);
+    }
+    return rotateLeftRelaxed(n);
+  }
+  else {
+    AVLNode<Key, Value>* c = n->getLeft();
+    if (c->getBalance() > 0) {
+      int d1 = rotateLeftRelaxed(c);
+      n->setBalance(b - d1);
+      return std::max(0, -(b - d1)) - std::max(0, -b) + rotateRightRelaxed(n);
+    }
+    return rotateRightRelaxed(n);
+  }
+}
+
+/**
+* rotateLeft that recomputes both balances for arbitrary balance factors
+* and returns the height change of the rotated subtree.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::rotateLeftRelaxed(AVLNode<Key,Value>* g) {
+  AVLNode<Key, Value>* c = g->getRight();
+  int bc = c->getBalance();
+  // heights relative to g's left subtree
+  int hc = g->getBalance();
+  int hB, hC;
+  if (bc >= 0) {
+    hC = hc - 1;
+    hB = hC - bc;
+  }
+  else {
+    hB = hc - 1;
+    hC = hB + bc;
+  }
+  int before = 1 + std::max(0, hc);
+  int hg = 1 + std::max(0, hB);
+  int after = 1 + std::max(hg, hC);
+
+  rotateLeft(g);
+  g->setBalance(hB);
+  c->setBalance(hC - hg);
+  return after - before;
+}
+
+/**
+* Mirror image of rotateLeftRelaxed.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::rotateRightRelaxed(AVLNode<Key,Value>* g) {
+  AVLNode<Key, Value>* c = g->getLeft();
+  int bc = c->getBalance();
+  // heights relative to g's right subtree
+  int hc = -g->getBalance();
+  int hA, hB;
+  if (bc <= 0) {
+    hA = hc - 1;
+    hB = hA + bc;
+  }
+  else {
+    hB = hc - 1;
+    hA = hB - bc;
+  }
+  int before = 1 + std::max(hc, 0);
+  int hg = 1 + std::max(hB, 0);
+  int after = 1 + std::max(hA, hg);
+
+  rotateRight(g);
+  g->setBalance(-hB);
+  c->setBalance(hg - hA);
+  return after - before;
+}
+
+/**
+* Deferred rebalancing pass for trees built in relaxed mode; the same as
+* rebalance().
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::tighten()
+{
+  rebalance();
+}
+
+/**
+* Runs the in-place Day-Stout-Warren pass from BinarySearchTree, then
+* recomputes balance factors (and any per-node data) bottom-up. The
+* result is perfectly balanced, so it satisfies any threshold.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebalance()
+{
+  BinarySearchTree<Key, Value>::rebalance();
+  restoreBalances(static_cast<AVLNode<Key, Value>*>(this->root_));
+}
+
+/**
+* Post-order pass that sets every balance from the real subtree heights
+* and returns the height of n.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::restoreBalances(AVLNode<Key,Value>* n)
+{
+  if (n == nullptr) {
+    return 0;
+  }
+  int hl = restoreBalances(n->getLeft());
+  int hr = restoreBalances(n->getRight());
+  n->setBalance(hr - hl);
+  refreshNode(n);
+  return 1 + std::max(hl, hr);
+}
+
+/**
+* Relinks a fragmented tree into a single block. Nodes are copied in van
+* Emde Boas order: the top half of the levels first, then each subtree
+* hanging below it, recursively, so a root-to-leaf search touches
+* O(log_B n) cache lines for any line size B. Shape, balance factors and
+* items are unchanged; only addresses move. Old nodes are forwarded
+* through their parent pointers while the new links are patched, so the
+* only extra memory is the order vector.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::compact()
+{
+  if (this->root_ == nullptr) {
+    return;
+  }
+  std::vector<AVLNode<Key, Value>*> order;
+  order.reserve(this->size_);
+  AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+  vebOrder(root, subtreeHeight(root), order);
+
+  const size_t align = alignof(std::max_align_t);
+  size_t stride = (nodeBytes() + align - 1) / align * align;
+  NodeArena arena;
+  arena.bytes = stride * order.size();
+  arena.base = static_cast<char*>(::operator new(arena.bytes));
+  arena.live = order.size();
+
+  // copy, then leave a forwarding pointer in the old node's parent slot
+  for (size_t i = 0; i < order.size(); i++) {
+    AVLNode<Key, Value>* moved = relocateNode(order[i], arena.base + i * stride);
+    BST_STAT(allocations);
+    order[i]->setParent(moved);
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    AVLNode<Key, Value>* moved = order[i]->getParent();
+    if (moved->getParent() != nullptr) {
+      moved->setParent(moved->getParent()->getParent());
+    }
+    if (moved->getLeft() != nullptr) {
+      moved->setLeft(moved->getLeft()->getParent());
+    }
+    if (moved->getRight() != nullptr) {
+      moved->setRight(moved->getRight()->getParent());
+    }
+  }
+  this->root_ = this->root_->getParent();
+  this->leftmost_ = this->leftmost_->getParent();
+  this->rightmost_ = this->rightmost_->getParent();
+
+  for (size_t i = 0; i < order.size(); i++) {
+    destroyNode(order[i]);
+  }
+  arenas_.push_back(arena);
+  if (!this->lookupCache_.empty()) {
+    this->lookupCache_.assign(this->lookupCache_.size(), nullptr);
+  }
+}
+
+/**
+* Appends the subtree at n, cut to h levels, in van Emde Boas order.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::vebOrder(AVLNode<Key,Value>* n, int h, std::vector<AVLNode<Key,Value>*>& out)
+{
+  if (n == nullptr) {
+    return;
+  }
+  if (h == 1) {
+    out.push_back(n);
+    return;
+  }
+  int top = h / 2;
+  vebOrder(n, top, out);
+  vebBottoms(n, top, h - top, out);
+}
+
+/**
+* Lays out, left to right, every subtree rooted depth levels below n.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::vebBottoms(AVLNode<Key,Value>* n, int depth, int h, std::vector<AVLNode<Key,Value>*>& out)
+{
+  if (n == nullptr) {
+    return;
+  }
+  if (depth == 0) {
+    vebOrder(n, h, out);
+    return;
+  }
+  vebBottoms(n->getLeft(), depth - 1, h, out);
+  vebBottoms(n->getRight(), depth - 1, h, out);
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::nodeBytes() const
+{
+  return sizeof(AVLNode<Key, Value>);
+}
+
+/**
+* Copies n into the raw storage at where. The copy keeps n's links.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::relocateNode(AVLNode<Key,Value>* n, void* where)
+{
+  return new (where) AVLNode<Key, Value>(*n);
+}
+
+/**
+* Nodes inside a compact() block are destroyed in place; the block goes
+* back to the heap with its last node.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::destroyNode(Node<Key,Value>* n)
+{
+  uintptr_t addr = reinterpret_cast<uintptr_t>(n);
+  for (size_t i = 0; i < arenas_.size(); i++) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(arenas_[i].base);
+    if (addr >= base && addr < base + arenas_[i].bytes) {
+      BST_STAT(frees);
+      n->~Node();
+      if (--arenas_[i].live == 0) {
+        ::operator delete(arenas_[i].base);
+        arenas_.erase(arenas_.begin() + i);
+      }
+      return;
+    }
+  }
+  BST_STAT(frees);
+  delete n;
+}
+
+/*
+  Snapshot format, host byte order:
+
+    char     magic[8]      "AVLSNAP1"
+    uint64_t count
+    int32_t  threshold
+    count records in pre-order:
+      uint8_t  children    bit 0 = has left child, bit 1 = has right child
+      int8_t   balance
+      Key, Value           as written by SnapshotTraits
+*/
+static const char AVL_SNAPSHOT_MAGIC[8] = { 'A', 'V', 'L', 'S', 'N', 'A', 'P', '1' };
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::save(const std::string& path) const
+{
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out) throw std::runtime_error("Cannot open " + path + " for writing");
+  save(out);
+  out.close();
+  if (!out) throw std::runtime_error("Error writing " + path);
+}
+
+/**
+* Writes the tree in pre-order with each node's balance, which together
+* pin down the exact shape, so load() needs no comparisons or rotations.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::save(std::ostream& out) const
+{
+  uint64_t count = this->size_;
+  int32_t threshold = threshold_;
+  out.write(AVL_SNAPSHOT_MAGIC, sizeof(AVL_SNAPSHOT_MAGIC));
+  out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  out.write(reinterpret_cast<const char*>(&threshold), sizeof(threshold));
+  saveHelper(out, static_cast<AVLNode<Key, Value>*>(this->root_));
+  if (!out) throw std::runtime_error("Error writing snapshot");
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::saveHelper(std::ostream& out, AVLNode<Key,Value>* n) const
+{
+  if (n == nullptr) {
+    return;
+  }
+  uint8_t children = (n->getLeft() != nullptr ? 1 : 0) | (n->getRight() != nullptr ? 2 : 0);
+  int8_t balance = n->getBalance();
+  out.put(static_cast<char>(children));
+  out.put(static_cast<char>(balance));
+  SnapshotTraits<Key>::write(out, n->getKey());
+  SnapshotTraits<Value>::write(out, n->getValue());
+  saveHelper(out, n->getLeft());
+  saveHelper(out, n->getRight());
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::load(const std::string& path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in) throw std::runtime_error("Cannot open " + path + " for reading");
+  load(in);
+}
+
+/**
+* Rebuilds the saved tree in O(n) from a single sequential read. The
+* recorded balances are checked against the heights actually read, so a
+* truncated or corrupt snapshot throws std::runtime_error and leaves the
+* tree as it was. The tree keeps its own balance threshold: a snapshot
+* saved with a looser one is validated against that, then tightened.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::load(std::istream& in)
+{
+  char magic[sizeof(AVL_SNAPSHOT_MAGIC)];
+  uint64_t count = 0;
+  int32_t threshold = 0;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&count), sizeof(count));
+  in.read(reinterpret_cast<char*>(&threshold), sizeof(threshold));
+  if (!in || !std::equal(magic, magic + sizeof(magic), AVL_SNAPSHOT_MAGIC)) {
+    throw std::runtime_error("Not an AVL snapshot");
+  }
+  if (threshold < 1 || threshold > 64) {
+    throw std::runtime_error("Corrupt snapshot header");
+  }
+
+  // build beside the current contents and only swap them out on success
+  Node<Key, Value>* oldRoot = this->root_;
+  Node<Key, Value>* oldLeftmost = this->leftmost_;
+  Node<Key, Value>* oldRightmost = this->rightmost_;
+  size_t oldSize = this->size_;
+  int oldThreshold = threshold_;
+  this->root_ = nullptr;
+  threshold_ = threshold;
+  uint64_t remaining = count;
+  try {
+    if (count > 0) {
+      loadHelper(in, nullptr, 0, 1, maxHeightFor(count, threshold), remaining);
+    }
+    if (remaining != 0) {
+      throw std::runtime_error("Corrupt snapshot");
+    }
+  }
+  catch (...) {
+    this->clearHelper(this->root_);
+    this->root_ = oldRoot;
+    this->leftmost_ = oldLeftmost;
+    this->rightmost_ = oldRightmost;
+    this->size_ = oldSize;
+    threshold_ = oldThreshold;
+    throw;
+  }
+  Node<Key, Value>* newRoot = this->root_;
+  this->root_ = oldRoot;
+  this->clear();
+  this->root_ = newRoot;
+  this->size_ = count;
+  this->leftmost_ = BinarySearchTree<Key, Value>::findMostLeft(this->root_);
+  this->rightmost_ = BinarySearchTree<Key, Value>::findMostRight(this->root_);
+  // nodes were linked directly, so the Bloom filter has not seen them
+  this->bloomStale_ = true;
+  threshold_ = oldThreshold;
+  if (threshold > oldThreshold) {
+    tighten();
+  }
+}
+
+/**
+* Reads one pre-order record and its subtrees, returning the subtree
+* height. Each node is linked in on the given side of parent (0 for the
+* root) as soon as it exists, so a partial load can be freed.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::loadHelper(std::istream& in, AVLNode<Key,Value>* parent, int side,
+                                    int depth, int maxDepth, uint64_t& remaining)
+{
+  if (remaining == 0 || depth > maxDepth) {
+    throw std::runtime_error("Corrupt snapshot");
+  }
+  remaining--;
+  int children = in.get();
+  int balance = static_cast<int8_t>(in.get());
+  Key key = SnapshotTraits<Key>::read(in);
+  Value value = SnapshotTraits<Value>::read(in);
+  if (!in || children < 0 || children > 3) {
+    throw std::runtime_error("Corrupt snapshot");
+  }
+
+  AVLNode<Key, Value>* n = createNode(key, value, parent);
+  BST_STAT(allocations);
+  n->setBalance(balance);
+  if (side < 0) {
+    parent->setLeft(n);
+  }
+  else if (side > 0) {
+    parent->setRight(n);
+  }
+  else {
+    this->root_ = n;
+  }
+
+  int hl = (children & 1) ? loadHelper(in, n, -1, depth + 1, maxDepth, remaining) : 0;
+  int hr = (children & 2) ? loadHelper(in, n, 1, depth + 1, maxDepth, remaining) : 0;
+  if (hr - hl != balance || std::abs(balance) > threshold_) {
+    throw std::runtime_error("Corrupt snapshot");
+  }
+  refreshNode(n);
+  return 1 + std::max(hl, hr);
+}
+
+/**
+* The tallest tree of count nodes whose balances stay within k: the
+* sparsest such tree of height h has N(h) = 1 + N(h-1) + N(h-1-k) nodes.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::maxHeightFor(uint64_t count, int k)
+{
+  std::vector<uint64_t> minNodes(1, 0);
+  while (true) {
+    int h = static_cast<int>(minNodes.size()) - 1;
+    uint64_t next = 1 + minNodes[h] + (h >= k ? minNodes[h - k] : 0);
+    if (next > count) {
+      return h;
+    }
+    minNodes.push_back(next);
+  }
+}
 
 #endif
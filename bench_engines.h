@@ -0,0 +1,69 @@
+#ifndef BENCH_ENGINES_H
+#define BENCH_ENGINES_H
+
+#include <map>
+#include <utility>
+#include "bst.h"
+
+/*
+  Adapters that give BinarySearchTree-style trees and std::map one
+  interface, so bst-bench and bst-replay write each workload once.
+  Values are ints; iterate() returns their sum so the traversal cannot
+  be optimized away.
+*/
+
+template <template <typename, typename> class Tree, typename Key>
+struct TreeEngine
+{
+    Tree<Key, int> tree;
+
+    void insert(const Key& key, int value)
+    {
+        tree.insert(std::make_pair(key, value));
+    }
+    bool find(const Key& key) const
+    {
+        return tree.find(key) != tree.end();
+    }
+    void remove(const Key& key)
+    {
+        tree.remove(key);
+    }
+    long long iterate() const
+    {
+        long long sum = 0;
+        for (typename Tree<Key, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+};
+
+template <typename Key>
+struct MapEngine
+{
+    std::map<Key, int> tree;
+
+    void insert(const Key& key, int value)
+    {
+        tree[key] = value;
+    }
+    bool find(const Key& key) const
+    {
+        return tree.find(key) != tree.end();
+    }
+    void remove(const Key& key)
+    {
+        tree.erase(key);
+    }
+    long long iterate() const
+    {
+        long long sum = 0;
+        for (typename std::map<Key, int>::const_iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+* Spreads a std::hash result over all 64 bits (the splitmix64 finalizer);
+* std::hash of an integer is often the integer itself.
+*/
+inline uint64_t bloomMix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+template <typename Key, typename Hash = std::hash<Key> >
+uint64_t bloomHash(const Key& key)
+{
+    return bloomMix(static_cast<uint64_t>(Hash()(key)));
+}
+
+/**
+* A blocked Bloom filter: every key sets all of its bits inside one
+* 64-byte block, so a probe costs a single cache miss. Keys are given as
+* 64-bit hashes (see bloomHash). A filter built with no capacity answers
+* "maybe" to everything.
+*/
+class BloomFilter
+{
+public:
+    BloomFilter();
+    BloomFilter(size_t expectedKeys, double bitsPerKey);
+
+    void reset(size_t expectedKeys, double bitsPerKey);
+    void clear();
+    void add(uint64_t hash);
+    bool mayContain(uint64_t hash) const;
+
+    size_t keyCount() const;
+    size_t memoryBytes() const;
+    double falsePositiveRate() const;
+
+    void write(std::ostream& out) const;
+    bool read(std::istream& in);
+
+private:
+    static const size_t WORDS_PER_BLOCK = 8;
+
+    size_t blockOffset(uint64_t hash) const;
+
+    std::vector<uint64_t> words_;
+    size_t blocks_;
+    unsigned probes_;
+    size_t keys_;
+};
+
+inline BloomFilter::BloomFilter() :
+    blocks_(0), probes_(0), keys_(0)
+{
+
+}
+
+inline BloomFilter::BloomFilter(size_t expectedKeys, double bitsPerKey) :
+    blocks_(0), probes_(0), keys_(0)
+{
+    reset(expectedKeys, bitsPerKey);
+}
+
+/**
+* Sizes the filter for expectedKeys at bitsPerKey and empties it. The
+* probe count is the usual bitsPerKey * ln 2, kept in [1, 16].
+*/
+inline void BloomFilter::reset(size_t expectedKeys, double bitsPerKey)
+{
+    size_t bits = static_cast<size_t>(std::ceil(expectedKeys * bitsPerKey));
+    blocks_ = (bits + 511) / 512;
+    if (blocks_ == 0) {
+        blocks_ = 1;
+    }
+    double k = std::floor(bitsPerKey * 0.69314718 + 0.5);
+    probes_ = static_cast<unsigned>(k < 1 ? 1 : (k > 16 ? 16 : k));
+    words_.assign(blocks_ * WORDS_PER_BLOCK, 0);
+    keys_ = 0;
+}
+
+/**
+* Empties the filter, keeping its size.
+*/
+inline void BloomFilter::clear()
+{
+    words_.assign(words_.size(), 0);
+    keys_ = 0;
+}
+
+inline size_t BloomFilter::blockOffset(uint64_t hash) const
+{
+    // multiply-shift maps the high half onto [0, blocks_) without a divide
+    size_t index = static_cast<size_t>(((hash >> 32) * (uint64_t)blocks_) >> 32);
+    return index * WORDS_PER_BLOCK;
+}
+
+inline void BloomFilter::add(uint64_t hash)
+{
+    if (words_.empty()) {
+        return;
+    }
+    uint64_t* b = &words_[blockOffset(hash)];
+    uint32_t h1 = static_cast<uint32_t>(hash);
+    uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+    for (unsigned i = 0; i < probes_; i++) {
+        uint32_t bit = (h1 + i * h2) & 511;
+        b[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    keys_++;
+}
+
+/**
+* false means the key was never added; true means it probably was.
+*/
+inline bool BloomFilter::mayContain(uint64_t hash) const
+{
+    if (words_.empty()) {
+        return true;
+    }
+    const uint64_t* b = &words_[blockOffset(hash)];
+    uint32_t h1 = static_cast<uint32_t>(hash);
+    uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+    for (unsigned i = 0; i < probes_; i++) {
+        uint32_t bit = (h1 + i * h2) & 511;
+        if ((b[bit >> 6] & (1ULL << (bit & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline size_t BloomFilter::keyCount() const
+{
+    return keys_;
+}
+
+inline size_t BloomFilter::memoryBytes() const
+{
+    return words_.size() * sizeof(uint64_t);
+}
+
+/**
+* Expected false-positive rate from the bits actually set: the chance
+* that all probes of an absent key land on set bits.
+*/
+inline double BloomFilter::falsePositiveRate() const
+{
+    if (words_.empty()) {
+        return 1.0;
+    }
+    size_t set = 0;
+    for (size_t i = 0; i < words_.size(); i++) {
+        set += __builtin_popcountll(words_[i]);
+    }
+    return std::pow(static_cast<double>(set) / (words_.size() * 64), static_cast<double>(probes_));
+}
+
+/**
+* Host byte order: block count, probe count, key count, then the words.
+*/
+inline void BloomFilter::write(std::ostream& out) const
+{
+    uint64_t header[3] = { blocks_, probes_, keys_ };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(words_.data()), words_.size() * sizeof(uint64_t));
+}
+
+inline bool BloomFilter::read(std::istream& in)
+{
+    uint64_t header[3];
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || header[1] > 16 || header[0] > (1ULL << 32)) {
+        return false;
+    }
+    blocks_ = static_cast<size_t>(header[0]);
+    probes_ = static_cast<unsigned>(header[1]);
+    keys_ = static_cast<size_t>(header[2]);
+    words_.assign(blocks_ * WORDS_PER_BLOCK, 0);
+    in.read(reinterpret_cast<char*>(words_.data()), words_.size() * sizeof(uint64_t));
+    return static_cast<bool>(in);
+}
+
+#endif
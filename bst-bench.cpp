@@ -0,0 +1,472 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "bench_engines.h"
+
+using namespace std;
+
+/*
+  Micro-benchmarks for BinarySearchTree, AVLTree and std::map.
+
+    bst-bench [--engines bst,avl,map] [--workloads insert,find,remove,iterate,mixed]
+              [--patterns sequential,random,zipf,window] [--sizes 1000,100000,1000000]
+              [--repeat N] [--seed S] [--format text|csv|json]
+
+  Every case runs in a forked child so its peak RSS is its own. Building
+  the tree a case starts from is not timed; the best of --repeat runs is
+  reported. The default sizes stop at 1M keys; larger runs such as
+  --sizes 50000000 work, but each 50M-key case needs over 3GB of memory
+  and can take ten minutes or more. Key patterns:
+
+    sequential  keys in ascending order
+    random      uniformly random keys
+    zipf        Zipf(0.99) popularity, hot keys scattered over the key space
+    window      for insert, find and remove: keys within 1024 of a cursor
+                that sweeps the key space once (locality without strict
+                order); for mixed: the n live keys themselves slide
+                upward, each write inserting the next key and removing
+                the oldest (time-series style)
+
+  The unbalanced BinarySearchTree degenerates into a list when it is fed
+  nearly ascending keys (sequential or window inserts, window mixed), so
+  those cases are skipped for it above MAX_DEGENERATE_KEYS.
+*/
+
+static const size_t MAX_DEGENERATE_KEYS = 20000;
+static volatile long long sink;
+
+struct Result
+{
+    string engine;
+    string workload;
+    string pattern;
+    size_t keys;
+    size_t ops;
+    double seconds;
+    long peakRssKb;
+};
+
+/**
+* Zipf ranks in [0, n) by the rejection-free method of Gray et al.
+* (as used by YCSB); rank 0 is the most popular.
+*/
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta) : n_(n), theta_(theta)
+    {
+        double zetan = 0;
+        for (size_t i = 1; i <= n; i++) {
+            zetan += 1.0 / pow((double)i, theta);
+        }
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        zetan_ = zetan;
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    size_t next(mt19937_64& rng)
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + pow(0.5, theta_)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+/**
+* count keys in [0, n) following pattern. Zipf ranks are multiplied by a
+* large odd constant so popular keys do not sit next to each other.
+*/
+static vector<int> makeKeys(const string& pattern, size_t n, size_t count, mt19937_64& rng)
+{
+    vector<int> keys(count);
+    if (pattern == "sequential") {
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = (int)(i % n);
+        }
+    }
+    else if (pattern == "zipf") {
+        ZipfGenerator zipf(n, 0.99);
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = (int)((zipf.next(rng) * 2654435761ULL) % n);
+        }
+    }
+    else if (pattern == "window") {
+        // probes stay close to a cursor that sweeps the key space once
+        const size_t width = 1024;
+        for (size_t i = 0; i < count; i++) {
+            size_t base = (size_t)((double)i / count * n);
+            keys[i] = (int)((base + rng() % width) % n);
+        }
+    }
+    else {
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = (int)(rng() % n);
+        }
+    }
+    return keys;
+}
+
+static vector<int> shuffledKeys(size_t n, mt19937_64& rng)
+{
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (int)i;
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Runs one workload on a fresh engine and returns the timed seconds.
+*/
+template <typename Engine>
+static double runOnce(const string& workload, const string& pattern, size_t n,
+                      unsigned seed, size_t& ops)
+{
+    mt19937_64 rng(seed);
+    Engine engine;
+    long long found = 0;
+    ops = n;
+
+    if (workload == "insert") {
+        vector<int> keys = (pattern == "random") ? shuffledKeys(n, rng)
+                                                 : makeKeys(pattern, n, n, rng);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            engine.insert(keys[i], (int)i);
+        }
+        return secondsSince(start);
+    }
+
+    // every other workload starts from keys 0..n-1 inserted in random order
+    vector<int> build = shuffledKeys(n, rng);
+    for (size_t i = 0; i < n; i++) {
+        engine.insert(build[i], (int)i);
+    }
+    vector<int>().swap(build);
+
+    if (workload == "find") {
+        vector<int> probes = makeKeys(pattern, n, n, rng);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            found += engine.find(probes[i]);
+        }
+        double secs = secondsSince(start);
+        sink = found;
+        return secs;
+    }
+    if (workload == "remove") {
+        vector<int> keys = (pattern == "random") ? shuffledKeys(n, rng)
+                                                 : makeKeys(pattern, n, n, rng);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            engine.remove(keys[i]);
+        }
+        return secondsSince(start);
+    }
+    if (workload == "iterate") {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        sink = engine.iterate();
+        return secondsSince(start);
+    }
+
+    // mixed: half finds, a quarter each inserts and removes
+    // window: writes insert the next key and retire the oldest, so the
+    // live set slides upward; finds are offsets into the live window
+    vector<int> keys = makeKeys((pattern == "window") ? "random" : pattern, n, n, rng);
+    vector<unsigned char> kinds(n);
+    for (size_t i = 0; i < n; i++) {
+        kinds[i] = (unsigned char)(rng() % 4);
+    }
+    size_t next = n;
+    size_t oldest = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        if (kinds[i] < 2) {
+            found += engine.find((pattern == "window") ? (int)oldest + keys[i] : keys[i]);
+        }
+        else if (pattern == "window") {
+            engine.insert((int)next++, (int)i);
+            engine.remove((int)oldest++);
+        }
+        else if (kinds[i] == 2) {
+            engine.insert(keys[i], (int)i);
+        }
+        else {
+            engine.remove(keys[i]);
+        }
+    }
+    double secs = secondsSince(start);
+    sink = found;
+    return secs;
+}
+
+template <typename Engine>
+static double runBest(const string& workload, const string& pattern, size_t n,
+                      unsigned seed, int repeat, size_t& ops)
+{
+    double best = 0;
+    for (int r = 0; r < repeat; r++) {
+        double secs = runOnce<Engine>(workload, pattern, n, seed + r, ops);
+        if (r == 0 || secs < best) {
+            best = secs;
+        }
+    }
+    return best;
+}
+
+static long peakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void printHeader(const string& format)
+{
+    if (format == "csv") {
+        cout << "engine,workload,pattern,keys,ops,seconds,ns_per_op,mops,peak_rss_kb" << endl;
+    }
+    else if (format == "json") {
+        cout << "[" << endl;
+    }
+    else {
+        cout << left << setw(7) << "engine" << setw(9) << "workload" << setw(11) << "pattern"
+             << right << setw(10) << "keys" << setw(12) << "ns/op" << setw(10) << "Mop/s"
+             << setw(12) << "peak MB" << endl;
+    }
+}
+
+static void printResult(const string& format, const Result& r, bool first)
+{
+    double nsPerOp = r.ops == 0 ? 0 : r.seconds * 1e9 / r.ops;
+    double mops = r.seconds == 0 ? 0 : r.ops / r.seconds / 1e6;
+    if (format == "csv") {
+        cout << r.engine << "," << r.workload << "," << r.pattern << "," << r.keys << ","
+             << r.ops << "," << r.seconds << "," << nsPerOp << "," << mops << ","
+             << r.peakRssKb << endl;
+    }
+    else if (format == "json") {
+        cout << (first ? "  " : ", ")
+             << "{\"engine\":\"" << r.engine << "\",\"workload\":\"" << r.workload
+             << "\",\"pattern\":\"" << r.pattern << "\",\"keys\":" << r.keys
+             << ",\"ops\":" << r.ops << ",\"seconds\":" << r.seconds
+             << ",\"ns_per_op\":" << nsPerOp << ",\"mops\":" << mops
+             << ",\"peak_rss_kb\":" << r.peakRssKb << "}" << endl;
+    }
+    else {
+        cout << left << setw(7) << r.engine << setw(9) << r.workload << setw(11) << r.pattern
+             << right << setw(10) << r.keys << fixed << setprecision(1) << setw(12) << nsPerOp
+             << setprecision(2) << setw(10) << mops << setprecision(1)
+             << setw(12) << r.peakRssKb / 1024.0 << endl;
+        cout.unsetf(ios::floatfield);
+        cout.precision(6);
+    }
+}
+
+static vector<string> splitList(const string& list)
+{
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static bool contains(const char* const* names, size_t count, const string& name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (name == names[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Runs one case in a child process and prints its result from there.
+* Returns false if the child failed.
+*/
+static bool runCase(const string& engine, const string& workload, const string& pattern,
+                    size_t n, unsigned seed, int repeat, const string& format, bool first)
+{
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        Result r;
+        r.engine = engine;
+        r.workload = workload;
+        r.pattern = pattern;
+        r.keys = n;
+        if (engine == "bst") {
+            r.seconds = runBest<TreeEngine<BinarySearchTree, int> >(workload, pattern, n, seed, repeat, r.ops);
+        }
+        else if (engine == "avl") {
+            r.seconds = runBest<TreeEngine<AVLTree, int> >(workload, pattern, n, seed, repeat, r.ops);
+        }
+        else {
+            r.seconds = runBest<MapEngine<int> >(workload, pattern, n, seed, repeat, r.ops);
+        }
+        r.peakRssKb = peakRssKb();
+        printResult(format, r, first);
+        cout.flush();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cerr << engine << " " << workload << " " << pattern << " " << n << ": failed" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char* const ENGINES[] = { "bst", "avl", "map" };
+    static const char* const WORKLOADS[] = { "insert", "find", "remove", "iterate", "mixed" };
+    static const char* const PATTERNS[] = { "sequential", "random", "zipf", "window" };
+
+    vector<string> engines = splitList("bst,avl,map");
+    vector<string> workloads = splitList("insert,find,remove,iterate,mixed");
+    vector<string> patterns = splitList("sequential,random,zipf,window");
+    vector<string> sizes = splitList("1000,100000,1000000");
+    string format = "text";
+    int repeat = 1;
+    unsigned seed = 104;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        if (arg == "--engines") {
+            engines = splitList(value);
+        }
+        else if (arg == "--workloads") {
+            workloads = splitList(value);
+        }
+        else if (arg == "--patterns") {
+            patterns = splitList(value);
+        }
+        else if (arg == "--sizes") {
+            sizes = splitList(value);
+        }
+        else if (arg == "--format") {
+            format = value;
+        }
+        else if (arg == "--repeat") {
+            repeat = max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--seed") {
+            seed = (unsigned)strtoul(value.c_str(), nullptr, 10);
+        }
+        else {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < engines.size(); i++) {
+        if (!contains(ENGINES, 3, engines[i])) {
+            cerr << "unknown engine " << engines[i] << endl;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < workloads.size(); i++) {
+        if (!contains(WORKLOADS, 5, workloads[i])) {
+            cerr << "unknown workload " << workloads[i] << endl;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (!contains(PATTERNS, 4, patterns[i])) {
+            cerr << "unknown pattern " << patterns[i] << endl;
+            return 1;
+        }
+    }
+    if (format != "text" && format != "csv" && format != "json") {
+        cerr << "unknown format " << format << endl;
+        return 1;
+    }
+
+    printHeader(format);
+    bool first = true;
+    bool ok = true;
+    for (size_t s = 0; s < sizes.size(); s++) {
+        size_t n = strtoull(sizes[s].c_str(), nullptr, 10);
+        if (n == 0 || n > 1000000000) {
+            cerr << "bad size " << sizes[s] << endl;
+            return 1;
+        }
+        for (size_t w = 0; w < workloads.size(); w++) {
+            for (size_t p = 0; p < patterns.size(); p++) {
+                // iteration order does not depend on the key pattern
+                if (workloads[w] == "iterate" && p > 0) {
+                    continue;
+                }
+                string pattern = (workloads[w] == "iterate") ? "-" : patterns[p];
+                for (size_t e = 0; e < engines.size(); e++) {
+                    bool ascending = workloads[w] == "insert" || workloads[w] == "mixed";
+                    bool degenerate = (pattern == "window" && ascending) ||
+                                      (pattern == "sequential" && workloads[w] == "insert");
+                    if (engines[e] == "bst" && degenerate && n > MAX_DEGENERATE_KEYS) {
+                        continue;
+                    }
+                    if (!runCase(engines[e], workloads[w], pattern, n, seed, repeat, format, first)) {
+                        ok = false;
+                        continue;
+                    }
+                    first = false;
+                }
+            }
+        }
+    }
+    if (format == "json") {
+        cout << "]" << endl;
+    }
+    return ok ? 0 : 1;
+}
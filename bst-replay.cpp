@@ -0,0 +1,273 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include "bst.h"
+#include "avlbst.h"
+#include "trace.h"
+#include "latency_histogram.h"
+#include "bench_engines.h"
+
+using namespace std;
+
+/*
+  Replays a trace written by RecordingTree against tree engines.
+
+    bst-replay TRACE [--engines bst,avl,map] [--repeat N] [--format text|json] [--no-latency]
+
+  The trace is decoded into memory first. Each engine then replays it
+  twice from empty: once untimed per operation for throughput (best of
+  --repeat), and once with every operation timed into a per-operation
+  latency histogram. Only traces with integer keys can be replayed; they
+  are widened to 64 bits, keeping their signedness.
+*/
+
+static volatile long long sink;
+
+template <typename Key>
+struct TraceRecord
+{
+    TraceOp op;
+    Key key;
+};
+
+struct ReplayResult
+{
+    string engine;
+    size_t ops;
+    double seconds;
+    bool timed;
+    LatencyHistogram latency[TRACE_ITERATE + 1];
+};
+
+static const char* opName(int op)
+{
+    switch (op) {
+    case TRACE_INSERT: return "insert";
+    case TRACE_REMOVE: return "remove";
+    case TRACE_FIND: return "find";
+    default: return "iterate";
+    }
+}
+
+template <typename FileKey, typename Key>
+static vector<TraceRecord<Key> > loadTrace(const string& path)
+{
+    TraceReader<FileKey> reader(path);
+    vector<TraceRecord<Key> > records;
+    TraceOp op;
+    FileKey key = FileKey();
+    while (reader.next(op, key)) {
+        TraceRecord<Key> record;
+        record.op = op;
+        record.key = static_cast<Key>(key);
+        records.push_back(record);
+    }
+    return records;
+}
+
+template <typename Engine, typename Key>
+static void applyRecord(Engine& engine, const TraceRecord<Key>& record, long long& checksum)
+{
+    switch (record.op) {
+    case TRACE_INSERT:
+        engine.insert(record.key, 0);
+        break;
+    case TRACE_REMOVE:
+        engine.remove(record.key);
+        break;
+    case TRACE_FIND:
+        checksum += engine.find(record.key);
+        break;
+    default:
+        checksum += engine.iterate();
+        break;
+    }
+}
+
+template <typename Engine, typename Key>
+static void replay(const vector<TraceRecord<Key> >& records, int repeat, bool timed,
+                   ReplayResult& result)
+{
+    result.ops = records.size();
+    result.timed = timed;
+    long long checksum = 0;
+    for (int r = 0; r < repeat; r++) {
+        Engine engine;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < records.size(); i++) {
+            applyRecord(engine, records[i], checksum);
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (r == 0 || secs < result.seconds) {
+            result.seconds = secs;
+        }
+    }
+    if (timed) {
+        Engine engine;
+        for (size_t i = 0; i < records.size(); i++) {
+            uint64_t begin = LatencyClock::now();
+            applyRecord(engine, records[i], checksum);
+            result.latency[records[i].op].record(LatencyClock::toNanos(LatencyClock::now() - begin));
+        }
+    }
+    sink = checksum;
+}
+
+static void printResult(const string& format, const ReplayResult& r, bool first)
+{
+    double mops = r.seconds == 0 ? 0 : r.ops / r.seconds / 1e6;
+    if (format == "json") {
+        cout << (first ? "  " : ", ") << "{\"engine\":\"" << r.engine << "\",\"ops\":" << r.ops
+             << ",\"seconds\":" << r.seconds << ",\"mops\":" << mops;
+        if (r.timed) {
+            cout << ",\"latency\":{";
+            for (int op = TRACE_INSERT; op <= TRACE_ITERATE; op++) {
+                cout << (op == TRACE_INSERT ? "" : ",") << "\"" << opName(op) << "\":";
+                r.latency[op].writeJson(cout);
+            }
+            cout << "}";
+        }
+        cout << "}" << endl;
+        return;
+    }
+    cout << r.engine << ": " << r.ops << " ops in " << fixed << setprecision(4) << r.seconds
+         << "s, " << setprecision(2) << mops << " Mop/s" << endl;
+    cout.unsetf(ios::floatfield);
+    cout.precision(6);
+    if (r.timed) {
+        for (int op = TRACE_INSERT; op <= TRACE_ITERATE; op++) {
+            if (r.latency[op].count() > 0) {
+                cout << "  ";
+                r.latency[op].writeText(cout, opName(op));
+            }
+        }
+    }
+}
+
+template <typename Key>
+static int run(const vector<TraceRecord<Key> >& records, const vector<string>& engines,
+               int repeat, bool timed, const string& format)
+{
+    if (format == "json") {
+        cout << "[" << endl;
+    }
+    for (size_t e = 0; e < engines.size(); e++) {
+        ReplayResult result;
+        result.engine = engines[e];
+        if (engines[e] == "bst") {
+            replay<TreeEngine<BinarySearchTree, Key> >(records, repeat, timed, result);
+        }
+        else if (engines[e] == "avl") {
+            replay<TreeEngine<AVLTree, Key> >(records, repeat, timed, result);
+        }
+        else {
+            replay<MapEngine<Key> >(records, repeat, timed, result);
+        }
+        printResult(format, result, e == 0);
+    }
+    if (format == "json") {
+        cout << "]" << endl;
+    }
+    return 0;
+}
+
+template <typename FileKey>
+static int runTrace(const string& path, const vector<string>& engines, int repeat,
+                    bool timed, const string& format)
+{
+    if (is_signed<FileKey>::value) {
+        return run(loadTrace<FileKey, int64_t>(path), engines, repeat, timed, format);
+    }
+    return run(loadTrace<FileKey, uint64_t>(path), engines, repeat, timed, format);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " TRACE [--engines bst,avl,map] [--repeat N]"
+             << " [--format text|json] [--no-latency]" << endl;
+        return 1;
+    }
+    string path = argv[1];
+    vector<string> engines;
+    engines.push_back("bst");
+    engines.push_back("avl");
+    engines.push_back("map");
+    int repeat = 1;
+    bool timed = true;
+    string format = "text";
+
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--no-latency") {
+            timed = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        if (arg == "--engines") {
+            engines.clear();
+            stringstream ss(value);
+            string item;
+            while (getline(ss, item, ',')) {
+                if (item != "bst" && item != "avl" && item != "map") {
+                    cerr << "unknown engine " << item << endl;
+                    return 1;
+                }
+                engines.push_back(item);
+            }
+        }
+        else if (arg == "--repeat") {
+            repeat = max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--format" && (value == "text" || value == "json")) {
+            format = value;
+        }
+        else {
+            cerr << "bad option " << arg << " " << value << endl;
+            return 1;
+        }
+    }
+
+    try {
+        ifstream in(path.c_str(), ios::binary);
+        if (!in) {
+            throw runtime_error("Cannot open trace " + path);
+        }
+        TraceHeader header = TraceReader<int>::readHeader(in);
+        bool isSigned = header.keyKind == TRACE_KEY_SIGNED;
+        if (header.keyKind == TRACE_KEY_OTHER) {
+            throw runtime_error("Only traces with integer keys can be replayed");
+        }
+        switch (header.keyBytes) {
+        case 1:
+            return isSigned ? runTrace<int8_t>(path, engines, repeat, timed, format)
+                            : runTrace<uint8_t>(path, engines, repeat, timed, format);
+        case 2:
+            return isSigned ? runTrace<int16_t>(path, engines, repeat, timed, format)
+                            : runTrace<uint16_t>(path, engines, repeat, timed, format);
+        case 4:
+            return isSigned ? runTrace<int32_t>(path, engines, repeat, timed, format)
+                            : runTrace<uint32_t>(path, engines, repeat, timed, format);
+        case 8:
+            return isSigned ? runTrace<int64_t>(path, engines, repeat, timed, format)
+                            : runTrace<uint64_t>(path, engines, repeat, timed, format);
+        default:
+            throw runtime_error("Unsupported key size in trace");
+        }
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
@@ -1,10 +1,1911 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cctype>
 #include "bst.h"
 #include "avlbst.h"
+#include "aggregate_avl.h"
+#include "interval_tree.h"
+#include "timed_tree.h"
+#include "trace.h"
+#include "mapped_tree.h"
 
 using namespace std;
 
+// Prints and counts a failed check; main() exits non-zero if any failed
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+// In-order contents of t equal m
+template <typename Tree>
+static bool sameItems(const Tree& t, const map<int, int>& m)
+{
+    if (t.size() != m.size()) {
+        return false;
+    }
+    map<int, int>::const_iterator expected = m.begin();
+    for (typename Tree::iterator it = t.begin(); it != t.end(); ++it, ++expected) {
+        if (it->first != expected->first || it->second != expected->second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The AVL invariant with threshold k: no node's subtrees differ in
+// height by more than k
+template <typename Tree>
+static bool heightsWithin(const Tree& t, int k)
+{
+    TreeShape shape = t.shape();
+    return shape.balances.empty() ||
+           (shape.balances.begin()->first >= -k && shape.balances.rbegin()->first <= k);
+}
+
+// Sum of the values of map entries with lo <= key < hi
+static long long mapSum(const map<int, long long>& m, int lo, int hi)
+{
+    long long sum = 0;
+    for (map<int, long long>::const_iterator it = m.lower_bound(lo); it != m.end() && it->first < hi; ++it) {
+        sum += it->second;
+    }
+    return sum;
+}
+
+static void checkAggregateRanges(const AggregateAVLTree<int, long long, SumMonoid<int, long long> >& t,
+                                 const map<int, long long>& m, mt19937& rng, const char* what)
+{
+    check(t.total() == mapSum(m, -1, 1 << 30), what);
+    for (int i = 0; i < 200; i++) {
+        int lo = (int)(rng() % 1100) - 50;
+        int hi = lo + (int)(rng() % 300);
+        check(t.aggregate(lo, hi) == mapSum(m, lo, hi), what);
+    }
+}
+
+// Relaxed thresholds, the rotation counters and tighten() against std::map
+static void testRelaxedBalance()
+{
+    AVLTree<int, int> bad;
+    bool threw = false;
+    try {
+        bad.setBalanceThreshold(0);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "balance threshold 0 throws");
+    threw = false;
+    try {
+        bad.setBalanceThreshold(65);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "balance threshold 65 throws");
+
+    // sorted input rotates on almost every insert at k = 1
+    size_t strictRotations = 0;
+    for (int k = 1; k <= 4; k *= 2) {
+        AVLTree<int, int> t;
+        t.setBalanceThreshold(k);
+        check(t.getBalanceThreshold() == k, "getBalanceThreshold");
+        for (int i = 0; i < 5000; i++) {
+            t.insert(make_pair(i, i));
+        }
+        check(heightsWithin(t, k), "sorted inserts keep the relaxed invariant");
+        if (k == 1) {
+            strictRotations = t.rotationCount();
+            check(strictRotations > 0 && t.avoidedRotationCount() == 0, "strict AVL never avoids a rotation");
+        }
+        else {
+            check(t.rotationCount() < strictRotations, "a relaxed threshold rotates less");
+            check(t.avoidedRotationCount() > 0, "a relaxed threshold counts avoided rotations");
+        }
+        t.resetRotationCounts();
+        check(t.rotationCount() == 0 && t.avoidedRotationCount() == 0, "resetRotationCounts");
+    }
+
+    mt19937 rng(26);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    t.setBalanceThreshold(3);
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 3000; i++) {
+            int k = (int)(rng() % 2000);
+            if (rng() % 3 == 0) {
+                t.remove(k);
+                m.erase(k);
+            }
+            else {
+                t.insert(make_pair(k, i));
+                m[k] = i;
+            }
+        }
+        check(sameItems(t, m), "relaxed tree matches std::map");
+        check(heightsWithin(t, 3), "relaxed tree stays within its threshold");
+    }
+
+    t.tighten();
+    check(sameItems(t, m), "tighten keeps the items");
+    check(t.isBalanced() && heightsWithin(t, 1), "tighten restores the AVL invariant");
+    check(t.getBalanceThreshold() == 3, "tighten keeps the threshold");
+
+    // lowering the threshold tightens, and later updates keep stored balances right
+    t.setBalanceThreshold(6);
+    for (int i = 0; i < 2000; i++) {
+        t.insert(make_pair(5000 + i, i));
+        m[5000 + i] = i;
+    }
+    t.setBalanceThreshold(1);
+    check(heightsWithin(t, 1), "lowering the threshold tightens the tree");
+    for (int i = 0; i < 4000; i++) {
+        int k = (int)(rng() % 8000);
+        if (i % 2 == 0) {
+            t.remove(k);
+            m.erase(k);
+        }
+        else {
+            t.insert(make_pair(k, i));
+            m[k] = i;
+        }
+    }
+    check(sameItems(t, m), "strict tree after tightening matches std::map");
+    check(heightsWithin(t, 1), "strict updates after tightening keep the AVL invariant");
+}
+
+// Finger find, lower_bound and hinted insert against std::map, from
+// random hints and from end()
+static void testFingerSearch()
+{
+    mt19937 rng(27);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    AVLTree<int, int>::iterator hint = t.insert(t.end(), make_pair(0, 0));
+    check(hint != t.end() && hint->first == 0, "hinted insert into an empty tree");
+    m[0] = 0;
+    // ascending runs, each hinted by the previous insert
+    for (int i = 1; i < 2000; i++) {
+        hint = t.insert(hint, make_pair(2 * i, i));
+        m[2 * i] = i;
+        check(hint->first == 2 * i, "hinted insert returns the new item");
+    }
+    // random keys from random hints, including overwrites
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 6000);
+        AVLTree<int, int>::iterator from = (rng() % 5 == 0) ? t.end() : t.find((int)(rng() % 2000) * 2);
+        AVLTree<int, int>::iterator it = t.insert(from, make_pair(k, -i));
+        m[k] = -i;
+        check(it != t.end() && it->first == k && it->second == -i, "hinted insert from a random hint");
+    }
+    check(sameItems(t, m), "hinted inserts match std::map");
+    check(heightsWithin(t, 1), "hinted inserts keep the AVL invariant");
+
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 6200) - 100;
+        AVLTree<int, int>::iterator from = (i % 7 == 0) ? t.end() : t.lower_bound((int)(rng() % 6000));
+        map<int, int>::iterator expected = m.find(k);
+        AVLTree<int, int>::iterator got = t.find(k, from);
+        check(expected == m.end() ? got == t.end() : (got != t.end() && got->first == k && got->second == expected->second),
+              "finger find matches std::map");
+        expected = m.lower_bound(k);
+        got = t.lower_bound(k, from);
+        check(expected == m.end() ? got == t.end() : (got != t.end() && got->first == expected->first),
+              "finger lower_bound matches std::map");
+    }
+
+    // the hint may be the item itself or a neighbour on either side
+    AVLTree<int, int>::iterator mid = t.find(3000);
+    if (mid == t.end()) {
+        mid = t.insert(t.end(), make_pair(3000, 0));
+        m[3000] = 0;
+    }
+    AVLTree<int, int>::iterator before = mid;
+    --before;
+    AVLTree<int, int>::iterator after = mid;
+    ++after;
+    check(t.find(3000, mid) == mid && t.find(3000, before) == mid && t.find(3000, after) == mid,
+          "finger find from the item and its neighbours");
+
+    AVLTree<int, int> empty;
+    check(empty.find(5, empty.end()) == empty.end(), "finger find in an empty tree");
+    check(empty.lower_bound(5, empty.end()) == empty.end(), "finger lower_bound in an empty tree");
+}
+
+// Sends every key to the same lookup cache slot
+struct CollidingHash
+{
+    size_t operator()(int) const
+    {
+        return 0;
+    }
+};
+
+// find() with the lookup cache on, against std::map, through every kind
+// of update that frees or moves nodes
+static void testLookupCache()
+{
+    mt19937 rng(28);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    t.enableLookupCache(256);
+    for (int i = 0; i < 2000; i++) {
+        int k = (int)(rng() % 4000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+    }
+    int hot = m.begin()->first;
+    check(t.find(hot) != t.end(), "hot key found");
+    size_t hits = t.lookupCacheHits();
+    for (int i = 0; i < 10; i++) {
+        check(t.find(hot)->second == m[hot], "cached find returns the value");
+    }
+    check(t.lookupCacheHits() == hits + 10, "repeated finds hit the cache");
+
+    // a removed node must not be returned from its slot
+    t.remove(hot);
+    m.erase(hot);
+    check(t.find(hot) == t.end(), "removed key is not found through the cache");
+    t.insert(make_pair(hot, -1));
+    m[hot] = -1;
+    check(t.find(hot) != t.end() && t.find(hot)->second == -1, "reinserted key is found with its new value");
+
+    for (int i = 0; i < 20000; i++) {
+        int k = (int)(rng() % 4000);
+        int op = (int)(rng() % 100);
+        if (op < 30) {
+            t.insert(make_pair(k, i));
+            m[k] = i;
+        }
+        else if (op < 50) {
+            t.remove(k);
+            m.erase(k);
+        }
+        else if (op == 50) {
+            t.erase_range(k, k + 40);
+            m.erase(m.lower_bound(k), m.lower_bound(k + 40));
+        }
+        else if (op == 51 && i % 7 == 0) {
+            t.compact();
+        }
+        else {
+            map<int, int>::iterator expected = m.find(k);
+            AVLTree<int, int>::iterator got = t.find(k);
+            check(expected == m.end() ? got == t.end() : (got != t.end() && got->second == expected->second),
+                  "cached find matches std::map");
+        }
+    }
+    check(t.lookupCacheHits() > 0 && t.lookupCacheMisses() > 0, "cache counts hits and misses");
+    check(sameItems(t, m), "tree with lookup cache matches std::map");
+    check(heightsWithin(t, 1), "lookup cache keeps the AVL invariant");
+
+    // compact() moves every node; cached pointers must not survive it
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        t.find(it->first);
+    }
+    t.compact();
+    bool same = true;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        AVLTree<int, int>::iterator got = t.find(it->first);
+        same = same && got != t.end() && got->second == it->second;
+    }
+    check(same, "cached finds after compact");
+
+    t.clear();
+    m.clear();
+    check(t.find(hot) == t.end(), "clear empties the cache");
+    t.insert(make_pair(hot, 7));
+    check(t.find(hot)->second == 7, "insert after clear");
+
+    // every key in one slot: each miss replaces the entry
+    AVLTree<int, int> one;
+    one.enableLookupCache<CollidingHash>(1);
+    for (int i = 0; i < 100; i++) {
+        one.insert(make_pair(i, i * i));
+    }
+    bool right = true;
+    for (int i = 0; i < 300; i++) {
+        int k = (int)(rng() % 120);
+        AVLTree<int, int>::iterator got = one.find(k);
+        right = right && (k < 100 ? (got != one.end() && got->second == k * k) : got == one.end());
+        if (k < 100 && k % 3 == 0) {
+            one.remove(k);
+            one.insert(make_pair(k, k * k));
+        }
+    }
+    check(right, "single colliding slot");
+
+    size_t before = one.lookupCacheHits() + one.lookupCacheMisses();
+    one.disableLookupCache();
+    one.find(5);
+    check(one.lookupCacheHits() + one.lookupCacheMisses() == before, "a disabled cache counts nothing");
+}
+
+// The iterator find_batch or find_sorted gave for key is right for m
+template <typename Tree>
+static bool foundAs(const Tree& t, typename Tree::iterator got, int key, const map<int, int>& m)
+{
+    map<int, int>::const_iterator expected = m.find(key);
+    if (expected == m.end()) {
+        return got == t.end();
+    }
+    return got != t.end() && got->first == key && got->second == expected->second;
+}
+
+// find_batch() against std::map for batch sizes around the group size,
+// with and without the Bloom filter, and on a degenerate tree
+static void testFindBatch()
+{
+    mt19937 rng(29);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 6000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+    }
+    const size_t sizes[] = { 0, 1, 15, 16, 17, 33, 1000 };
+    for (int bloom = 0; bloom < 2; bloom++) {
+        if (bloom) {
+            t.enableBloomFilter(m.size());
+        }
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            vector<int> keys;
+            for (size_t i = 0; i < sizes[s]; i++) {
+                keys.push_back((int)(rng() % 6400) - 200);
+            }
+            if (!keys.empty()) {
+                keys.push_back(keys[0]);
+            }
+            vector<AVLTree<int, int>::iterator> out;
+            t.find_batch(keys, out);
+            bool right = out.size() == keys.size();
+            for (size_t i = 0; right && i < keys.size(); i++) {
+                right = foundAs(t, out[i], keys[i], m);
+            }
+            check(right, bloom ? "find_batch with a Bloom filter matches std::map" : "find_batch matches std::map");
+        }
+    }
+
+    BinarySearchTree<int, int> chain;
+    map<int, int> chainMap;
+    for (int i = 0; i < 3000; i++) {
+        chain.insert(make_pair(i, -i));
+        chainMap[i] = -i;
+    }
+    vector<int> keys;
+    for (int i = 0; i < 500; i++) {
+        keys.push_back((int)(rng() % 3100));
+    }
+    vector<BinarySearchTree<int, int>::iterator> out;
+    chain.find_batch(keys, out);
+    bool right = out.size() == keys.size();
+    for (size_t i = 0; right && i < keys.size(); i++) {
+        right = foundAs(chain, out[i], keys[i], chainMap);
+    }
+    check(right, "find_batch on a degenerate tree");
+
+    AVLTree<int, int> empty;
+    empty.find_batch(keys, out);
+    check(out.size() == keys.size() && out[0] == empty.end(), "find_batch on an empty tree");
+}
+
+// find_sorted() against std::map: hits, misses and repeated keys, on a
+// balanced and a degenerate tree, writing through an output iterator
+static void testFindSorted()
+{
+    mt19937 rng(30);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 6000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+    }
+    for (int round = 0; round < 20; round++) {
+        vector<int> keys;
+        size_t count = (round == 0) ? 0 : (size_t)(rng() % 2000);
+        for (size_t i = 0; i < count; i++) {
+            keys.push_back((int)(rng() % 6400) - 200);
+        }
+        sort(keys.begin(), keys.end());
+        vector<AVLTree<int, int>::iterator> out;
+        t.find_sorted(keys.begin(), keys.end(), back_inserter(out));
+        bool right = out.size() == keys.size();
+        for (size_t i = 0; right && i < keys.size(); i++) {
+            right = foundAs(t, out[i], keys[i], m);
+        }
+        check(right, "find_sorted matches std::map");
+    }
+
+    // every key, so each node is reported once
+    vector<int> all;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        all.push_back(it->first);
+    }
+    vector<AVLTree<int, int>::iterator> out(all.size());
+    vector<AVLTree<int, int>::iterator>::iterator end = t.find_sorted(all.begin(), all.end(), out.begin());
+    bool right = end == out.end();
+    AVLTree<int, int>::iterator walk = t.begin();
+    for (size_t i = 0; right && i < out.size(); i++, ++walk) {
+        right = out[i] == walk;
+    }
+    check(right, "find_sorted of every key follows the in-order walk");
+
+    // a sorted-insert chain is as deep as it is long
+    BinarySearchTree<int, int> chain;
+    map<int, int> chainMap;
+    for (int i = 0; i < 5000; i++) {
+        chain.insert(make_pair(2 * i, i));
+        chainMap[2 * i] = i;
+    }
+    vector<int> keys;
+    for (int k = -3; k < 10010; k += 3) {
+        keys.push_back(k);
+    }
+    vector<BinarySearchTree<int, int>::iterator> chainOut;
+    chain.find_sorted(keys.begin(), keys.end(), back_inserter(chainOut));
+    right = chainOut.size() == keys.size();
+    for (size_t i = 0; right && i < keys.size(); i++) {
+        right = foundAs(chain, chainOut[i], keys[i], chainMap);
+    }
+    check(right, "find_sorted on a degenerate tree");
+
+    AVLTree<int, int> empty;
+    chainOut.clear();
+    empty.find_sorted(keys.begin(), keys.end(), back_inserter(chainOut));
+    check(chainOut.size() == keys.size() && chainOut.back() == empty.end(), "find_sorted on an empty tree");
+}
+
+// size(), empty(), min() and max() agree with m; the ends throw when empty
+template <typename Tree>
+static bool endsMatch(const Tree& t, const map<int, int>& m)
+{
+    if (t.size() != m.size() || t.empty() != m.empty()) {
+        return false;
+    }
+    if (m.empty()) {
+        int thrown = 0;
+        try {
+            t.min();
+        }
+        catch (out_of_range&) {
+            thrown++;
+        }
+        try {
+            t.max();
+        }
+        catch (out_of_range&) {
+            thrown++;
+        }
+        return thrown == 2 && t.begin() == t.end();
+    }
+    typename Tree::iterator last = t.end();
+    --last;
+    return t.min().first == m.begin()->first && t.min().second == m.begin()->second &&
+           t.max().first == m.rbegin()->first && t.max().second == m.rbegin()->second &&
+           t.begin()->first == m.begin()->first && last->first == m.rbegin()->first;
+}
+
+// The cached leftmost, rightmost and size through every kind of update
+static void testCachedEnds()
+{
+    mt19937 rng(33);
+    AVLTree<int, int> t;
+    BinarySearchTree<int, int> plain;
+    map<int, int> m;
+    check(endsMatch(t, m) && endsMatch(plain, m), "ends of an empty tree");
+    bool ok = true;
+    bool plainOk = true;
+    for (int i = 0; i < 6000; i++) {
+        int k = (int)(rng() % 3000);
+        int op = (int)(rng() % 10);
+        if (op < 5) {
+            t.insert(make_pair(k, i));
+            plain.insert(make_pair(k, i));
+            m[k] = i;
+        }
+        else if (op < 7) {
+            t.remove(k);
+            plain.remove(k);
+            m.erase(k);
+        }
+        else if (op == 7 && !m.empty()) {
+            // remove both current ends by key
+            int lo = m.begin()->first;
+            int hi = m.rbegin()->first;
+            t.remove(lo);
+            plain.remove(lo);
+            m.erase(lo);
+            t.remove(hi);
+            plain.remove(hi);
+            m.erase(hi);
+        }
+        else if (op == 8 && !m.empty()) {
+            pair<int, int> a = t.pop_min();
+            pair<int, int> b = plain.pop_min();
+            ok = ok && a.first == m.begin()->first && a.second == m.begin()->second;
+            plainOk = plainOk && b == a;
+            m.erase(m.begin());
+        }
+        else if (!m.empty()) {
+            pair<int, int> a = t.pop_max();
+            pair<int, int> b = plain.pop_max();
+            ok = ok && a.first == m.rbegin()->first && a.second == m.rbegin()->second;
+            plainOk = plainOk && b == a;
+            m.erase(prev(m.end()));
+        }
+        ok = ok && endsMatch(t, m);
+        plainOk = plainOk && endsMatch(plain, m);
+    }
+    check(ok, "AVL ends and size match std::map");
+    check(plainOk, "BST ends and size match std::map");
+    check(sameItems(t, m) && sameItems(plain, m), "trees match std::map after pops");
+    check(heightsWithin(t, 1), "pops keep the AVL invariant");
+
+    for (int i = 0; i < 3000; i++) {
+        t.insert(make_pair(i, i));
+        plain.insert(make_pair(i, i));
+        m[i] = i;
+    }
+    t.erase_range(-10, 100);
+    plain.erase_range(-10, 100);
+    m.erase(m.begin(), m.lower_bound(100));
+    check(endsMatch(t, m) && endsMatch(plain, m), "ends after erasing the low end");
+    t.erase_range(2900, 5000);
+    plain.erase_range(2900, 5000);
+    m.erase(m.lower_bound(2900), m.end());
+    check(endsMatch(t, m) && endsMatch(plain, m), "ends after erasing the high end");
+    t.compact();
+    plain.rebalance();
+    check(endsMatch(t, m) && endsMatch(plain, m), "ends after compact and rebalance");
+    check(heightsWithin(t, 1), "erase_range and compact keep the AVL invariant");
+
+    t.clear();
+    plain.clear();
+    m.clear();
+    check(endsMatch(t, m) && endsMatch(plain, m), "ends after clear");
+    t.insert(make_pair(4, 4));
+    m[4] = 4;
+    check(endsMatch(t, m), "ends of a one-item tree");
+    t.pop_max();
+    m.clear();
+    check(endsMatch(t, m), "popping the only item");
+}
+
+// Forward, backward, const and reverse iteration against std::map
+static void testIterators()
+{
+    mt19937 rng(34);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    check(t.begin() == t.end() && t.rbegin() == t.rend() && t.cbegin() == t.cend(), "empty tree iterators");
+    for (int i = 0; i < 2000; i++) {
+        int k = (int)(rng() % 5000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+        if (i % 3 == 0) {
+            int gone = (int)(rng() % 5000);
+            t.remove(gone);
+            m.erase(gone);
+        }
+    }
+    check(heightsWithin(t, 1), "iterator test tree keeps the AVL invariant");
+
+    // backward from end() visits the items in reverse
+    bool right = true;
+    map<int, int>::reverse_iterator mr = m.rbegin();
+    AVLTree<int, int>::iterator it = t.end();
+    while (it != t.begin()) {
+        --it;
+        right = right && mr != m.rend() && it->first == mr->first && it->second == mr->second;
+        ++mr;
+    }
+    check(right && mr == m.rend(), "decrementing from end() walks backwards");
+
+    check(equal(t.rbegin(), t.rend(), m.rbegin()) && (size_t)distance(t.rbegin(), t.rend()) == m.size(),
+          "reverse_iterator matches std::map");
+    check(equal(t.crbegin(), t.crend(), m.rbegin()), "const_reverse_iterator matches std::map");
+    check(equal(t.cbegin(), t.cend(), m.begin()) && (size_t)distance(t.cbegin(), t.cend()) == m.size(),
+          "const_iterator matches std::map");
+
+    // postfix forms return the old position
+    it = t.begin();
+    AVLTree<int, int>::iterator old = it++;
+    check(old == t.begin() && it == next(t.begin()), "postfix ++");
+    old = it--;
+    check(old == next(t.begin()) && it == t.begin(), "postfix --");
+    AVLTree<int, int>::const_iterator cit = t.cend();
+    AVLTree<int, int>::const_iterator cold = cit--;
+    check(cold == t.cend() && cit->first == m.rbegin()->first, "const postfix -- from cend()");
+
+    // an iterator converts to a const_iterator at the same place
+    AVLTree<int, int>::iterator mid = t.find(m.begin()->first);
+    for (int i = 0; i < 100; i++) {
+        ++mid;
+    }
+    AVLTree<int, int>::const_iterator cmid = mid;
+    check(cmid->first == mid->first && &*cmid == &*mid, "iterator converts to const_iterator");
+
+    // values can be written through a mutable iterator
+    for (AVLTree<int, int>::iterator w = t.begin(); w != t.end(); ++w) {
+        w->second = -w->first;
+        m[w->first] = -w->first;
+    }
+    check(sameItems(t, m), "writes through iterators");
+
+    // both directions after removing every other item
+    vector<int> keys;
+    for (AVLTree<int, int>::iterator w = t.begin(); w != t.end(); ++w) {
+        keys.push_back(w->first);
+    }
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        t.remove(keys[i]);
+        m.erase(keys[i]);
+    }
+    check(equal(t.rbegin(), t.rend(), m.rbegin()) && equal(t.begin(), t.end(), m.begin()),
+          "iteration after removes");
+    check(heightsWithin(t, 1), "removes keep the AVL invariant");
+
+    BinarySearchTree<int, int> one;
+    one.insert(make_pair(1, 1));
+    BinarySearchTree<int, int>::iterator e = one.end();
+    --e;
+    check(e == one.begin() && one.rbegin()->first == 1, "one-item tree iterators");
+}
+
+// erase(it), erase(first, last) and split/join erase_range against
+// std::map, on AVL trees (strict and relaxed) and a plain BST
+static void testErase()
+{
+    mt19937 rng(35);
+    for (int k = 1; k <= 3; k += 2) {
+        AVLTree<int, int> t;
+        BinarySearchTree<int, int> plain;
+        map<int, int> m;
+        t.setBalanceThreshold(k);
+        bool returned = true;
+        for (int round = 0; round < 300; round++) {
+            for (int i = 0; i < 40; i++) {
+                int key = (int)(rng() % 4000);
+                t.insert(make_pair(key, i));
+                plain.insert(make_pair(key, i));
+                m[key] = i;
+            }
+            int lo = (int)(rng() % 4200) - 100;
+            int hi = lo + (int)(rng() % 300) - 20;
+            int op = round % 3;
+            if (op == 0) {
+                t.erase_range(lo, hi);
+                plain.erase_range(lo, hi);
+                if (lo < hi) {
+                    m.erase(m.lower_bound(lo), m.lower_bound(hi));
+                }
+            }
+            else if (op == 1) {
+                AVLTree<int, int>::iterator first = t.lower_bound(lo);
+                AVLTree<int, int>::iterator last = t.lower_bound(max(lo, hi));
+                AVLTree<int, int>::iterator after = t.erase(first, last);
+                BinarySearchTree<int, int>::iterator plainAfter =
+                    plain.erase(plain.lower_bound(lo), plain.lower_bound(max(lo, hi)));
+                map<int, int>::iterator mAfter = m.erase(m.lower_bound(lo), m.lower_bound(max(lo, hi)));
+                returned = returned && (mAfter == m.end() ? after == t.end() && plainAfter == plain.end()
+                                                          : after->first == mAfter->first &&
+                                                            plainAfter->first == mAfter->first);
+            }
+            else if (!m.empty()) {
+                int key = (int)(rng() % 4000);
+                map<int, int>::iterator mIt = m.lower_bound(key);
+                if (mIt != m.end()) {
+                    AVLTree<int, int>::iterator after = t.erase(t.lower_bound(key));
+                    BinarySearchTree<int, int>::iterator plainAfter = plain.erase(plain.lower_bound(key));
+                    mIt = m.erase(mIt);
+                    returned = returned && (mIt == m.end() ? after == t.end() && plainAfter == plain.end()
+                                                           : after->first == mIt->first &&
+                                                             plainAfter->first == mIt->first);
+                }
+            }
+            if (round % 50 == 49) {
+                check(sameItems(t, m) && sameItems(plain, m), "erase matches std::map");
+                check(heightsWithin(t, k), "erase keeps the AVL invariant");
+            }
+        }
+        check(returned, "erase returns the position after the erased items");
+
+        // the returned iterator stays usable while erasing a run one by one
+        AVLTree<int, int>::iterator it = t.lower_bound(1000);
+        while (it != t.end() && it->first < 2000) {
+            it = t.erase(it);
+        }
+        m.erase(m.lower_bound(1000), m.lower_bound(2000));
+        check(sameItems(t, m) && heightsWithin(t, k), "erase(it) in a loop");
+
+        // ranges at either end and the whole tree
+        t.erase_range(-1000, m.begin()->first + 1);
+        m.erase(m.begin());
+        t.erase(t.lower_bound(m.rbegin()->first), t.end());
+        m.erase(prev(m.end()));
+        check(sameItems(t, m) && heightsWithin(t, k), "erasing at the ends");
+        t.erase(t.begin(), t.end());
+        check(t.empty() && t.begin() == t.end(), "erasing everything");
+        t.insert(make_pair(1, 1));
+        check(t.size() == 1 && t.find(1) != t.end(), "insert after erasing everything");
+    }
+}
+
+// compact() keeps the items and the exact shape, and the tree stays
+// fully usable afterwards, including after compacting again
+static void testCompact()
+{
+    mt19937 rng(37);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    t.compact();
+    check(t.empty(), "compact of an empty tree");
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 2000; i++) {
+            int k = (int)(rng() % 5000);
+            if (rng() % 3 == 0) {
+                t.remove(k);
+                m.erase(k);
+            }
+            else {
+                t.insert(make_pair(k, i));
+                m[k] = i;
+            }
+        }
+        TreeShape before = t.shape();
+        t.compact();
+        TreeShape after = t.shape();
+        check(sameItems(t, m), "compact keeps the items");
+        check(before.height == after.height && before.leafDepths == after.leafDepths &&
+              before.balances == after.balances, "compact keeps the shape");
+        check(heightsWithin(t, 1), "compact keeps the AVL invariant");
+        check(t.min().first == m.begin()->first && t.max().first == m.rbegin()->first,
+              "compact keeps the cached ends");
+    }
+
+    // remove every compacted node, so each block is freed, then reuse the tree
+    vector<int> keys;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        keys.push_back(it->first);
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+    for (size_t i = 0; i < keys.size(); i++) {
+        t.remove(keys[i]);
+        m.erase(keys[i]);
+        if (i % 500 == 0) {
+            check(sameItems(t, m) && heightsWithin(t, 1), "removing compacted nodes");
+        }
+    }
+    check(t.empty(), "every compacted node removed");
+    for (int i = 0; i < 100; i++) {
+        t.insert(make_pair(i, i));
+        m[i] = i;
+    }
+    t.compact();
+    t.clear();
+    m.clear();
+    t.insert(make_pair(1, 2));
+    m[1] = 2;
+    check(sameItems(t, m), "insert after clearing a compacted tree");
+}
+
+// load() throws std::runtime_error for bytes and leaves t untouched
+static bool loadRejects(AVLTree<int, int>& t, const string& bytes, const map<int, int>& m)
+{
+    istringstream in(bytes);
+    bool threw = false;
+    try {
+        t.load(in);
+    }
+    catch (runtime_error&) {
+        threw = true;
+    }
+    return threw && sameItems(t, m);
+}
+
+// save()/load() round trips, truncated and corrupt snapshots, and the
+// caller's balance threshold kept across load()
+static void testSnapshots()
+{
+    mt19937 rng(38);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 6000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+        if (i % 4 == 0) {
+            t.remove(k / 2);
+            m.erase(k / 2);
+        }
+    }
+    ostringstream out;
+    t.save(out);
+    AVLTree<int, int> copy;
+    copy.enableBloomFilter(10);
+    copy.insert(make_pair(-1, -1));
+    istringstream in(out.str());
+    copy.load(in);
+    check(sameItems(copy, m), "load restores the items");
+    TreeShape a = t.shape();
+    TreeShape b = copy.shape();
+    check(a.height == b.height && a.leafDepths == b.leafDepths && a.balances == b.balances,
+          "load restores the exact shape");
+    bool found = true;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        found = found && copy.find(it->first) != copy.end();
+    }
+    check(found && copy.find(-1) == copy.end(), "the Bloom filter follows a load");
+    for (int i = 0; i < 2000; i++) {
+        int k = (int)(rng() % 6000);
+        if (i % 2) {
+            copy.insert(make_pair(k, i));
+            m[k] = i;
+        }
+        else {
+            copy.remove(k);
+            m.erase(k);
+        }
+    }
+    check(sameItems(copy, m) && heightsWithin(copy, 1), "a loaded tree takes updates");
+
+    // through a file, and an empty tree
+    copy.save("bst-test.snapshot");
+    AVLTree<int, int> fromFile;
+    fromFile.load("bst-test.snapshot");
+    check(sameItems(fromFile, m), "save and load through a file");
+    remove("bst-test.snapshot");
+    bool threw = false;
+    try {
+        fromFile.load("bst-test.snapshot");
+    }
+    catch (runtime_error&) {
+        threw = true;
+    }
+    check(threw && sameItems(fromFile, m), "loading a missing file throws");
+    AVLTree<int, int> empty;
+    ostringstream emptyOut;
+    empty.save(emptyOut);
+    istringstream emptyIn(emptyOut.str());
+    fromFile.load(emptyIn);
+    check(fromFile.empty() && fromFile.begin() == fromFile.end(), "loading an empty snapshot");
+
+    // every truncation of a small snapshot is rejected
+    AVLTree<int, int> small;
+    map<int, int> smallMap;
+    for (int i = 0; i < 40; i++) {
+        small.insert(make_pair(i * 3, i));
+        smallMap[i * 3] = i;
+    }
+    ostringstream smallOut;
+    small.save(smallOut);
+    string bytes = smallOut.str();
+    bool rejected = true;
+    for (size_t len = 0; len < bytes.size(); len++) {
+        rejected = rejected && loadRejects(copy, bytes.substr(0, len), m);
+    }
+    check(rejected, "truncated snapshots throw and leave the tree alone");
+
+    // structural corruption: header fields, a children byte and a balance
+    const size_t header = 8 + 8 + 4;
+    const size_t record = 2 + sizeof(int) + sizeof(int);
+    string bad = bytes;
+    bad[0] = 'X';
+    check(loadRejects(copy, bad, m), "bad magic throws");
+    bad = bytes;
+    bad[8] = (char)(bad[8] + 1);
+    check(loadRejects(copy, bad, m), "a count too high throws");
+    bad = bytes;
+    bad[8] = (char)(bad[8] - 1);
+    check(loadRejects(copy, bad, m), "a count too low throws");
+    bad = bytes;
+    bad[16] = 0;
+    check(loadRejects(copy, bad, m), "threshold 0 throws");
+    bad = bytes;
+    bad[header] = 4;
+    check(loadRejects(copy, bad, m), "a bad children byte throws");
+    rejected = true;
+    for (size_t r = 0; r < 40; r++) {
+        bad = bytes;
+        bad[header + r * record + 1] = (char)(bad[header + r * record + 1] + 1);
+        rejected = rejected && loadRejects(copy, bad, m);
+        bad = bytes;
+        bad[header + r * record] = (char)(bad[header + r * record] ^ 1);
+        rejected = rejected && loadRejects(copy, bad, m);
+    }
+    check(rejected, "a wrong balance or child flag in any record throws");
+
+    // the loading tree keeps its own threshold
+    AVLTree<int, int> relaxed;
+    relaxed.setBalanceThreshold(4);
+    map<int, int> sorted;
+    for (int i = 0; i < 3000; i++) {
+        relaxed.insert(make_pair(i, i));
+        sorted[i] = i;
+    }
+    check(!heightsWithin(relaxed, 1), "sorted inserts leave a relaxed tree loose");
+    ostringstream relaxedOut;
+    relaxed.save(relaxedOut);
+    AVLTree<int, int> strict;
+    istringstream relaxedIn(relaxedOut.str());
+    strict.load(relaxedIn);
+    check(strict.getBalanceThreshold() == 1 && heightsWithin(strict, 1) && sameItems(strict, sorted),
+          "a strict tree tightens a relaxed snapshot");
+    AVLTree<int, int> loose;
+    loose.setBalanceThreshold(6);
+    istringstream relaxedAgain(relaxedOut.str());
+    loose.load(relaxedAgain);
+    TreeShape saved = relaxed.shape();
+    TreeShape loaded = loose.shape();
+    check(loose.getBalanceThreshold() == 6 && saved.balances == loaded.balances && saved.height == loaded.height,
+          "a looser tree keeps its threshold and the saved shape");
+
+    // keys that own memory
+    AVLTree<string, string> words;
+    map<string, string> wordMap;
+    for (int i = 0; i < 500; i++) {
+        string k = to_string(rng() % 100000) + string(i % 7, 'x');
+        words.insert(make_pair(k, to_string(i)));
+        wordMap[k] = to_string(i);
+    }
+    ostringstream wordsOut;
+    words.save(wordsOut);
+    AVLTree<string, string> wordsCopy;
+    istringstream wordsIn(wordsOut.str());
+    wordsCopy.load(wordsIn);
+    check(equal(wordsCopy.begin(), wordsCopy.end(), wordMap.begin()) && wordsCopy.size() == wordMap.size(),
+          "string snapshots round trip");
+}
+
+// Bloom filter: every miss is a reject or a false positive, present keys
+// are never ruled out, and the filter follows removes, growth and clear()
+static void testBloomFilter()
+{
+    const int n = 20000;
+    AVLTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < n; i++) {
+        t.insert(make_pair(2 * i, i));
+        m[2 * i] = i;
+    }
+    t.enableBloomFilter(n);
+    check(t.bloomMemoryBytes() >= (size_t)n * 10 / 8, "the filter holds about 10 bits per key");
+    bool found = true;
+    for (int i = 0; i < n; i++) {
+        found = found && foundAs(t, t.find(2 * i), 2 * i, m);
+    }
+    check(found, "present keys are never ruled out");
+    check(t.bloomRejects() == 0 && t.bloomFalsePositives() == 0, "hits touch neither counter");
+
+    bool missed = true;
+    for (int i = 0; i < n; i++) {
+        missed = missed && t.find(2 * i + 1) == t.end();
+    }
+    size_t rejects = t.bloomRejects();
+    size_t falsePositives = t.bloomFalsePositives();
+    check(missed && rejects + falsePositives == (size_t)n, "each miss is a reject or a false positive");
+    check(falsePositives < (size_t)n / 30, "about 1% false positives at 10 bits per key");
+    check(t.bloomFalsePositiveRate() > 0 && t.bloomFalsePositiveRate() < 0.03, "expected rate near 1%");
+
+    // find_batch counts the same way
+    vector<int> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(2 * i + 1);
+        keys.push_back(2 * i);
+    }
+    vector<AVLTree<int, int>::iterator> out;
+    t.find_batch(keys, out);
+    bool batch = true;
+    for (size_t i = 0; i < keys.size(); i++) {
+        batch = batch && foundAs(t, out[i], keys[i], m);
+    }
+    check(batch, "find_batch answers through the filter");
+    check(t.bloomRejects() + t.bloomFalsePositives() == rejects + falsePositives + 1000,
+          "find_batch counts each miss once");
+
+    // removed keys stay set until they make up a quarter of the filter,
+    // then it is rebuilt without them
+    for (int i = 0; i < n; i += 2) {
+        t.remove(2 * i);
+        m.erase(2 * i);
+    }
+    check(sameItems(t, m) && heightsWithin(t, 1), "removes under the filter");
+    rejects = t.bloomRejects();
+    falsePositives = t.bloomFalsePositives();
+    for (int i = 0; i < n; i += 2) {
+        missed = missed && t.find(2 * i) == t.end();
+    }
+    check(missed && t.bloomRejects() - rejects > (size_t)n / 2 * 3 / 4,
+          "most removed keys are rejected");
+    check(t.bloomFalsePositives() - falsePositives + t.bloomRejects() - rejects == (size_t)n / 2,
+          "removed keys count as misses");
+
+    // outgrowing the filter doubles it on the next lookup
+    for (int i = 0; i < 3 * n; i++) {
+        t.insert(make_pair(2 * n + 2 * i, i));
+        m[2 * n + 2 * i] = i;
+    }
+    check(t.bloomFalsePositiveRate() < 0.03, "the filter grows with the tree");
+    found = true;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        found = found && foundAs(t, t.find(it->first), it->first, m);
+    }
+    check(found && heightsWithin(t, 1), "keys inserted past the capacity are found");
+
+    t.clear();
+    m.clear();
+    check(t.find(2 * n) == t.end(), "clear() empties the filter");
+    t.insert(make_pair(7, 7));
+    m[7] = 7;
+    check(foundAs(t, t.find(7), 7, m), "inserts after clear() pass the filter");
+
+    t.disableBloomFilter();
+    rejects = t.bloomRejects();
+    falsePositives = t.bloomFalsePositives();
+    for (int i = 0; i < 100; i++) {
+        missed = missed && t.find(1000 + i) == t.end();
+    }
+    check(missed && t.bloomRejects() == rejects && t.bloomFalsePositives() == falsePositives,
+          "a disabled filter counts nothing");
+}
+
+// BST_STATS counters; without BST_STATS they stay zero whatever the tree does
+static void testStats()
+{
+    const int n = 4096;
+    AVLTree<int, int>::resetStats();
+    {
+        AVLTree<int, int> t;
+        map<int, int> m;
+        for (int i = 0; i < n; i++) {
+            t.insert(make_pair(i, i));
+            m[i] = i;
+        }
+        TreeStats afterInserts = AVLTree<int, int>::stats();
+        for (int i = 0; i < n; i += 2) {
+            t.insert(make_pair(i, -i));
+            m[i] = -i;
+        }
+        for (int i = 0; i < 2 * n; i++) {
+            t.find(i);
+        }
+        for (int i = 0; i < n; i += 4) {
+            t.remove(i);
+            m.erase(i);
+        }
+        t.remove(-1);
+        check(sameItems(t, m) && heightsWithin(t, 1), "counting does not change the tree");
+        TreeStats s = AVLTree<int, int>::stats();
+#ifdef BST_STATS
+        check(afterInserts.inserts == (uint64_t)n && afterInserts.allocations == (uint64_t)n,
+              "one insert and one allocation per new key");
+        // ascending keys only ever lean right
+        check(afterInserts.rotateLefts > 0 && afterInserts.rotateRights == 0,
+              "sorted inserts rotate left only");
+        check(afterInserts.insertFixCalls > 0 && afterInserts.maxInsertFixDepth <= 13,
+              "insertFix recursion is bounded by the height");
+        check(s.inserts == (uint64_t)(n + n / 2) && s.allocations == (uint64_t)n,
+              "overwrites count as inserts but allocate nothing");
+        check(s.removes == (uint64_t)(n / 4 + 1) && s.frees == (uint64_t)(n / 4),
+              "a remove of a missing key frees nothing");
+        check(s.lookups == (uint64_t)(2 * n + n / 4 + 1), "find() and remove() each look up once");
+        check(s.comparisonsPerOp() > 1 && s.comparisonsPerOp() <= 2 * 14, "comparisons are per level");
+        check(s.nodesVisited >= s.lookups, "lookups visit nodes");
+        check(s.insertFixDepth == 0 && s.removeFixDepth == 0, "fix depths unwind");
+#else
+        check(afterInserts.inserts == 0 && s.inserts == 0 && s.lookups == 0 && s.removes == 0 &&
+              s.rotateLefts == 0 && s.allocations == 0 && s.frees == 0 && s.comparisonsPerOp() == 0,
+              "counters stay zero without BST_STATS");
+#endif
+    }
+#ifdef BST_STATS
+    check(AVLTree<int, int>::stats().frees == (uint64_t)n, "the destructor frees the rest");
+#endif
+    AVLTree<int, int>::resetStats();
+    TreeStats cleared = AVLTree<int, int>::stats();
+    check(cleared.inserts == 0 && cleared.frees == 0 && cleared.maxInsertFixDepth == 0, "resetStats clears");
+}
+
+// shape() on trees whose shape is known exactly
+static void testShape()
+{
+    // 2^k - 1 ascending keys make a perfect AVL tree
+    const int levels = 12;
+    const int n = (1 << levels) - 1;
+    AVLTree<int, int> t;
+    for (int i = 0; i < n; i++) {
+        t.insert(make_pair(i, i));
+    }
+    TreeShape full = t.shape();
+    check(full.nodes == (size_t)n && full.height == levels && full.leaves == (size_t)(n + 1) / 2,
+          "shape() of a perfect tree");
+    check(full.leafDepthSpread() == 0 && full.minLeafDepth == levels - 1, "perfect tree leaves share one depth");
+    check(full.balances.size() == 1 && full.balances[0] == (size_t)n && heightsWithin(t, 0),
+          "perfect tree has no lean");
+    check(full.missPathLength == levels, "every miss in a perfect tree costs the height");
+
+    // one more key puts a leaf a level lower
+    t.insert(make_pair(n, n));
+    TreeShape more = t.shape();
+    check(more.leafDepthSpread() == 1 && more.height == levels + 1 && heightsWithin(t, 1),
+          "one extra key spreads the leaves");
+
+    // ascending keys make a plain tree a right chain
+    BinarySearchTree<int, int> plain;
+    const int chainLength = 500;
+    for (int i = 0; i < chainLength; i++) {
+        plain.insert(make_pair(i, i));
+    }
+    TreeShape chain = plain.shape();
+    check(chain.nodes == (size_t)chainLength && chain.height == chainLength && chain.leaves == 1,
+          "shape() of a chain");
+    check(chain.averagePathLength == (chainLength + 1) / 2.0 && chain.balances.rbegin()->first == chainLength - 1,
+          "chain path length and lean");
+    check(BinarySearchTree<int, int>().shape().nodes == 0, "shape() of an empty tree");
+}
+
+// One node of an exportTree() JSON dump; children are indices into the
+// parsed vector, -1 for none
+struct ExportedNode
+{
+    bool elided;
+    string key;
+    string value;
+    int balance;
+    long size;
+    int depth;
+    int left;
+    int right;
+};
+
+// Parses exportTree() JSON into nodes (pre-order); false if the text is
+// not the format tree_export.h documents
+class ExportParser
+{
+public:
+    ExportParser(const string& text) : text_(text), pos_(0) { }
+
+    bool parse(vector<ExportedNode>& nodes)
+    {
+        nodes.clear();
+        if (text_ == "null\n") {
+            return true;
+        }
+        int root = -1;
+        return object(nodes, 0, root) && text_.compare(pos_, string::npos, "\n") == 0;
+    }
+
+private:
+    bool eat(char c)
+    {
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool scalar(string& out)
+    {
+        out.clear();
+        if (!eat('"')) {
+            while (pos_ < text_.size() && (isdigit((unsigned char)text_[pos_]) || text_[pos_] == '-' ||
+                                           text_[pos_] == '.' || isalpha((unsigned char)text_[pos_]))) {
+                out += text_[pos_++];
+            }
+            return !out.empty();
+        }
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            if (text_[pos_] == '\\') {
+                pos_++;
+                if (pos_ == text_.size()) {
+                    return false;
+                }
+                out += text_[pos_] == 'n' ? '\n' : text_[pos_];
+            }
+            else {
+                out += text_[pos_];
+            }
+            pos_++;
+        }
+        return eat('"');
+    }
+
+    bool object(vector<ExportedNode>& nodes, int depth, int& index)
+    {
+        if (!eat('{')) {
+            return false;
+        }
+        index = (int)nodes.size();
+        ExportedNode blank = { false, "", "", 0, -1, depth, -1, -1 };
+        nodes.push_back(blank);
+        bool first = true;
+        while (!eat('}')) {
+            string name;
+            if ((!first && !eat(',')) || !scalar(name) || !eat(':')) {
+                return false;
+            }
+            first = false;
+            string v;
+            int child = -1;
+            if (name == "left" || name == "right") {
+                if (!object(nodes, depth + 1, child)) {
+                    return false;
+                }
+                (name == "left" ? nodes[index].left : nodes[index].right) = child;
+            }
+            else if (!scalar(v)) {
+                return false;
+            }
+            else if (name == "key") {
+                nodes[index].key = v;
+            }
+            else if (name == "value") {
+                nodes[index].value = v;
+            }
+            else if (name == "balance") {
+                nodes[index].balance = atoi(v.c_str());
+            }
+            else if (name == "size") {
+                nodes[index].size = atol(v.c_str());
+            }
+            else if (name == "elided" && v == "true") {
+                nodes[index].elided = true;
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    string text_;
+    size_t pos_;
+};
+
+static string exported(const AVLTree<int, int>& t, const TreeExportOptions& options)
+{
+    ostringstream out;
+    t.exportTree(out, options);
+    return out.str();
+}
+
+// Sizes and heights below node i of a parsed dump hold up: sizes add up
+// and balances are the real height differences. Returns the height.
+static int checkExported(const vector<ExportedNode>& nodes, int i, bool& ok)
+{
+    if (i < 0) {
+        return 0;
+    }
+    const ExportedNode& n = nodes[i];
+    int l = checkExported(nodes, n.left, ok);
+    int r = checkExported(nodes, n.right, ok);
+    long sizes = 1 + (n.left < 0 ? 0 : nodes[n.left].size) + (n.right < 0 ? 0 : nodes[n.right].size);
+    ok = ok && !n.elided && n.size == sizes && n.balance == r - l;
+    return 1 + max(l, r);
+}
+
+// Adds up the written nodes and the sizes of the elided ones
+static long exportedCount(const vector<ExportedNode>& nodes, int& deepest)
+{
+    long count = 0;
+    deepest = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        count += nodes[i].elided ? nodes[i].size : 1;
+        if (!nodes[i].elided) {
+            deepest = max(deepest, nodes[i].depth);
+        }
+    }
+    return count;
+}
+
+// exportTree(): JSON and DOT hold exactly the tree's keys, cut subtrees
+// carry exact sizes, sampling is reproducible and bad input throws
+static void testExport()
+{
+    mt19937 rng(50);
+    AVLTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 600; i++) {
+        int k = (int)(rng() % 5000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+    }
+    for (int i = 0; i < 100; i++) {
+        t.remove(m.begin()->first + i);
+        m.erase(m.begin()->first + i);
+    }
+    check(heightsWithin(t, 1), "exported tree is AVL");
+
+    TreeExportOptions options;
+    options.format = TreeExportOptions::JSON;
+    options.values = true;
+    options.balance = true;
+    options.size = true;
+    vector<ExportedNode> nodes;
+    check(ExportParser(exported(t, options)).parse(nodes), "JSON export parses");
+    map<int, int> fromJson;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        fromJson[atoi(nodes[i].key.c_str())] = atoi(nodes[i].value.c_str());
+    }
+    bool ok = true;
+    checkExported(nodes, 0, ok);
+    check(fromJson == m && nodes.size() == m.size(), "JSON holds every key and value once");
+    check(ok && nodes[0].size == (long)m.size(), "JSON sizes and balances are exact");
+
+    // DOT: one box per key, one edge per non-root node
+    options.format = TreeExportOptions::DOT;
+    options.values = false;
+    options.balance = false;
+    options.size = false;
+    string dot = exported(t, options);
+    istringstream lines(dot);
+    string line;
+    getline(lines, line);
+    bool header = line == "digraph tree {";
+    set<int> labels;
+    size_t edges = 0;
+    string last;
+    while (getline(lines, line)) {
+        last = line;
+        size_t label = line.find("[label=\"");
+        if (label != string::npos) {
+            labels.insert(atoi(line.c_str() + label + 8));
+        }
+        edges += line.find(" -> ") != string::npos;
+    }
+    bool sameKeys = labels.size() == m.size();
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        sameKeys = sameKeys && labels.count(it->first) == 1;
+    }
+    check(header && last == "}" && sameKeys && edges == m.size() - 1, "DOT holds every key once");
+
+    // maxDepth cuts below depth 3; with sizes on, the cuts say how much they hide
+    options.format = TreeExportOptions::JSON;
+    options.size = true;
+    options.maxDepth = 3;
+    int deepest = 0;
+    check(ExportParser(exported(t, options)).parse(nodes), "depth-limited JSON parses");
+    check(exportedCount(nodes, deepest) == (long)m.size() && deepest == 3, "elided sizes cover the cut subtrees");
+    options.size = false;
+    check(ExportParser(exported(t, options)).parse(nodes), "depth-limited JSON without sizes parses");
+    bool bare = true;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        bare = bare && (nodes[i].size == -1);
+    }
+    check(bare && nodes.size() == 15 + 16, "without sizes the 16 cuts are bare");
+    options.format = TreeExportOptions::DOT;
+    options.size = true;
+    dot = exported(t, options);
+    size_t hidden = 0;
+    size_t written = 0;
+    lines.clear();
+    lines.str(dot);
+    while (getline(lines, line)) {
+        size_t cut = line.find("label=\"... ");
+        if (cut != string::npos) {
+            hidden += atoi(line.c_str() + cut + 11);
+        }
+        written += line.find("[label=\"") != string::npos;
+    }
+    check(written == 15 && hidden + written == m.size(), "DOT cuts carry their sizes");
+
+    // sampling is reproducible from the seed, and sizes stay exact
+    options.format = TreeExportOptions::JSON;
+    options.maxDepth = -1;
+    options.sampleRate = 0.7;
+    options.seed = 9;
+    string sampled = exported(t, options);
+    check(sampled == exported(t, options), "one seed gives one dump");
+    check(ExportParser(sampled).parse(nodes) && exportedCount(nodes, deepest) == (long)m.size() &&
+          nodes.size() < m.size(), "sampled dumps account for every node");
+    options.seed = 10;
+    check(sampled != exported(t, options), "another seed samples differently");
+
+    // a subtree by key
+    options.sampleRate = 1;
+    check(ExportParser(exported(t, options)).parse(nodes), "JSON export parses again");
+    string rootKey = nodes[0].key;
+    string leftKey = nodes[nodes[0].left].key;
+    long leftSize = nodes[nodes[0].left].size;
+    ostringstream whole;
+    t.exportTree(whole, atoi(rootKey.c_str()), options);
+    check(whole.str() == exported(t, options), "exporting from the root key writes the whole tree");
+    ostringstream sub;
+    t.exportTree(sub, atoi(leftKey.c_str()), options);
+    check(ExportParser(sub.str()).parse(nodes) && nodes[0].key == leftKey && nodes[0].size == leftSize &&
+          (long)nodes.size() == leftSize, "subtree export starts at key");
+
+    bool missing = false;
+    try {
+        ostringstream out;
+        t.exportTree(out, -1, options);
+    }
+    catch (out_of_range&) {
+        missing = true;
+    }
+    check(missing, "exporting a missing key throws out_of_range");
+    int invalid = 0;
+    double rates[] = { 0, -0.5, 1.5 };
+    for (int i = 0; i < 3; i++) {
+        options.sampleRate = rates[i];
+        try {
+            exported(t, options);
+        }
+        catch (invalid_argument&) {
+            invalid++;
+        }
+    }
+    options.sampleRate = 1;
+    options.maxDepth = -2;
+    try {
+        exported(t, options);
+    }
+    catch (invalid_argument&) {
+        invalid++;
+    }
+    check(invalid == 4, "bad sample rates and depths throw invalid_argument");
+
+    // empty trees, and keys that need escaping
+    options.maxDepth = -1;
+    check(exported(AVLTree<int, int>(), options) == "null\n", "an empty tree is JSON null");
+    AVLTree<string, int> words;
+    string odd = "say \"hi\"\\\nbye";
+    words.insert(make_pair(odd, 1));
+    words.insert(make_pair(string("plain"), 2));
+    ostringstream wordsOut;
+    words.exportTree(wordsOut, options);
+    check(ExportParser(wordsOut.str()).parse(nodes) && nodes.size() == 2 &&
+          (nodes[0].key == odd || nodes[1].key == odd), "JSON strings are escaped");
+}
+
+// rebalance() and scapegoat auto-rebalancing keep the items and bound the height
+static void testAutoRebalance()
+{
+    BinarySearchTree<int, int> bad;
+    bool threw = false;
+    try {
+        bad.setAutoRebalance(0.5);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "auto-rebalance factor below 1 throws");
+    threw = false;
+    try {
+        bad.setAutoRebalance(std::nan(""));
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "NaN auto-rebalance factor throws");
+    bad.setAutoRebalance(0);
+    bad.setAutoRebalance(1);
+    bad.rebalance();
+    check(bad.empty(), "rebalance of an empty tree");
+
+    mt19937 rng(36);
+    BinarySearchTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 3000; i++) {
+        int k = (int)(rng() % 2000);
+        t.insert(make_pair(k, i));
+        m[k] = i;
+    }
+    t.rebalance();
+    check(sameItems(t, m), "rebalance keeps the items");
+    check(t.isBalanced(), "rebalance balances the tree");
+    check(t.shape().height == (int)ceil(log2((double)m.size() + 1)), "rebalance gives the minimum height");
+
+    // random inserts and removes against std::map
+    t.setAutoRebalance(2);
+    for (int i = 0; i < 20000; i++) {
+        int k = (int)(rng() % 5000);
+        if (i % 4 == 0) {
+            t.remove(k);
+            m.erase(k);
+        }
+        else {
+            t.insert(make_pair(k, i));
+            m[k] = i;
+        }
+    }
+    check(sameItems(t, m), "auto-rebalance keeps the items");
+
+    // descending input with a tighter factor
+    BinarySearchTree<int, int> down;
+    map<int, int> downMap;
+    down.setAutoRebalance(1.5);
+    for (int i = 200000; i > 0; i--) {
+        down.insert(make_pair(i, -i));
+        downMap[i] = -i;
+    }
+    check(sameItems(down, downMap), "descending auto-rebalance keeps the items");
+    check(down.shape().height <= 1.5 * log2(200000.0 + 1), "descending inserts stay within the height bound");
+
+    // sorted input used to trigger a full rebuild every few inserts
+    const int n = 1000000;
+    BinarySearchTree<int, int> sorted;
+    sorted.setAutoRebalance(2);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        sorted.insert(make_pair(i, i));
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    check(seconds < 30, "a million sorted inserts with auto-rebalance run in near-linear time");
+    check(sorted.size() == (size_t)n && sorted.min().first == 0 && sorted.max().first == n - 1,
+          "sorted auto-rebalance keeps the items");
+    check(sorted.shape().height <= 2 * log2((double)n + 1), "sorted inserts stay within the height bound");
+    int expected = 0;
+    bool inOrder = true;
+    for (BinarySearchTree<int, int>::iterator it = sorted.begin(); it != sorted.end(); ++it) {
+        inOrder = inOrder && it->first == expected++;
+    }
+    check(inOrder && expected == n, "sorted auto-rebalance keeps the order");
+}
+
+// aggregate()/total() against std::map across every kind of update
+static void testAggregates()
+{
+    mt19937 rng(31);
+    AggregateAVLTree<int, long long, SumMonoid<int, long long> > t;
+    map<int, long long> m;
+    for (int i = 0; i < 2000; i++) {
+        int k = (int)(rng() % 1000);
+        long long v = (long long)(rng() % 1000) - 500;
+        t.insert(make_pair(k, v));
+        m[k] = v;
+    }
+    checkAggregateRanges(t, m, rng, "aggregate after insert");
+
+    for (int i = 0; i < 500; i++) {
+        int k = (int)(rng() % 1000);
+        t.remove(k);
+        m.erase(k);
+    }
+    checkAggregateRanges(t, m, rng, "aggregate after remove");
+
+    t.erase_range(200, 350);
+    m.erase(m.lower_bound(200), m.lower_bound(350));
+    t.erase_range(900, 2000);
+    m.erase(m.lower_bound(900), m.end());
+    checkAggregateRanges(t, m, rng, "aggregate after erase_range");
+
+    t.compact();
+    checkAggregateRanges(t, m, rng, "aggregate after compact");
+    for (int i = 0; i < 300; i++) {
+        int k = (int)(rng() % 1000);
+        t.insert(make_pair(k, (long long)i));
+        m[k] = i;
+        t.remove(k / 2);
+        m.erase(k / 2);
+    }
+    checkAggregateRanges(t, m, rng, "aggregate after updating a compacted tree");
+
+    t.setBalanceThreshold(4);
+    for (int i = 0; i < 1000; i++) {
+        int k = 1000 + i;
+        t.insert(make_pair(k, (long long)k));
+        m[k] = k;
+    }
+    checkAggregateRanges(t, m, rng, "aggregate with a relaxed threshold");
+    t.tighten();
+    check(t.isBalanced(), "tighten balances the tree");
+    checkAggregateRanges(t, m, rng, "aggregate after tighten");
+    check(t.size() == m.size(), "aggregate tree size");
+}
+
+// overlapping() and stab() against a linear scan of the same intervals
+static void testIntervals()
+{
+    mt19937 rng(32);
+    IntervalTree<int, int> t;
+    map<pair<int, int>, int> m;
+    for (int i = 0; i < 1500; i++) {
+        int start = (int)(rng() % 1000);
+        int end = start + 1 + (int)(rng() % 60);
+        t.insert(start, end, i);
+        m[make_pair(start, end)] = i;
+    }
+    for (int i = 0; i < 400; i++) {
+        map<pair<int, int>, int>::iterator it = m.begin();
+        advance(it, rng() % m.size());
+        t.remove(it->first.first, it->first.second);
+        m.erase(it);
+    }
+
+    for (int q = 0; q < 300; q++) {
+        int lo = (int)(rng() % 1100) - 50;
+        int hi = lo + (int)(rng() % 40);
+        vector<int> expected;
+        for (map<pair<int, int>, int>::iterator it = m.begin(); it != m.end(); ++it) {
+            if (it->first.first < hi && lo < it->first.second && lo < hi) {
+                expected.push_back(it->second);
+            }
+        }
+        vector<int> found;
+        t.overlapping(lo, hi, [&found](const IntervalTree<int, int>::Item& item) { found.push_back(item.second); });
+        check(found == expected, "overlapping matches a linear scan");
+
+        expected.clear();
+        for (map<pair<int, int>, int>::iterator it = m.begin(); it != m.end(); ++it) {
+            if (it->first.first <= lo && lo < it->first.second) {
+                expected.push_back(it->second);
+            }
+        }
+        found.clear();
+        t.stab(lo, [&found](const IntervalTree<int, int>::Item& item) { found.push_back(item.second); });
+        check(found == expected, "stab matches a linear scan");
+    }
+
+    IntervalTree<int, int> one;
+    one.insert(0, 10, 1);
+    size_t hits = 0;
+    one.overlapping(5, 5, [&hits](const IntervalTree<int, int>::Item&) { hits++; });
+    check(hits == 0, "empty overlapping query reports nothing");
+    one.overlapping(10, 20, [&hits](const IntervalTree<int, int>::Item&) { hits++; });
+    check(hits == 0, "half-open intervals touching at an end do not overlap");
+    bool threw = false;
+    try {
+        one.insert(3, 3, 0);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "empty interval is rejected");
+}
+
+// TimedTree behaves like its engine and samples the requested share of calls
+static void testTimedTree()
+{
+    TimedTree<int, int> t;
+    map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        t.insert(make_pair((i * 7919) % 1000, i));
+        m[(i * 7919) % 1000] = i;
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        t.remove(i);
+        m.erase(i);
+    }
+    size_t hits = 0;
+    for (int i = 0; i < 1000; i++) {
+        hits += (t.find(i) != t.end());
+    }
+    size_t visited = 0;
+    long long sum = 0;
+    t.forEach([&](const pair<const int, int>& item) { visited++; sum += item.second; });
+    long long expected = 0;
+    for (map<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+        expected += it->second;
+    }
+    check(hits == m.size() && visited == m.size() && sum == expected, "TimedTree matches std::map");
+    check(t.insertLatency().count() == 1000, "every insert timed");
+    check(t.removeLatency().count() == 334, "every remove timed");
+    check(t.findLatency().count() == 1000, "every find timed");
+    check(t.iterateLatency().count() == m.size(), "every iterator step timed");
+    check(t.insertLatency().min() <= t.insertLatency().percentile(50) &&
+          t.insertLatency().percentile(50) <= t.insertLatency().percentile(99) &&
+          t.insertLatency().percentile(99) <= t.insertLatency().max(), "latency percentiles are ordered");
+
+    t.resetLatency();
+    t.setSampleRate(10);
+    for (int i = 0; i < 1000; i++) {
+        t.find(i);
+    }
+    check(t.findLatency().count() == 100 && t.insertLatency().count() == 0, "one find in ten timed");
+    bool threw = false;
+    try {
+        t.setSampleRate(0);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "sample rate 0 is rejected");
+}
+
+// True if the trace at path holds exactly ops
+template <typename Key>
+static bool traceMatches(const char* path, const vector<pair<TraceOp, Key> >& ops)
+{
+    TraceReader<Key> reader(path);
+    TraceOp op;
+    Key key = Key();
+    size_t i = 0;
+    while (reader.next(op, key)) {
+        if (i >= ops.size() || op != ops[i].first || (op != TRACE_ITERATE && !(key == ops[i].second))) {
+            return false;
+        }
+        i++;
+    }
+    return i == ops.size();
+}
+
+// Writes ops with a TraceWriter and checks that a TraceReader returns them
+template <typename Key>
+static void checkTraceRoundTrip(const vector<pair<TraceOp, Key> >& ops, const char* path, const char* what)
+{
+    {
+        TraceWriter<Key> writer(path);
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (ops[i].first == TRACE_ITERATE) {
+                writer.recordIterate();
+            }
+            else {
+                writer.record(ops[i].first, ops[i].second);
+            }
+        }
+        writer.flush();
+    }
+    check(traceMatches(path, ops), what);
+}
+
+// RecordingTree and TraceWriter output read back through TraceReader
+static void testTrace()
+{
+    const char* path = "bst-test.trace";
+    mt19937 rng(46);
+    vector<pair<TraceOp, int> > expected;
+    {
+        RecordingTree<int, int> t(path);
+        for (int i = 0; i < 2000; i++) {
+            int k = (int)(rng() % 2000) - 1000;
+            switch (rng() % 3) {
+            case 0:
+                t.insert(make_pair(k, i));
+                expected.push_back(make_pair(TRACE_INSERT, k));
+                break;
+            case 1:
+                t.remove(k);
+                expected.push_back(make_pair(TRACE_REMOVE, k));
+                break;
+            default:
+                t.find(k);
+                expected.push_back(make_pair(TRACE_FIND, k));
+                break;
+            }
+        }
+        t.forEach([](const pair<const int, int>&) {});
+        expected.push_back(make_pair(TRACE_ITERATE, 0));
+        t.flushTrace();
+        check(t.traceRecords() == expected.size(), "RecordingTree counts its records");
+    }
+    check(traceMatches(path, expected), "RecordingTree trace reads back");
+
+    // extreme deltas, narrow keys that wrap, and keys without a varint codec
+    vector<pair<TraceOp, long long> > wide;
+    wide.push_back(make_pair(TRACE_INSERT, numeric_limits<long long>::min()));
+    wide.push_back(make_pair(TRACE_FIND, numeric_limits<long long>::max()));
+    wide.push_back(make_pair(TRACE_REMOVE, 0LL));
+    wide.push_back(make_pair(TRACE_ITERATE, 0LL));
+    wide.push_back(make_pair(TRACE_FIND, -1LL));
+    checkTraceRoundTrip(wide, path, "64-bit trace round trip");
+    vector<pair<TraceOp, unsigned char> > narrow;
+    for (int k = 0; k < 600; k += 37) {
+        narrow.push_back(make_pair(TRACE_INSERT, (unsigned char)(255 - k % 256)));
+    }
+    checkTraceRoundTrip(narrow, path, "8-bit trace round trip");
+    vector<pair<TraceOp, string> > words;
+    words.push_back(make_pair(TRACE_INSERT, string("pear")));
+    words.push_back(make_pair(TRACE_FIND, string("")));
+    words.push_back(make_pair(TRACE_REMOVE, string("apple")));
+    checkTraceRoundTrip(words, path, "string trace round trip");
+
+    bool threw = false;
+    try {
+        TraceReader<int> wrongType(path);
+    }
+    catch (invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "trace with another key type is rejected");
+
+    // cut the last record in half
+    {
+        TraceWriter<int> writer(path);
+        writer.record(TRACE_INSERT, 1 << 30);
+        writer.flush();
+    }
+    ifstream in(path, ios::binary);
+    string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    in.close();
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(bytes.data(), bytes.size() - 1);
+    out.close();
+    threw = false;
+    try {
+        TraceReader<int> truncated(path);
+        TraceOp op;
+        int key;
+        while (truncated.next(op, key)) {
+        }
+    }
+    catch (runtime_error&) {
+        threw = true;
+    }
+    check(threw, "truncated trace is reported");
+    remove(path);
+}
+
+// MappedTree lookups and iteration against std::map, and a rewrite of
+// the file while an old mapping of it is still being read
+static void testMappedTree()
+{
+    const char* path = "bst-test.map";
+    mt19937 rng(39);
+    AVLTree<int, long long> t;
+    map<int, long long> m;
+    for (int i = 0; i < 5000; i++) {
+        int k = (int)(rng() % 20000);
+        t.insert(make_pair(k, (long long)i));
+        m[k] = i;
+    }
+    MappedTree<int, long long>::write(t, path);
+    {
+        MappedTree<int, long long> mapped(path);
+        check(mapped.size() == m.size(), "mapped size");
+        bool same = true;
+        map<int, long long>::iterator expect = m.begin();
+        for (MappedTree<int, long long>::const_iterator it = mapped.begin(); it != mapped.end(); ++it, ++expect) {
+            same = same && expect != m.end() && it->first == expect->first && it->second == expect->second;
+        }
+        check(same && expect == m.end(), "mapped iteration in key order");
+        MappedTree<int, long long>::const_iterator back = mapped.end();
+        --back;
+        check(back->first == m.rbegin()->first, "decrementing end() gives the last item");
+        for (int q = 0; q < 2000; q++) {
+            int k = (int)(rng() % 20100) - 50;
+            map<int, long long>::iterator lb = m.lower_bound(k);
+            MappedTree<int, long long>::const_iterator found = mapped.lower_bound(k);
+            check(lb == m.end() ? found == mapped.end() : (found != mapped.end() && found->first == lb->first),
+                  "mapped lower_bound");
+            check((mapped.find(k) != mapped.end()) == (m.count(k) > 0), "mapped find");
+        }
+
+        // shrink the file under the open mapping; the old one must stay readable
+        AVLTree<int, long long> small;
+        small.insert(make_pair(1, 1LL));
+        MappedTree<int, long long>::write(small, path);
+        long long sum = 0;
+        long long expectedSum = 0;
+        for (MappedTree<int, long long>::const_iterator it = mapped.begin(); it != mapped.end(); ++it) {
+            sum += it->second;
+        }
+        for (expect = m.begin(); expect != m.end(); ++expect) {
+            expectedSum += expect->second;
+        }
+        check(sum == expectedSum, "old mapping survives a rewrite");
+    }
+    MappedTree<int, long long> rewritten(path);
+    check(rewritten.size() == 1 && rewritten[1] == 1, "rewritten file holds the new tree");
+    bool threw = false;
+    try {
+        MappedTree<int, int> wrongTypes(path);
+    }
+    catch (runtime_error&) {
+        threw = true;
+    }
+    check(threw, "mapped file with other types is rejected");
+    remove(path);
+}
+
 int main(int argc, char *argv[])
 {
     // Binary Search Tree tests
@@ -38,6 +1939,30 @@ int main(int argc, char *argv[])
     bt.remove(8);
     bt.print();
 
+    testRelaxedBalance();
+    testFingerSearch();
+    testLookupCache();
+    testFindBatch();
+    testFindSorted();
+    testBloomFilter();
+    testCachedEnds();
+    testIterators();
+    testErase();
+    testAutoRebalance();
+    testCompact();
+    testSnapshots();
+    testStats();
+    testShape();
+    testExport();
+    testAggregates();
+    testIntervals();
+    testTimedTree();
+    testTrace();
+    testMappedTree();
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
     return 0;
     // cout << "Binary Search Tree contents:" << endl;
     // BinarySearchTree<int, int>::iterator it = bt.begin();
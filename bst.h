@@ -3,10 +3,29 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <utility>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+#include <cmath>
+#include "bloom.h"
+#include "tree_stats.h"
+#include "tree_shape.h"
+#include "tree_export.h"
 
 using namespace std;
+
+// Hint the CPU to start loading a node we are about to visit
+#if defined(__GNUC__)
+#define BST_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define BST_PREFETCH(ptr) ((void)(ptr))
+#endif
+
 /**
  * A templated class for a Node in a search tree.
  * The getters for parent/left/right are virtual so
@@ -200,18 +219,67 @@ public:
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+    virtual void rebalance();
+    void setAutoRebalance(double factor);
     void print() const;
     bool empty() const;
+    size_t size() const;
+
+    // O(1) access to the ends of the tree
+    std::pair<const Key, Value>& min() const;
+    std::pair<const Key, Value>& max() const;
+    std::pair<Key, Value> pop_min();
+    std::pair<Key, Value> pop_max();
+
+    // Optional direct-mapped cache from key hash to node, checked before internalFind descends.
+    // Lookups write it, so concurrent readers need a lock while it is on.
+    template<typename Hash = std::hash<Key> >
+    void enableLookupCache(size_t slots);
+    void disableLookupCache();
+    size_t lookupCacheHits() const;
+    size_t lookupCacheMisses() const;
+
+    // Optional Bloom filter over the keys; lookups it rules out skip the descent.
+    // Lookups update its counters and may rebuild it, so readers need a lock while it is on.
+    template<typename Hash = std::hash<Key> >
+    void enableBloomFilter(size_t expectedKeys, double bitsPerKey = 10);
+    void disableBloomFilter();
+    size_t bloomRejects() const;
+    size_t bloomFalsePositives() const;
+    double bloomFalsePositiveRate() const;
+    size_t bloomMemoryBytes() const;
+
+    // Operation counters for the calling thread; all zero unless built with BST_STATS
+    static TreeStats stats();
+    static void resetStats();
+
+    // O(n) shape report; weight(item) gives each item's access weight
+    TreeShape shape() const;
+    template<typename Weight>
+    TreeShape shape(Weight weight) const;
+
+    // Streams the tree, or the subtree under key, as DOT or JSON (see tree_export.h)
+    void exportTree(std::ostream& out, const TreeExportOptions& options = TreeExportOptions()) const;
+    void exportTree(std::ostream& out, const Key& key, const TreeExportOptions& options) const;
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * Bidirectional: decrementing end() yields the largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -221,21 +289,73 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
         friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class const_iterator;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value>* tree_;
+    };
+
+    /**
+    * Read-only counterpart of iterator. An iterator converts to it.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
 
-        // inOrder helper functions
-        Node<Key, Value>* findMostLeft(Node<Key, Value>* current);
-        Node<Key, Value>* findFirstLeftPointer(Node<Key, Value>* current);
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        const_iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value>* tree);
+        Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value>* tree_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    void find_batch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+
+    // Erase without repeating the search; each returns the position after the erased items
+    iterator erase(iterator pos);
+    virtual iterator erase(iterator first, iterator last);
+    virtual void erase_range(const Key& lo, const Key& hi);
+    template<typename KeyIt, typename OutIt>
+    OutIt find_sorted(KeyIt keys_first, KeyIt keys_last, OutIt out) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
@@ -244,6 +364,7 @@ protected:
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    static Node<Key, Value>* successor(Node<Key, Value>* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
@@ -257,14 +378,64 @@ protected:
     void clearHelper(Node<Key, Value>* current);
     Node<Key, Value>* getSmallestNodeHelper(Node<Key, Value>* current) const;
     Node<Key, Value>* internalFindHelper(Node<Key, Value>* current, const Key& key) const;
+    template<typename KeyIt, typename OutIt>
+    OutIt findSortedHelper(Node<Key, Value>* current, KeyIt first, KeyIt last, OutIt out) const;
     bool isBalancedHelper(Node<Key, Value>* current) const;
+    void rotateNodeLeft(Node<Key, Value>* g);
+    void rotateNodeRight(Node<Key, Value>* g);
+    void rebuildSubtree(Node<Key, Value>* top, size_t count);
+    void rebuildScapegoat(Node<Key, Value>* added);
+    void compressVine(Node<Key, Value>* parent, bool leftSide, size_t count);
+    static size_t countNodes(Node<Key, Value>* current);
     static int getHeight(Node<Key, Value>* current);
+    static Node<Key, Value>* findMostLeft(Node<Key, Value>* current);
+    static Node<Key, Value>* findFirstLeftPointer(Node<Key, Value>* current);
     static Node<Key, Value>* findMostRight(Node<Key, Value>* current);
     static Node<Key, Value>* findFirstRightPointer(Node<Key, Value>* current);
+    // Lets derived trees build and unpack iterators
+    iterator makeIterator(Node<Key, Value>* n) const;
+    static Node<Key, Value>* iteratorNode(const iterator& it);
+    void forgetCachedNode(Node<Key, Value>* n);
+    void forgetNode(Node<Key, Value>* n);
+    bool bloomRulesOut(const Key& key) const;
+    void rebuildBloom() const;
+    void noteInserted(Node<Key, Value>* n);
+    void noteRemoving(Node<Key, Value>* n);
+    virtual void eraseNode(Node<Key, Value>* n);
+    virtual void destroyNode(Node<Key, Value>* n);
+    template<typename Hash>
+    static size_t lookupHashOf(const Key& key);
 
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+
+    // Cached ends of the tree and element count
+    Node<Key, Value>* leftmost_;
+    Node<Key, Value>* rightmost_;
+    size_t size_;
+
+    // Rebuild a scapegoat subtree once an insert lands deeper than
+    // factor * log2(n + 1); 0 = never
+    double autoRebalance_;
+
+    // Lookup cache; empty when disabled. Slots only ever hold live nodes.
+    mutable std::vector<Node<Key, Value>*> lookupCache_;
+    size_t (*lookupHash_)(const Key&);
+    mutable size_t cacheHits_;
+    mutable size_t cacheMisses_;
+
+    // Bloom filter; bloomHash_ is null when disabled. Removed keys stay set
+    // until the next rebuild, which happens lazily once they are a fifth of
+    // the filter's keys or the filter outgrows its capacity.
+    mutable BloomFilter bloom_;
+    uint64_t (*bloomHash_)(const Key&);
+    double bloomBitsPerKey_;
+    mutable size_t bloomCapacity_;
+    mutable size_t bloomRemoved_;
+    mutable bool bloomStale_;
+    mutable size_t bloomRejects_;
+    mutable size_t bloomFalsePositives_;
 };
 
 /*
@@ -275,12 +446,15 @@ Begin implementations for the BinarySearchTree::iterator class.
 
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
+* The tree is remembered so that end() can be decremented.
 */
 template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr,
+                                                 const BinarySearchTree<Key, Value>* tree)
 {
     // TODO
     current_ = ptr;
+    tree_ = tree;
 }
 
 /**
@@ -291,6 +465,7 @@ BinarySearchTree<Key, Value>::iterator::iterator()
 {
     // TODO
     current_ = nullptr;
+    tree_ = nullptr;
 }
 
 /**
@@ -349,51 +524,43 @@ BinarySearchTree<Key, Value>::iterator::operator++()
 {
     // TODO
     if (current_ != nullptr) {
-        // get from current_ -> essentially finding the successor
-        if (current_->getRight() == nullptr) {
-            // no right tree -> get parent to find first left pointer
-            current_ = findFirstLeftPointer(current_);
-        } else {
-            // there is a right tree
-            current_ = findMostLeft(current_->getRight());
-        }
+        current_ = successor(current_);
     }
     return *this;
 }
 
 template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::iterator::findMostLeft(Node<Key, Value>* current) {
-    if (current == nullptr) {
-        return nullptr;
-    }
-
-    if (current -> getLeft() != nullptr) {
-        return findMostLeft(current->getLeft());
-    } else {
-        return current;
-    }
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
 }
 
+/**
+* Moves back one item in order. Decrementing end() gives the largest item.
+*/
 template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::iterator::findFirstLeftPointer(Node<Key, Value>* current) {
-    if (current == nullptr) { 
-        return nullptr;
+typename BinarySearchTree<Key, Value>::iterator&
+BinarySearchTree<Key, Value>::iterator::operator--()
+{
+    if (current_ != nullptr) {
+        current_ = predecessor(current_);
     }
-
-    Node<Key, Value>* p = current->getParent();
-    if (p == nullptr) {
-      // at root
-      return nullptr;
-    }
-    
-    if (current == p->getLeft()) {
-      // is a left child
-      return p;
-    } else {
-        return findFirstLeftPointer(p);
+    else if (tree_ != nullptr) {
+        current_ = tree_->rightmost_;
     }
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
 }
 
 /*
@@ -402,6 +569,112 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator(Node<Key,Value> *ptr,
+                                                             const BinarySearchTree<Key, Value>* tree) :
+    current_(ptr), tree_(tree)
+{
+
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator() :
+    current_(nullptr), tree_(nullptr)
+{
+
+}
+
+/**
+* Converting constructor so iterators can be used where const_iterators are expected.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), tree_(it.tree_)
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<class Key, class Value>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<class Key, class Value>
+bool
+BinarySearchTree<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<class Key, class Value>
+bool
+BinarySearchTree<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator++()
+{
+    if (current_ != nullptr) {
+        current_ = successor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator--()
+{
+    if (current_ != nullptr) {
+        current_ = predecessor(current_);
+    }
+    else if (tree_ != nullptr) {
+        current_ = tree_->rightmost_;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -412,7 +685,11 @@ Begin implementations for the BinarySearchTree class.
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
 template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+BinarySearchTree<Key, Value>::BinarySearchTree() :
+    leftmost_(nullptr), rightmost_(nullptr), size_(0), autoRebalance_(0),
+    lookupHash_(nullptr), cacheHits_(0), cacheMisses_(0),
+    bloomHash_(nullptr), bloomBitsPerKey_(10), bloomCapacity_(0), bloomRemoved_(0),
+    bloomStale_(false), bloomRejects_(0), bloomFalsePositives_(0)
 {
     // TODO
     root_ = nullptr;
@@ -434,163 +711,764 @@ bool BinarySearchTree<Key, Value>::empty() const
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+ * Returns the number of items in the tree
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::size() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return size_;
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
-*/
+ * @precondition The tree is not empty
+ * Returns the item with the smallest key
+ */
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+std::pair<const Key, Value>& BinarySearchTree<Key, Value>::min() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    if(leftmost_ == NULL) throw std::out_of_range("Empty tree");
+    return leftmost_->getItem();
 }
 
 /**
-* Returns an iterator whose value means INVALID
-*/
+ * @precondition The tree is not empty
+ * Returns the item with the largest key
+ */
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+std::pair<const Key, Value>& BinarySearchTree<Key, Value>::max() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    if(rightmost_ == NULL) throw std::out_of_range("Empty tree");
+    return rightmost_->getItem();
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
-*/
+ * @precondition The tree is not empty
+ * Removes and returns the item with the smallest key. No search is
+ * needed, so the cost is the unlinking plus any rebalancing.
+ */
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+std::pair<Key, Value> BinarySearchTree<Key, Value>::pop_min()
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    if(leftmost_ == NULL) throw std::out_of_range("Empty tree");
+    std::pair<Key, Value> item(leftmost_->getKey(), leftmost_->getValue());
+    eraseNode(leftmost_);
+    return item;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
+ * @precondition The tree is not empty
+ * Removes and returns the item with the largest key
  */
 template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+std::pair<Key, Value> BinarySearchTree<Key, Value>::pop_max()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    if(rightmost_ == NULL) throw std::out_of_range("Empty tree");
+    std::pair<Key, Value> item(rightmost_->getKey(), rightmost_->getValue());
+    eraseNode(rightmost_);
+    return item;
 }
+
+/**
+* Bookkeeping for a node that was just linked into the tree.
+*/
 template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+void BinarySearchTree<Key, Value>::noteInserted(Node<Key, Value>* n)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    size_++;
+    if (leftmost_ == nullptr || n->getKey() < leftmost_->getKey()) {
+        leftmost_ = n;
+    }
+    if (rightmost_ == nullptr || rightmost_->getKey() < n->getKey()) {
+        rightmost_ = n;
+    }
+    if (bloomHash_ != nullptr && !bloomStale_) {
+        bloom_.add(bloomHash_(n->getKey()));
+        if (bloom_.keyCount() > bloomCapacity_) {
+            bloomStale_ = true;
+        }
+    }
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Bookkeeping for a node that is about to be unlinked and freed. Must run
+* while n is still in the tree so its neighbours can be found.
 */
 template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+void BinarySearchTree<Key, Value>::noteRemoving(Node<Key, Value>* n)
 {
-    // cout << "inserting" << endl;
-    // TODO
-    // cout << keyValuePair.first << endl;
-    Node<Key, Value>* current = root_;
-    Node<Key, Value>* parent = nullptr;
-
-    if (root_ == nullptr) {
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-        return;
+    size_--;
+    if (n == leftmost_) {
+        leftmost_ = successor(n);
     }
+    if (n == rightmost_) {
+        rightmost_ = predecessor(n);
+    }
+    forgetNode(n);
+}
 
-    while (current != nullptr) {
-        // cout << "current node: " << current->getKey() << " " << current->getValue() << endl;
-        parent = current;
-        if (keyValuePair.first == current->getKey()) {
-            // duplicate, replace value
-            current->setValue(keyValuePair.second);
-            return;
-        }
-        else if (keyValuePair.first > current->getKey()) {
-            // go right
-            current = current->getRight();
-        }
-        else {
-            // cout << "HERE" << endl;
-            // go left
-            current = current->getLeft();
-        } 
+/**
+* Turns on the lookup cache with at least the given number of slots
+* (rounded up to a power of two). Each slot remembers the last node found
+* for keys hashing to it, so repeated lookups of hot keys cost one probe.
+* Nodes keep their items when nodeSwap relinks them, so only removal and
+* clear() need to drop entries.
+*
+* While the cache is on, the const lookups find() and operator[] write
+* its slots and counters, so two threads may no longer read one tree at
+* the same time without a lock. With the cache off, concurrent const
+* reads are safe as before.
+*/
+template<typename Key, typename Value>
+template<typename Hash>
+void BinarySearchTree<Key, Value>::enableLookupCache(size_t slots)
+{
+    size_t size = 1;
+    while (size < slots) {
+        size <<= 1;
     }
+    lookupCache_.assign(size, nullptr);
+    lookupHash_ = &BinarySearchTree<Key, Value>::template lookupHashOf<Hash>;
+    cacheHits_ = 0;
+    cacheMisses_ = 0;
+}
 
-    // cout << "Parent node: " << parent->getKey() << " " << parent->getValue() << endl;
-    // cout << (current==nullptr) << endl;
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::disableLookupCache()
+{
+    std::vector<Node<Key, Value>*>().swap(lookupCache_);
+    lookupHash_ = nullptr;
+}
 
-    if (keyValuePair.first > parent->getKey()) {
-        // cout << "HERE1" << endl;
-        // set right
-        Node<Key, Value>* temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
-        parent->setRight(temp);
-    }
-    else if (keyValuePair.first < parent->getKey()) {
-        // set left
-        Node<Key, Value>* temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
-        parent->setLeft(temp);
-        // cout << "Parent node: " << parent->getKey() << " " << parent->getValue() << endl;
-        // cout << "Parent left: " << parent->getLeft()->getKey() << " " << parent->getLeft()->getValue() << endl;
-        // cout << "HERE2" << endl;
-    } 
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::lookupCacheHits() const
+{
+    return cacheHits_;
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::lookupCacheMisses() const
+{
+    return cacheMisses_;
+}
+
+template<typename Key, typename Value>
+template<typename Hash>
+size_t BinarySearchTree<Key, Value>::lookupHashOf(const Key& key)
+{
+    return Hash()(key);
 }
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Drops n from the lookup cache. Must be called before a node is freed.
 */
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+void BinarySearchTree<Key, Value>::forgetCachedNode(Node<Key, Value>* n)
 {
-    // cout << "removing" << endl;
-    // TODO
-    // first find the node
-    Node<Key, Value>* removeNode = internalFind(key);
-
-    if (removeNode == nullptr) {
+    if (lookupCache_.empty()) {
         return;
     }
+    Node<Key, Value>*& slot = lookupCache_[lookupHash_(n->getKey()) & (lookupCache_.size() - 1)];
+    if (slot == n) {
+        slot = nullptr;
+    }
+}
 
-    // cout << "removeNode: " << removeNode->getKey() << " " << removeNode->getValue() << endl;
-
-    Node<Key, Value>* parent = removeNode -> getParent();
-    // if no children
-    if (removeNode -> getRight() == nullptr && removeNode -> getLeft() == nullptr) {
-        if (parent == nullptr) {
-            // remove node is the root
-            root_= nullptr;
-            // delete removeNode;
-            return;
-        }
-        if (removeNode == parent->getLeft()) {
-            parent->setLeft(nullptr);
-        } else if (removeNode == parent->getRight()) {
-            parent->setRight(nullptr);
+/**
+* Everything a tree remembers about a node besides its links: its cache
+* slot and its key in the Bloom filter. Call before the node is freed.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::forgetNode(Node<Key, Value>* n)
+{
+    forgetCachedNode(n);
+    if (bloomHash_ != nullptr && !bloomStale_) {
+        bloomRemoved_++;
+        if (4 * bloomRemoved_ > bloom_.keyCount()) {
+            bloomStale_ = true;
         }
     }
-    // cout << "Parent: " << parent->getKey() << " " << parent->getValue() << endl;
-    // cout << "removeNode: " << removeNode->getKey() << " " << removeNode->getValue() << endl;
-    // cout << "removeNode Right: " << removeNode->getRight()->getKey() << " " << removeNode->getRight()->getValue() << endl;
-    // cout << "Parent: " << parent->getKey() << " " << parent->getValue() << endl;
+}
+
+/**
+* Turns on a blocked Bloom filter sized for expectedKeys at bitsPerKey
+* (10 bits gives about 1% false positives). find(), operator[] and
+* remove() return at once for keys it rules out. The filter follows
+* inserts directly; after many removes, or once the tree outgrows it, it
+* is rebuilt on the next lookup in O(n).
+*
+* While the filter is on, find(), operator[] and find_batch() bump its
+* counters and may rebuild it although they are const, so concurrent
+* readers of one tree need a lock, as with the lookup cache.
+*/
+template<typename Key, typename Value>
+template<typename Hash>
+void BinarySearchTree<Key, Value>::enableBloomFilter(size_t expectedKeys, double bitsPerKey)
+{
+    bloomHash_ = &bloomHash<Key, Hash>;
+    bloomBitsPerKey_ = bitsPerKey;
+    bloomCapacity_ = expectedKeys;
+    bloomRejects_ = 0;
+    bloomFalsePositives_ = 0;
+    rebuildBloom();
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::disableBloomFilter()
+{
+    bloom_ = BloomFilter();
+    bloomHash_ = nullptr;
+    bloomStale_ = false;
+}
+
+/**
+* Lookups answered by the filter alone.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::bloomRejects() const
+{
+    return bloomRejects_;
+}
+
+/**
+* Lookups the filter let through that then missed.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::bloomFalsePositives() const
+{
+    return bloomFalsePositives_;
+}
+
+/**
+* The filter's expected false-positive rate, from the bits currently set.
+*/
+template<typename Key, typename Value>
+double BinarySearchTree<Key, Value>::bloomFalsePositiveRate() const
+{
+    if (bloomStale_) {
+        rebuildBloom();
+    }
+    return bloom_.falsePositiveRate();
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::bloomMemoryBytes() const
+{
+    return bloom_.memoryBytes();
+}
+
+/**
+* Depth histogram, path lengths and balance distribution of the tree.
+*/
+template<typename Key, typename Value>
+TreeShape BinarySearchTree<Key, Value>::shape() const
+{
+    return shape(UnitShapeWeight());
+}
+
+/**
+* As shape(), with weightedPathLength averaging search cost over
+* weight(item), for example observed access counts.
+*/
+template<typename Key, typename Value>
+template<typename Weight>
+TreeShape BinarySearchTree<Key, Value>::shape(Weight weight) const
+{
+    return measureShape(root_,
+                        [](Node<Key, Value>* n) { return n->getLeft(); },
+                        [](Node<Key, Value>* n) { return n->getRight(); },
+                        [&weight](Node<Key, Value>* n) { return weight(n->getItem()); });
+}
+
+/**
+* Writes the whole tree; unlike print() there is no limit on its height.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportTree(std::ostream& out, const TreeExportOptions& options) const
+{
+    ::exportTree(out, root_,
+                 [](Node<Key, Value>* n) { return n->getLeft(); },
+                 [](Node<Key, Value>* n) { return n->getRight(); },
+                 [](Node<Key, Value>* n) -> const Key& { return n->getKey(); },
+                 [](Node<Key, Value>* n) -> const Value& { return n->getValue(); },
+                 options);
+}
+
+/**
+* Writes only the subtree rooted at key's node; depths in options count
+* from there. Throws std::out_of_range if key is not in the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::exportTree(std::ostream& out, const Key& key,
+                                              const TreeExportOptions& options) const
+{
+    Node<Key, Value>* top = internalFind(key);
+    if (top == NULL) throw std::out_of_range("Invalid key");
+    ::exportTree(out, top,
+                 [](Node<Key, Value>* n) { return n->getLeft(); },
+                 [](Node<Key, Value>* n) { return n->getRight(); },
+                 [](Node<Key, Value>* n) -> const Key& { return n->getKey(); },
+                 [](Node<Key, Value>* n) -> const Value& { return n->getValue(); },
+                 options);
+}
+
+/**
+* Counters for the calling thread, summed over every tree it has used.
+*/
+template<typename Key, typename Value>
+TreeStats BinarySearchTree<Key, Value>::stats()
+{
+    return treeStats();
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::resetStats()
+{
+    treeStats().reset();
+}
+
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::bloomRulesOut(const Key& key) const
+{
+    if (bloomHash_ == nullptr) {
+        return false;
+    }
+    if (bloomStale_) {
+        rebuildBloom();
+    }
+    if (bloom_.mayContain(bloomHash_(key))) {
+        return false;
+    }
+    bloomRejects_++;
+    return true;
+}
+
+/**
+* Refills the filter from the live keys, doubling its capacity if the tree
+* has outgrown it.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildBloom() const
+{
+    if (bloomHash_ == nullptr) {
+        return;
+    }
+    if (size_ >= bloomCapacity_) {
+        bloomCapacity_ = 2 * size_;
+    }
+    bloom_.reset(bloomCapacity_, bloomBitsPerKey_);
+    for (Node<Key, Value>* n = leftmost_; n != nullptr; n = successor(n)) {
+        bloom_.add(bloomHash_(n->getKey()));
+    }
+    bloomRemoved_ = 0;
+    bloomStale_ = false;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::begin() const
+{
+    BinarySearchTree<Key, Value>::iterator begin(leftmost_, this);
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::end() const
+{
+    BinarySearchTree<Key, Value>::iterator end(NULL, this);
+    return end;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cbegin() const
+{
+    return const_iterator(leftmost_, this);
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cend() const
+{
+    return const_iterator(NULL, this);
+}
+
+/**
+* Reverse iteration starts at the largest item
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::find(const Key & k) const
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than k,
+* or the end iterator if every key is smaller
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::lower_bound(const Key & k) const
+{
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* candidate = nullptr;
+    while (current != nullptr) {
+        if (current->getKey() < k) {
+            current = current->getRight();
+        }
+        else {
+            candidate = current;
+            current = current->getLeft();
+        }
+    }
+    return iterator(candidate, this);
+}
+
+/**
+* Looks up every key in keys and stores the matching iterators (or end())
+* in out, in the same order. Searches run in groups that advance one level
+* at a time in lockstep, prefetching each search's next node so the cache
+* misses of the whole group overlap instead of being paid one by one.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::find_batch(const std::vector<Key>& keys,
+                                              std::vector<iterator>& out) const
+{
+    const size_t GROUP = 16;
+    out.assign(keys.size(), end());
+
+    Node<Key, Value>* cursor[GROUP];
+    size_t slot[GROUP];
+    for (size_t base = 0; base < keys.size(); base += GROUP) {
+        size_t active = 0;
+        for (size_t i = base; i < std::min(base + GROUP, keys.size()); i++) {
+            // keys the Bloom filter rules out keep their end()
+            if (!bloomRulesOut(keys[i])) {
+                cursor[active] = root_;
+                slot[active] = i;
+                active++;
+            }
+        }
+        // step every unfinished search by one level; finished ones are
+        // swapped out of the active range
+        while (active > 0) {
+            size_t i = 0;
+            while (i < active) {
+                Node<Key, Value>* current = cursor[i];
+                const Key& key = keys[slot[i]];
+                if (current != nullptr && !(current->getKey() == key)) {
+                    current = (key < current->getKey()) ? current->getLeft() : current->getRight();
+                    BST_PREFETCH(current);
+                    cursor[i] = current;
+                    i++;
+                    continue;
+                }
+                if (current == nullptr && bloomHash_ != nullptr) {
+                    bloomFalsePositives_++;
+                }
+                out[slot[i]] = iterator(current, this);
+                active--;
+                cursor[i] = cursor[active];
+                slot[i] = slot[active];
+            }
+        }
+    }
+}
+
+/**
+* Looks up an ascending range of keys with one merged traversal and writes
+* one iterator (or end()) per key to out, in key order. Each node splits
+* the pending keys by binary search and only subtrees that still have
+* pending keys are entered, so nodes shared by many searches are visited
+* once: O(k log(n/k)) for k keys instead of O(k log n).
+*/
+template<class Key, class Value>
+template<typename KeyIt, typename OutIt>
+OutIt BinarySearchTree<Key, Value>::find_sorted(KeyIt keys_first, KeyIt keys_last, OutIt out) const
+{
+    return findSortedHelper(root_, keys_first, keys_last, out);
+}
+
+/**
+* In-order walk over the subtrees that still have pending keys. The stack
+* is explicit, and the right subtree replaces its parent's frame instead
+* of going on top of it, so a degenerate (sorted-insert) tree cannot
+* overflow the call stack.
+*/
+template<class Key, class Value>
+template<typename KeyIt, typename OutIt>
+OutIt BinarySearchTree<Key, Value>::findSortedHelper(Node<Key, Value>* current,
+                                                     KeyIt first, KeyIt last, OutIt out) const
+{
+    struct Frame
+    {
+        Node<Key, Value>* node;
+        KeyIt first;
+        KeyIt mid;      // keys before mid belong to the left subtree
+        KeyIt last;
+        bool leftDone;
+    };
+    std::vector<Frame> stack;
+    Frame start = { current, first, first, last, false };
+    stack.push_back(start);
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        if (f.first == f.last) {
+            stack.pop_back();
+            continue;
+        }
+        if (f.node == nullptr) {
+            // none of the pending keys are in this subtree
+            for (; f.first != f.last; ++f.first) {
+                *out++ = end();
+            }
+            stack.pop_back();
+            continue;
+        }
+        if (!f.leftDone) {
+            f.mid = std::lower_bound(f.first, f.last, f.node->getKey());
+            f.leftDone = true;
+            Frame left = { f.node->getLeft(), f.first, f.first, f.mid, false };
+            stack.push_back(left);
+            continue;
+        }
+        while (f.mid != f.last && !(f.node->getKey() < *f.mid)) {
+            *out++ = iterator(f.node, this);
+            ++f.mid;
+        }
+        Frame right = { f.node->getRight(), f.mid, f.mid, f.last, false };
+        f = right;
+    }
+    return out;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value>
+Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // cout << "inserting" << endl;
+    // TODO
+    // cout << keyValuePair.first << endl;
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* parent = nullptr;
+    BST_STAT(inserts);
+
+    if (root_ == nullptr) {
+        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
+        BST_STAT(allocations);
+        noteInserted(root_);
+        return;
+    }
+
+    size_t depth = 1;
+    while (current != nullptr) {
+        // cout << "current node: " << current->getKey() << " " << current->getValue() << endl;
+        depth++;
+        parent = current;
+        BST_STAT(nodesVisited);
+        if (keyValuePair.first == current->getKey()) {
+            // duplicate, replace value
+            BST_STAT(comparisons);
+            current->setValue(keyValuePair.second);
+            return;
+        }
+        else if (keyValuePair.first > current->getKey()) {
+            // go right
+            BST_STAT_ADD(comparisons, 2);
+            current = current->getRight();
+        }
+        else {
+            // cout << "HERE" << endl;
+            // go left
+            BST_STAT_ADD(comparisons, 2);
+            current = current->getLeft();
+        } 
+    }
+
+    // cout << "Parent node: " << parent->getKey() << " " << parent->getValue() << endl;
+    // cout << (current==nullptr) << endl;
+
+    Node<Key, Value>* temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
+    BST_STAT(allocations);
+    if (keyValuePair.first > parent->getKey()) {
+        // cout << "HERE1" << endl;
+        // set right
+        parent->setRight(temp);
+    }
+    else {
+        // set left
+        parent->setLeft(temp);
+        // cout << "Parent node: " << parent->getKey() << " " << parent->getValue() << endl;
+        // cout << "Parent left: " << parent->getLeft()->getKey() << " " << parent->getLeft()->getValue() << endl;
+        // cout << "HERE2" << endl;
+    } 
+    noteInserted(temp);
+
+    if (autoRebalance_ > 0 && depth > autoRebalance_ * std::log2((double)size_ + 1)) {
+        rebuildScapegoat(temp);
+    }
+}
+
+/**
+* Removes the item at pos, which must not be end(), and returns an
+* iterator to the next item. The node is unlinked directly, so the key
+* is not searched for again.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator pos)
+{
+    Node<Key, Value>* next = successor(pos.current_);
+    eraseNode(pos.current_);
+    return iterator(next, this);
+}
+
+/**
+* Removes the items in [first, last) and returns last.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator first, iterator last)
+{
+    while (first != last) {
+        first = erase(first);
+    }
+    return last;
+}
+
+/**
+* Removes every key with lo <= key < hi.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::erase_range(const Key& lo, const Key& hi)
+{
+    if (lo < hi) {
+        erase(lower_bound(lo), lower_bound(hi));
+    }
+}
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::remove(const Key& key)
+{
+    // cout << "removing" << endl;
+    // TODO
+    // first find the node
+    BST_STAT(removes);
+    Node<Key, Value>* removeNode = internalFind(key);
+
+    if (removeNode == nullptr) {
+        return;
+    }
+    eraseNode(removeNode);
+}
+
+/**
+* Unlinks and frees a node that is known to be in the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::eraseNode(Node<Key, Value>* removeNode)
+{
+    noteRemoving(removeNode);
+
+    // cout << "removeNode: " << removeNode->getKey() << " " << removeNode->getValue() << endl;
+
+    Node<Key, Value>* parent = removeNode -> getParent();
+    // if no children
+    if (removeNode -> getRight() == nullptr && removeNode -> getLeft() == nullptr) {
+        if (parent == nullptr) {
+            // remove node is the root
+            root_= nullptr;
+            destroyNode(removeNode);
+            return;
+        }
+        if (removeNode == parent->getLeft()) {
+            parent->setLeft(nullptr);
+        } else if (removeNode == parent->getRight()) {
+            parent->setRight(nullptr);
+        }
+    }
+    // cout << "Parent: " << parent->getKey() << " " << parent->getValue() << endl;
+    // cout << "removeNode: " << removeNode->getKey() << " " << removeNode->getValue() << endl;
+    // cout << "removeNode Right: " << removeNode->getRight()->getKey() << " " << removeNode->getRight()->getValue() << endl;
+    // cout << "Parent: " << parent->getKey() << " " << parent->getValue() << endl;
     // cout << "Parent Right: " << parent->getRight()->getKey() << " " << parent->getRight()->getValue() << endl;
     // if removeNode only has right child
     else if (removeNode -> getRight() != nullptr && removeNode -> getLeft() == nullptr) {
@@ -663,7 +1541,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     }
   }
 
-  delete removeNode;
+  destroyNode(removeNode);
 }
 
 
@@ -677,40 +1555,99 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
         // recurse to right most node of left subtree
         return findMostRight(current->getLeft());
     } else {
-        return findFirstRightPointer(current->getParent());
+        return findFirstRightPointer(current);
     }
 }
 
+/**
+* Returns the in-order successor of current, or NULL if it is the largest node
+*/
 template<class Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::findMostRight(Node<Key, Value>* current) {
-  if (current == nullptr) {
-    return nullptr;
-  }
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+{
+    if (current->getRight() != nullptr) {
+        // left most node of right subtree
+        return findMostLeft(current->getRight());
+    } else {
+        return findFirstLeftPointer(current);
+    }
+}
 
-  if (current->getRight()!=nullptr) {
-      return findMostRight(current->getRight());
-  } else {
-      return current;
-  }
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::makeIterator(Node<Key, Value>* n) const
+{
+    return iterator(n, this);
 }
 
 template<class Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::findFirstRightPointer(Node<Key, Value>* current) {
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::iteratorNode(const iterator& it)
+{
+    return it.current_;
+}
+
+/**
+* Walks down to the left most node of the subtree at current.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findMostLeft(Node<Key, Value>* current) {
     if (current == nullptr) {
-      return nullptr;
+        return nullptr;
     }
+    while (current->getLeft() != nullptr) {
+        current = current->getLeft();
+    }
+    return current;
+}
 
+/**
+* Climbs until current is a left child and returns that parent,
+* or NULL if current is on the right spine.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findFirstLeftPointer(Node<Key, Value>* current) {
+    if (current == nullptr) {
+        return nullptr;
+    }
     Node<Key, Value>* p = current->getParent();
-    if (p == nullptr) {
-      // at root
-      return nullptr;
+    while (p != nullptr && current == p->getRight()) {
+        current = p;
+        p = p->getParent();
     }
-    if (current == p->getRight()) {
-        // is a right child
-        return p;
-    } else {
-        return findFirstRightPointer(p);
+    return p;
+}
+
+/**
+* Walks down to the right most node of the subtree at current.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findMostRight(Node<Key, Value>* current) {
+    if (current == nullptr) {
+        return nullptr;
     }
+    while (current->getRight() != nullptr) {
+        current = current->getRight();
+    }
+    return current;
+}
+
+/**
+* Climbs until current is a right child and returns that parent,
+* or NULL if current is on the left spine.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findFirstRightPointer(Node<Key, Value>* current) {
+    if (current == nullptr) {
+        return nullptr;
+    }
+    Node<Key, Value>* p = current->getParent();
+    while (p != nullptr && current == p->getLeft()) {
+        current = p;
+        p = p->getParent();
+    }
+    return p;
 }
 
 
@@ -724,6 +1661,17 @@ void BinarySearchTree<Key, Value>::clear()
     // TODO
     clearHelper(root_);
     root_ = nullptr;
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    if (!lookupCache_.empty()) {
+        lookupCache_.assign(lookupCache_.size(), nullptr);
+    }
+    if (bloomHash_ != nullptr) {
+        bloom_.clear();
+        bloomRemoved_ = 0;
+        bloomStale_ = false;
+    }
 }
 
 template<typename Key, typename Value>
@@ -734,7 +1682,18 @@ void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* current) {
     }
     clearHelper(current -> getLeft());
     clearHelper(current -> getRight());
-    delete current;
+    destroyNode(current);
+}
+
+/**
+* Frees a node that is no longer linked into the tree. Trees that place
+* nodes in their own storage override this.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::destroyNode(Node<Key, Value>* n)
+{
+    BST_STAT(frees);
+    delete n;
 }
 
 
@@ -746,7 +1705,7 @@ Node<Key, Value>*
 BinarySearchTree<Key, Value>::getSmallestNode() const
 {
     // TODO
-    return getSmallestNodeHelper(root_);
+    return leftmost_;
 }
 
 template<typename Key, typename Value>
@@ -771,7 +1730,31 @@ template<typename Key, typename Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
 {
     // TODO
-    return internalFindHelper(root_, key);
+    BST_STAT(lookups);
+    if (bloomRulesOut(key)) {
+        return nullptr;
+    }
+
+    Node<Key, Value>* found;
+    if (lookupCache_.empty()) {
+        found = internalFindHelper(root_, key);
+    }
+    else {
+        Node<Key, Value>*& slot = lookupCache_[lookupHash_(key) & (lookupCache_.size() - 1)];
+        if (slot != nullptr && slot->getKey() == key) {
+            cacheHits_++;
+            return slot;
+        }
+        cacheMisses_++;
+        found = internalFindHelper(root_, key);
+        if (found != nullptr) {
+            slot = found;
+        }
+    }
+    if (found == nullptr && bloomHash_ != nullptr) {
+        bloomFalsePositives_++;
+    }
+    return found;
 }
 
 // DEFINE
@@ -781,16 +1764,20 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFindHelper(Node<Key, Val
     if (current == nullptr) {
         return nullptr;
     }
+    BST_STAT(nodesVisited);
     // if the current node key is key, then return
-    else if (current->getKey() == key) {
+    if (current->getKey() == key) {
+        BST_STAT(comparisons);
         return current;
     } 
     // if key is greater than current node key
     else if (key >= current->getKey()) {
+        BST_STAT_ADD(comparisons, 2);
         return internalFindHelper(current -> getRight(), key);
     } 
     // key is less than current
     else {
+        BST_STAT_ADD(comparisons, 2);
         return internalFindHelper(current -> getLeft(), key);
     }
 }
@@ -831,6 +1818,172 @@ bool BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* current) c
 
 }
 
+/**
+* Day-Stout-Warren over the whole tree; see rebuildSubtree().
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalance()
+{
+    if (root_ != nullptr) {
+        rebuildSubtree(root_, size_);
+    }
+}
+
+/**
+* Day-Stout-Warren: rotates the count nodes under top into a right-leaning
+* vine and then folds the vine back into a perfectly balanced subtree with
+* rounds of left rotations. O(count) time, O(1) extra space, no nodes are
+* allocated or moved in memory; the subtree stays where top hung.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildSubtree(Node<Key, Value>* top, size_t count)
+{
+    Node<Key, Value>* parent = top->getParent();
+    bool leftSide = parent != nullptr && parent->getLeft() == top;
+
+    // tree to vine
+    Node<Key, Value>* current = top;
+    while (current != nullptr) {
+        if (current->getLeft() != nullptr) {
+            Node<Key, Value>* left = current->getLeft();
+            rotateNodeRight(current);
+            current = left;
+        }
+        else {
+            current = current->getRight();
+        }
+    }
+
+    // vine to tree: first fold the leaves of the last, partial level
+    size_t full = 0;
+    while (full * 2 + 1 <= count) {
+        full = full * 2 + 1;
+    }
+    compressVine(parent, leftSide, count - full);
+    while (full > 1) {
+        full /= 2;
+        compressVine(parent, leftSide, full);
+    }
+}
+
+/**
+* Scapegoat step after an insert that landed too deep: climbs from the
+* new node to the first ancestor one of whose children holds more than
+* alpha of its nodes, alpha = 2^(-1/factor), and rebuilds only that
+* subtree. An alpha-weight-balanced tree has height at most
+* log_(1/alpha)(n) = factor * log2(n), so a too-deep node always has such
+* an ancestor; the whole tree is rebuilt only if rounding leaves none.
+* Sizes are counted on the way up, so the cost is O(size of the
+* scapegoat), which amortizes to O(log n) per insert on sorted input
+* instead of a full O(n) rebuild every few inserts.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildScapegoat(Node<Key, Value>* added)
+{
+    double alpha = std::pow(2.0, -1.0 / autoRebalance_);
+    Node<Key, Value>* child = added;
+    size_t childSize = 1;
+    for (Node<Key, Value>* node = added->getParent(); node != nullptr; node = node->getParent()) {
+        Node<Key, Value>* sibling = (node->getLeft() == child) ? node->getRight() : node->getLeft();
+        size_t nodeSize = childSize + 1 + countNodes(sibling);
+        if ((double)childSize > alpha * (double)nodeSize) {
+            rebuildSubtree(node, nodeSize);
+            return;
+        }
+        child = node;
+        childSize = nodeSize;
+    }
+    rebalance();
+}
+
+/**
+* Turns on automatic rebalancing: whenever an insert lands deeper than
+* factor * log2(n + 1), the smallest subtree that explains the depth is
+* rebuilt (see rebuildScapegoat). Pass 0 to turn it off. Factors of
+* about 1.5 and up cost O(log n) amortized per insert; 1 asks for the
+* minimum possible height, which can take a rebuild of most of the tree
+* every few inserts. Factors below 1 would fire on perfectly balanced
+* trees, so anything other than 0 or at least 1 (including NaN) throws
+* std::invalid_argument.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setAutoRebalance(double factor)
+{
+    if (factor != 0 && !(factor >= 1)) {
+        throw std::invalid_argument("Auto-rebalance factor must be 0 or at least 1");
+    }
+    autoRebalance_ = factor;
+}
+
+/**
+* Left-rotates count times down the right spine of the vine hanging on
+* parent's leftSide (or at the root), every other node.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compressVine(Node<Key, Value>* parent, bool leftSide, size_t count)
+{
+    Node<Key, Value>* current = (parent == nullptr) ? root_ :
+                                leftSide ? parent->getLeft() : parent->getRight();
+    for (size_t i = 0; i < count; i++) {
+        rotateNodeLeft(current);
+        current = current->getParent()->getRight();
+    }
+}
+
+/**
+* Plain pointer rotation; g's right child takes its place.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateNodeLeft(Node<Key, Value>* g)
+{
+    BST_STAT(rotateLefts);
+    Node<Key, Value>* p = g->getRight();
+    Node<Key, Value>* parent = g->getParent();
+    g->setRight(p->getLeft());
+    if (p->getLeft() != nullptr) {
+        p->getLeft()->setParent(g);
+    }
+    p->setLeft(g);
+    g->setParent(p);
+    p->setParent(parent);
+    if (parent == nullptr) {
+        root_ = p;
+    }
+    else if (parent->getLeft() == g) {
+        parent->setLeft(p);
+    }
+    else {
+        parent->setRight(p);
+    }
+}
+
+/**
+* Plain pointer rotation; g's left child takes its place.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateNodeRight(Node<Key, Value>* g)
+{
+    BST_STAT(rotateRights);
+    Node<Key, Value>* p = g->getLeft();
+    Node<Key, Value>* parent = g->getParent();
+    g->setLeft(p->getRight());
+    if (p->getRight() != nullptr) {
+        p->getRight()->setParent(g);
+    }
+    p->setRight(g);
+    g->setParent(p);
+    p->setParent(parent);
+    if (parent == nullptr) {
+        root_ = p;
+    }
+    else if (parent->getLeft() == g) {
+        parent->setLeft(p);
+    }
+    else {
+        parent->setRight(p);
+    }
+}
+
 template<typename Key, typename Value>
 int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* current) {
     if (current == nullptr) {
@@ -846,6 +1999,31 @@ int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* current) {
     }
 }
 
+/**
+* Nodes in the subtree under current, counted with an explicit stack.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::countNodes(Node<Key, Value>* current)
+{
+    size_t count = 0;
+    std::vector<Node<Key, Value>*> stack;
+    if (current != nullptr) {
+        stack.push_back(current);
+    }
+    while (!stack.empty()) {
+        Node<Key, Value>* n = stack.back();
+        stack.pop_back();
+        count++;
+        if (n->getLeft() != nullptr) {
+            stack.push_back(n->getLeft());
+        }
+        if (n->getRight() != nullptr) {
+            stack.push_back(n->getRight());
+        }
+    }
+    return count;
+}
+
 
 
 template<typename Key, typename Value>
@@ -854,6 +2032,7 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    BST_STAT(nodeSwaps);
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
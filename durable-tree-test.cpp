@@ -0,0 +1,400 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include "durable_tree.h"
+
+using namespace std;
+
+// Prints and counts a failed check; main() exits non-zero if any failed
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+static string makeTempDir()
+{
+    char name[] = "/tmp/durable-tree-test.XXXXXX";
+    if (::mkdtemp(name) == nullptr) {
+        throw runtime_error("Cannot create a temporary directory");
+    }
+    return name;
+}
+
+static void removeDir(const string& dir)
+{
+    DIR* d = ::opendir(dir.c_str());
+    if (d != nullptr) {
+        while (struct dirent* entry = ::readdir(d)) {
+            string name = entry->d_name;
+            if (name != "." && name != "..") {
+                ::unlink((dir + "/" + name).c_str());
+            }
+        }
+        ::closedir(d);
+    }
+    ::rmdir(dir.c_str());
+}
+
+static size_t countSegments(const string& dir)
+{
+    size_t count = 0;
+    DIR* d = ::opendir(dir.c_str());
+    while (struct dirent* entry = ::readdir(d)) {
+        count += string(entry->d_name).compare(0, 4, "wal.") == 0;
+    }
+    ::closedir(d);
+    return count;
+}
+
+static bool fileExists(const string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
+
+static bool sameContents(const DurableTree<int, int>& t, const map<int, int>& m)
+{
+    if (t.size() != m.size()) {
+        return false;
+    }
+    for (map<int, int>::const_iterator it = m.begin(); it != m.end(); ++it) {
+        int value;
+        if (!t.get(it->first, value) || value != it->second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Limits the size any file of this process may grow to; writes past it fail
+static void limitFileSize(rlim_t bytes)
+{
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = bytes;
+    ::setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+static void unlimitFileSize()
+{
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+// Random inserts and removes survive a reopen, with and without sync-on-write
+static void testReplay()
+{
+    string dir = makeTempDir();
+    mt19937 rng(40);
+    map<int, int> m;
+    {
+        DurableTree<int, int> t(dir);
+        for (int i = 0; i < 2000; i++) {
+            int k = (int)(rng() % 500);
+            if (rng() % 3 == 0) {
+                t.remove(k);
+                m.erase(k);
+            }
+            else {
+                t.insert(make_pair(k, i));
+                m[k] = i;
+            }
+        }
+        check(sameContents(t, m), "contents match before reopen");
+    }
+    {
+        DurableTree<int, int> t(dir);
+        check(sameContents(t, m), "log replay restores every write");
+        t.setSyncOnWrite(false);
+        size_t before = t.fsyncCount();
+        for (int i = 0; i < 1000; i++) {
+            t.insert(make_pair(1000 + i, i));
+            m[1000 + i] = i;
+        }
+        t.sync();
+        check(t.fsyncCount() == before + 1, "sync() makes a buffer durable with one fsync");
+    }
+    DurableTree<int, int> t(dir);
+    check(sameContents(t, m), "buffered writes survive after sync()");
+    removeDir(dir);
+}
+
+// Without sync-on-write the buffer is flushed once it passes its limit,
+// and those flushes start background checkpoints
+static void testBufferLimit()
+{
+    string dir = makeTempDir();
+    map<int, int> m;
+    const int writes = 20000;
+    {
+        DurableTree<int, int> t(dir);
+        t.setSyncOnWrite(false);
+        t.setBufferBytes(4096);
+        t.setCheckpointBytes(64 * 1024);
+        for (int i = 0; i < 100; i++) {
+            t.insert(make_pair(i, i));
+            m[i] = i;
+        }
+        check(t.fsyncCount() == 0, "a small buffer waits for sync()");
+        for (int i = 100; i < writes; i++) {
+            t.insert(make_pair(i % 5000, i));
+            m[i % 5000] = i;
+        }
+        // each record is 17 bytes, so the buffer fills every 241 writes
+        size_t fills = (size_t)writes * 17 / 4096;
+        check(t.fsyncCount() >= fills - 1 && t.fsyncCount() <= fills + 10, "a full buffer is flushed");
+        t.setCheckpointBytes(0);
+    }
+    // checked after the checkpointer has stopped, since it may still be folding
+    check(fileExists(dir + "/checkpoint"), "flushes of a full buffer start checkpoints");
+    check(countSegments(dir) < 4, "checkpoints delete the segments they fold");
+    DurableTree<int, int> t(dir);
+    check(sameContents(t, m), "buffered writes survive");
+    removeDir(dir);
+}
+
+// Concurrent writers share fsyncs and all land in the log
+static void testGroupCommit()
+{
+    string dir = makeTempDir();
+    const int threads = 8;
+    const int perThread = 200;
+    {
+        DurableTree<int, int> t(dir);
+        vector<thread> writers;
+        for (int w = 0; w < threads; w++) {
+            writers.push_back(thread([&t, w]() {
+                for (int i = 0; i < perThread; i++) {
+                    t.insert(make_pair(w * perThread + i, w));
+                }
+            }));
+        }
+        for (size_t w = 0; w < writers.size(); w++) {
+            writers[w].join();
+        }
+        // while a leader waits in fdatasync the others queue up behind it;
+        // tmpfs syncs without waiting, so there nothing can queue
+        struct statfs fs;
+        bool syncWaits = ::statfs(dir.c_str(), &fs) == 0 && fs.f_type != TMPFS_MAGIC;
+        check(!syncWaits || t.fsyncCount() <= (size_t)(threads * perThread) / 2,
+              "concurrent writers share fsyncs");
+
+        // buffered records and many sync() callers: the first leader takes
+        // everything and the rest find it durable
+        t.setSyncOnWrite(false);
+        for (int i = 0; i < 2000; i++) {
+            t.insert(make_pair(-1 - i, i));
+        }
+        size_t before = t.fsyncCount();
+        vector<thread> syncers;
+        for (int w = 0; w < threads; w++) {
+            syncers.push_back(thread([&t]() { t.sync(); }));
+        }
+        for (size_t w = 0; w < syncers.size(); w++) {
+            syncers[w].join();
+        }
+        check(t.fsyncCount() == before + 1, "concurrent sync() calls share one fsync");
+    }
+    DurableTree<int, int> t(dir);
+    check(t.size() == (size_t)(threads * perThread + 2000), "every concurrent write recovered");
+    removeDir(dir);
+}
+
+// Checkpoints fold and delete segments, by hand and in the background
+static void testCheckpoints()
+{
+    string dir = makeTempDir();
+    map<int, int> m;
+    {
+        DurableTree<int, int> t(dir);
+        t.setCheckpointBytes(0);
+        for (int i = 0; i < 500; i++) {
+            t.insert(make_pair(i, i));
+            m[i] = i;
+        }
+        t.checkpoint();
+        check(countSegments(dir) == 1, "checkpoint deletes the segments it covers");
+        for (int i = 0; i < 500; i += 2) {
+            t.remove(i);
+            m.erase(i);
+        }
+    }
+    {
+        DurableTree<int, int> t(dir);
+        check(sameContents(t, m), "checkpoint plus log replay");
+
+        // a small threshold makes the checkpointer run many times
+        t.setCheckpointBytes(4096);
+        for (int i = 0; i < 3000; i++) {
+            t.insert(make_pair(i % 700, i));
+            m[i % 700] = i;
+        }
+        t.setCheckpointBytes(0);
+        t.checkpoint();
+    }
+    // checked after the checkpointer has stopped, since it may still be folding
+    check(countSegments(dir) == 1, "background checkpoints leave one live segment");
+    {
+        DurableTree<int, int> t(dir);
+        check(sameContents(t, m), "state after background checkpoints");
+    }
+
+    // a torn tail is cut off on open and later writes go after it
+    ofstream garbage((dir + "/wal.9999").c_str(), ios::binary);
+    garbage << "\x10\x00\x00\x00torn";
+    garbage.close();
+    {
+        DurableTree<int, int> t(dir);
+        check(sameContents(t, m), "torn segment tail is ignored");
+        t.insert(make_pair(-1, -1));
+        m[-1] = -1;
+    }
+    DurableTree<int, int> t(dir);
+    check(sameContents(t, m), "writes after a torn tail survive");
+    removeDir(dir);
+}
+
+template <typename Fn>
+static bool throwsRuntime(Fn fn)
+{
+    try {
+        fn();
+    }
+    catch (runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// A log write that fails part way stops the tree: nothing after it is
+// acknowledged, even once the disk works again
+static void testFailedWrite()
+{
+    string dir = makeTempDir();
+    set<int> acknowledged;
+    {
+        DurableTree<int, int> t(dir);
+        t.setCheckpointBytes(0);
+        t.setSyncOnWrite(false);
+        for (int i = 0; i < 100; i++) {
+            t.insert(make_pair(i, i));
+            acknowledged.insert(i);
+        }
+        t.sync();
+        for (int i = 100; i < 2000; i++) {
+            t.insert(make_pair(i, i));
+        }
+        // the segment holds about 1.7KB; let the next batch tear half way
+        limitFileSize(16 * 1024);
+        bool failed = throwsRuntime([&t]() { t.sync(); });
+        unlimitFileSize();
+        check(failed, "sync() reports a failed log write");
+        check(throwsRuntime([&t]() { t.insert(make_pair(5000, 0)); }), "insert after a failed write throws");
+        check(throwsRuntime([&t]() { t.remove(0); }), "remove after a failed write throws");
+        check(throwsRuntime([&t]() { t.sync(); }), "sync after a failed write throws");
+        check(throwsRuntime([&t]() { t.checkpoint(); }), "checkpoint after a failed write throws");
+    }
+    {
+        DurableTree<int, int> t(dir);
+        bool prefix = true;
+        int value;
+        for (int i = 0; i < 100; i++) {
+            prefix = prefix && t.get(i, value);
+        }
+        // whatever came back of the torn batch is a prefix of it
+        bool contiguous = true;
+        bool missing = false;
+        for (int i = 100; i < 2000; i++) {
+            bool found = t.get(i, value);
+            contiguous = contiguous && !(found && missing);
+            missing = missing || !found;
+        }
+        check(prefix, "acknowledged writes survive a failed write");
+        check(contiguous && !t.get(5000, value), "recovery stops at the torn batch");
+    }
+    removeDir(dir);
+
+    // concurrent writers; the disk recovers right after the first failure,
+    // so a waiter that took over as leader would find it working again
+    dir = makeTempDir();
+    const int threads = 4;
+    const int perThread = 2000;
+    vector<vector<int> > acked(threads);
+    atomic<bool> sawFailure(false);
+    {
+        DurableTree<int, int> t(dir);
+        t.setCheckpointBytes(0);
+        limitFileSize(8 * 1024);
+        vector<thread> writers;
+        for (int w = 0; w < threads; w++) {
+            writers.push_back(thread([&t, &acked, &sawFailure, w]() {
+                for (int i = 0; i < perThread; i++) {
+                    int k = w * perThread + i;
+                    try {
+                        t.insert(make_pair(k, k));
+                        acked[w].push_back(k);
+                    }
+                    catch (runtime_error&) {
+                        if (!sawFailure.exchange(true)) {
+                            unlimitFileSize();
+                        }
+                    }
+                }
+            }));
+        }
+        for (size_t w = 0; w < writers.size(); w++) {
+            writers[w].join();
+        }
+        unlimitFileSize();
+        check(sawFailure.load(), "concurrent writers see the failed write");
+    }
+    DurableTree<int, int> t(dir);
+    bool allThere = true;
+    size_t total = 0;
+    int value;
+    for (int w = 0; w < threads; w++) {
+        for (size_t i = 0; i < acked[w].size(); i++) {
+            allThere = allThere && t.get(acked[w][i], value);
+        }
+        total += acked[w].size();
+    }
+    check(allThere, "every acknowledged concurrent write survives");
+    check(total < (size_t)(threads * perThread), "writes after the failure are not acknowledged");
+    removeDir(dir);
+}
+
+int main()
+{
+    // a write past RLIMIT_FSIZE should fail with EFBIG, not kill the process
+    signal(SIGXFSZ, SIG_IGN);
+
+    testReplay();
+    testBufferLimit();
+    testGroupCommit();
+    testCheckpoints();
+    testFailedWrite();
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "durable-tree-test: all checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,721 @@
+#ifndef DURABLE_TREE_H
+#define DURABLE_TREE_H
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "avlbst.h"
+#include "snapshot.h"
+
+/*
+  Files kept in the tree's directory:
+
+    checkpoint    uint64_t covered segment, then an AVLTree::save snapshot
+    wal.<n>       log segments; every segment <= covered is already folded
+                  into the checkpoint and gets deleted
+
+  A log record is
+
+    uint32_t length      of the payload
+    uint32_t checksum    FNV-1a of the payload
+    uint8_t  op          1 = insert, 2 = remove
+    Key [, Value]        as written by SnapshotTraits
+
+  A record that is cut short or fails its checksum ends the log; it can
+  only be the tail of a write that was never acknowledged.
+
+  Uses std::thread, so link with -pthread.
+*/
+
+/**
+* An AVLTree made durable by a write-ahead log.
+*
+* Mutations are applied in memory and appended to a shared buffer. With
+* sync-on-write (the default), each call then waits until its record is on
+* disk. Whichever waiter finds no flush in progress writes and fsyncs the
+* whole buffer on behalf of everyone queued behind it, so concurrent
+* writers share fsyncs (group commit). With sync-on-write off, calls return
+* at once and sync() makes everything so far durable with one fsync; a
+* call that finds more than setBufferBytes() buffered flushes it first, so
+* the buffer stays bounded and background checkpoints still start.
+*
+* checkpoint() switches writers to a new log segment, which is the only
+* moment it holds them up. It then rebuilds the state as of that switch
+* from the previous checkpoint plus the closed segments, in a separate
+* tree, saves it, and deletes those segments. Checkpoints also run on a
+* background thread once the active segment passes setCheckpointBytes().
+*
+* If writing or syncing the log ever fails, the tree stops taking writes:
+* the records of the failed batch are never acknowledged, and every later
+* mutation, sync() and checkpoint() throws std::runtime_error. Reads still
+* answer from memory, which may hold those unacknowledged mutations.
+* Reopening the directory recovers every acknowledged mutation; of the
+* failed batch, any prefix that reached the disk may come back too, and
+* nothing after it.
+*/
+template <typename Key, typename Value>
+class DurableTree
+{
+public:
+    explicit DurableTree(const std::string& dir);
+    ~DurableTree();
+
+    void insert(const std::pair<const Key, Value>& item);
+    void remove(const Key& key);
+    bool get(const Key& key, Value& value) const;
+    size_t size() const;
+
+    void sync();
+    void checkpoint();
+
+    void setSyncOnWrite(bool on);
+    void setBufferBytes(size_t bytes);
+    void setCheckpointBytes(size_t bytes);
+    size_t fsyncCount() const;
+
+    // Direct access for reads while no other thread is writing
+    const AVLTree<Key, Value>& tree() const;
+
+private:
+    // Not copyable: owns files and a thread
+    DurableTree(const DurableTree&);
+    DurableTree& operator=(const DurableTree&);
+
+    enum { OP_INSERT = 1, OP_REMOVE = 2 };
+
+    uint64_t append(const std::string& payload);
+    void waitDurable(uint64_t lsn);
+    void flushLocked(std::unique_lock<std::mutex>& lock);
+    void failLocked(const std::string& what);
+    void checkpointLoop();
+    void runCheckpoint();
+    void foldSegments(uint64_t upto);
+
+    std::string segmentPath(uint64_t segment) const;
+    std::string checkpointPath() const;
+    std::vector<uint64_t> listSegments() const;
+    uint64_t loadCheckpoint(AVLTree<Key, Value>& tree) const;
+    void writeCheckpoint(const AVLTree<Key, Value>& tree, uint64_t covered) const;
+    static size_t replaySegment(const std::string& path, AVLTree<Key, Value>& tree);
+    static uint32_t checksum(const char* data, size_t length);
+    static void writeAll(int fd, const std::string& data);
+    static void syncPath(const std::string& path);
+
+    std::string dir_;
+    AVLTree<Key, Value> tree_;
+
+    // Guards tree_, the log buffer and everything below
+    mutable std::mutex mutex_;
+    std::condition_variable flushed_;
+    std::string pending_;
+    std::ostringstream encoder_;
+    uint64_t lastLsn_;
+    uint64_t durableLsn_;
+    bool flushing_;
+    int logFd_;
+    uint64_t segment_;
+    size_t segmentBytes_;
+    bool syncOnWrite_;
+    size_t bufferBytes_;
+    size_t checkpointBytes_;
+    size_t fsyncs_;
+    // Set once a log write fails; nothing is written after that
+    bool failed_;
+    std::string failure_;
+
+    // The background checkpointer sleeps on checkpointWanted_
+    std::condition_variable checkpointWanted_;
+    bool checkpointRunning_;
+    bool checkpointRequested_;
+    bool stopping_;
+    std::thread checkpointer_;
+
+    // Serializes checkpoints
+    std::mutex checkpointMutex_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the DurableTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Opens or creates the store in dir: loads the last checkpoint, replays
+* the segments written after it and starts a fresh segment.
+*/
+template<class Key, class Value>
+DurableTree<Key, Value>::DurableTree(const std::string& dir) :
+    dir_(dir), lastLsn_(0), durableLsn_(0), flushing_(false), logFd_(-1), segment_(0),
+    segmentBytes_(0), syncOnWrite_(true), bufferBytes_(1 << 20), checkpointBytes_(64 << 20), fsyncs_(0),
+    failed_(false), checkpointRunning_(false), checkpointRequested_(false), stopping_(false)
+{
+    if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create " + dir_);
+    }
+    uint64_t covered = loadCheckpoint(tree_);
+    segment_ = covered;
+    std::vector<uint64_t> segments = listSegments();
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (segments[i] <= covered) {
+            // left behind by a checkpoint that stopped before deleting it
+            ::unlink(segmentPath(segments[i]).c_str());
+            continue;
+        }
+        std::string path = segmentPath(segments[i]);
+        size_t good = replaySegment(path, tree_);
+        if (::truncate(path.c_str(), (off_t)good) != 0) {
+            throw std::runtime_error("Cannot truncate " + path);
+        }
+        segment_ = segments[i];
+    }
+
+    segment_++;
+    logFd_ = ::open(segmentPath(segment_).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (logFd_ < 0) {
+        throw std::runtime_error("Cannot open " + segmentPath(segment_));
+    }
+    syncPath(dir_);
+    checkpointer_ = std::thread(&DurableTree<Key, Value>::checkpointLoop, this);
+}
+
+/**
+* Stops the checkpointer, letting a running checkpoint finish, and makes
+* pending records durable.
+*/
+template<class Key, class Value>
+DurableTree<Key, Value>::~DurableTree()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        checkpointWanted_.notify_all();
+    }
+    checkpointer_.join();
+    try {
+        sync();
+    }
+    catch (...) {
+        // nothing to report to from a destructor
+    }
+    ::close(logFd_);
+}
+
+template<class Key, class Value>
+void DurableTree<Key, Value>::insert(const std::pair<const Key, Value>& item)
+{
+    uint64_t lsn;
+    bool wait;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            throw std::runtime_error(failure_);
+        }
+        encoder_.str(std::string());
+        encoder_.put(static_cast<char>(OP_INSERT));
+        SnapshotTraits<Key>::write(encoder_, item.first);
+        SnapshotTraits<Value>::write(encoder_, item.second);
+        tree_.insert(item);
+        lsn = append(encoder_.str());
+        wait = syncOnWrite_ || pending_.size() >= bufferBytes_;
+    }
+    if (wait) {
+        waitDurable(lsn);
+    }
+}
+
+template<class Key, class Value>
+void DurableTree<Key, Value>::remove(const Key& key)
+{
+    uint64_t lsn;
+    bool wait;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            throw std::runtime_error(failure_);
+        }
+        encoder_.str(std::string());
+        encoder_.put(static_cast<char>(OP_REMOVE));
+        SnapshotTraits<Key>::write(encoder_, key);
+        tree_.remove(key);
+        lsn = append(encoder_.str());
+        wait = syncOnWrite_ || pending_.size() >= bufferBytes_;
+    }
+    if (wait) {
+        waitDurable(lsn);
+    }
+}
+
+/**
+* Copies the value for key into value. Returns false if key is absent.
+*/
+template<class Key, class Value>
+bool DurableTree<Key, Value>::get(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if (it == tree_.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+size_t DurableTree<Key, Value>::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tree_.size();
+}
+
+/**
+* Returns once every mutation made so far is on disk.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::sync()
+{
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lsn = lastLsn_;
+    }
+    waitDurable(lsn);
+}
+
+/**
+* Folds the log into a new checkpoint. Writers are held up only while the
+* active segment is synced and swapped; other callers wait for a running
+* checkpoint to finish first.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::checkpoint()
+{
+    std::lock_guard<std::mutex> guard(checkpointMutex_);
+    runCheckpoint();
+}
+
+template<class Key, class Value>
+void DurableTree<Key, Value>::setSyncOnWrite(bool on)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    syncOnWrite_ = on;
+}
+
+/**
+* With sync-on-write off, the write that brings the buffer to bytes also
+* writes and syncs it, as sync() would. The default is 1MB.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::setBufferBytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bufferBytes_ = bytes;
+}
+
+/**
+* Starts a background checkpoint once the active segment grows past
+* bytes. 0 turns automatic checkpoints off.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::setCheckpointBytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    checkpointBytes_ = bytes;
+}
+
+template<class Key, class Value>
+size_t DurableTree<Key, Value>::fsyncCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return fsyncs_;
+}
+
+template<class Key, class Value>
+const AVLTree<Key, Value>& DurableTree<Key, Value>::tree() const
+{
+    return tree_;
+}
+
+/**
+* Frames payload into the log buffer. Called with mutex_ held; returns the
+* record's sequence number.
+*/
+template<class Key, class Value>
+uint64_t DurableTree<Key, Value>::append(const std::string& payload)
+{
+    uint32_t header[2];
+    header[0] = (uint32_t)payload.size();
+    header[1] = checksum(payload.data(), payload.size());
+    pending_.append(reinterpret_cast<const char*>(header), sizeof(header));
+    pending_.append(payload);
+    return ++lastLsn_;
+}
+
+/**
+* Group commit. The first waiter to find no flush running becomes the
+* leader: it takes the whole buffer, writes and fsyncs it without holding
+* the lock, and wakes everyone it covered. Records appended meanwhile go
+* out with the next leader. If the leader's write fails, durableLsn_ stays
+* where it was, so the leader and every waiter past it throw.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::waitDurable(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (durableLsn_ < lsn) {
+        if (failed_) {
+            throw std::runtime_error(failure_);
+        }
+        if (flushing_) {
+            flushed_.wait(lock);
+            continue;
+        }
+        flushing_ = true;
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t upto = lastLsn_;
+        int fd = logFd_;
+        lock.unlock();
+        bool ok = true;
+        try {
+            writeAll(fd, batch);
+            ok = (::fdatasync(fd) == 0);
+        }
+        catch (...) {
+            ok = false;
+        }
+        lock.lock();
+        flushing_ = false;
+        if (!ok) {
+            // part of the batch may be on disk, so nothing may follow it
+            failLocked("Cannot write log segment " + segmentPath(segment_));
+            throw std::runtime_error(failure_);
+        }
+        flushed_.notify_all();
+        durableLsn_ = upto;
+        segmentBytes_ += batch.size();
+        fsyncs_++;
+        if (checkpointBytes_ > 0 && segmentBytes_ >= checkpointBytes_ &&
+            !checkpointRunning_ && !checkpointRequested_) {
+            checkpointRequested_ = true;
+            checkpointWanted_.notify_all();
+        }
+    }
+}
+
+/**
+* Writes and fsyncs the buffer while holding the lock; used when the
+* segment is about to change.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::flushLocked(std::unique_lock<std::mutex>& lock)
+{
+    while (flushing_) {
+        flushed_.wait(lock);
+    }
+    if (failed_) {
+        throw std::runtime_error(failure_);
+    }
+    bool ok = true;
+    try {
+        writeAll(logFd_, pending_);
+        ok = (::fdatasync(logFd_) == 0);
+    }
+    catch (...) {
+        ok = false;
+    }
+    if (!ok) {
+        failLocked("Cannot write log segment " + segmentPath(segment_));
+        throw std::runtime_error(failure_);
+    }
+    segmentBytes_ += pending_.size();
+    pending_.clear();
+    fsyncs_++;
+    durableLsn_ = lastLsn_;
+    flushed_.notify_all();
+}
+
+/**
+* Puts the tree in the failed state after a log write. Called with mutex_
+* held; wakes the waiters so that those not yet durable throw.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::failLocked(const std::string& what)
+{
+    failed_ = true;
+    failure_ = what + "; writes are stopped until the tree is reopened";
+    pending_.clear();
+    flushed_.notify_all();
+}
+
+/**
+* Body of the background checkpointer. A failed checkpoint leaves the log
+* in place; the next one (or recovery) picks it up.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::checkpointLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        while (!stopping_ && !checkpointRequested_) {
+            checkpointWanted_.wait(lock);
+        }
+        if (stopping_) {
+            return;
+        }
+        checkpointRequested_ = false;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> guard(checkpointMutex_);
+            try {
+                runCheckpoint();
+            }
+            catch (...) {
+                // runCheckpoint has already cleared checkpointRunning_
+            }
+        }
+        lock.lock();
+    }
+}
+
+/**
+* Called with checkpointMutex_ held.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::runCheckpoint()
+{
+    uint64_t upto;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        checkpointRunning_ = true;
+        std::string next = segmentPath(segment_ + 1);
+        int fd = -1;
+        try {
+            flushLocked(lock);
+            fd = ::open(next.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        }
+        catch (...) {
+            checkpointRunning_ = false;
+            throw;
+        }
+        if (fd < 0) {
+            checkpointRunning_ = false;
+            throw std::runtime_error("Cannot open " + next);
+        }
+        ::close(logFd_);
+        logFd_ = fd;
+        upto = segment_;
+        segment_++;
+        segmentBytes_ = 0;
+    }
+
+    try {
+        foldSegments(upto);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkpointRunning_ = false;
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    checkpointRunning_ = false;
+}
+
+/**
+* Rebuilds the state as of the end of segment upto in a separate tree,
+* saves it as the checkpoint and deletes the segments it covers.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::foldSegments(uint64_t upto)
+{
+    AVLTree<Key, Value> shadow;
+    uint64_t covered = loadCheckpoint(shadow);
+    std::vector<uint64_t> segments = listSegments();
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (segments[i] > covered && segments[i] <= upto) {
+            replaySegment(segmentPath(segments[i]), shadow);
+        }
+    }
+    writeCheckpoint(shadow, upto);
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (segments[i] <= upto) {
+            ::unlink(segmentPath(segments[i]).c_str());
+        }
+    }
+}
+
+template<class Key, class Value>
+std::string DurableTree<Key, Value>::segmentPath(uint64_t segment) const
+{
+    std::ostringstream path;
+    path << dir_ << "/wal." << segment;
+    return path.str();
+}
+
+template<class Key, class Value>
+std::string DurableTree<Key, Value>::checkpointPath() const
+{
+    return dir_ + "/checkpoint";
+}
+
+/**
+* Segment numbers present in the directory, in increasing order.
+*/
+template<class Key, class Value>
+std::vector<uint64_t> DurableTree<Key, Value>::listSegments() const
+{
+    std::vector<uint64_t> segments;
+    DIR* d = ::opendir(dir_.c_str());
+    if (d == nullptr) {
+        return segments;
+    }
+    while (struct dirent* entry = ::readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "wal.") == 0 && name.size() > 4 &&
+            name.find_first_not_of("0123456789", 4) == std::string::npos) {
+            segments.push_back(std::strtoull(name.c_str() + 4, nullptr, 10));
+        }
+    }
+    ::closedir(d);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+/**
+* Loads the checkpoint into tree and returns the last segment it covers,
+* or 0 when there is none yet.
+*/
+template<class Key, class Value>
+uint64_t DurableTree<Key, Value>::loadCheckpoint(AVLTree<Key, Value>& tree) const
+{
+    std::ifstream in(checkpointPath().c_str(), std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    uint64_t covered = 0;
+    in.read(reinterpret_cast<char*>(&covered), sizeof(covered));
+    if (!in) {
+        throw std::runtime_error("Corrupt checkpoint in " + dir_);
+    }
+    tree.load(in);
+    return covered;
+}
+
+/**
+* Writes a temporary file, syncs it and renames it over the checkpoint, so
+* a crash leaves either the old or the new one.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::writeCheckpoint(const AVLTree<Key, Value>& tree, uint64_t covered) const
+{
+    std::string tmp = checkpointPath() + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + tmp);
+        }
+        out.write(reinterpret_cast<const char*>(&covered), sizeof(covered));
+        tree.save(out);
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Error writing " + tmp);
+        }
+    }
+    syncPath(tmp);
+    if (std::rename(tmp.c_str(), checkpointPath().c_str()) != 0) {
+        throw std::runtime_error("Cannot replace " + checkpointPath());
+    }
+    syncPath(dir_);
+}
+
+/**
+* Applies the records of one segment to tree and returns the length of
+* its intact prefix.
+*/
+template<class Key, class Value>
+size_t DurableTree<Key, Value>::replaySegment(const std::string& path, AVLTree<Key, Value>& tree)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::string log((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (log.size() - pos >= 2 * sizeof(uint32_t)) {
+        uint32_t header[2];
+        std::copy(log.data() + pos, log.data() + pos + sizeof(header), reinterpret_cast<char*>(header));
+        size_t start = pos + sizeof(header);
+        if (header[0] == 0 || log.size() - start < header[0] ||
+            checksum(log.data() + start, header[0]) != header[1]) {
+            break;
+        }
+        std::istringstream record(log.substr(start, header[0]));
+        int op = record.get();
+        Key key = SnapshotTraits<Key>::read(record);
+        if (op == OP_INSERT) {
+            Value value = SnapshotTraits<Value>::read(record);
+            tree.insert(std::make_pair(key, value));
+        }
+        else if (op == OP_REMOVE) {
+            tree.remove(key);
+        }
+        pos = start + header[0];
+    }
+    return pos;
+}
+
+template<class Key, class Value>
+uint32_t DurableTree<Key, Value>::checksum(const char* data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+template<class Key, class Value>
+void DurableTree<Key, Value>::writeAll(int fd, const std::string& data)
+{
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Cannot write log segment");
+        }
+        done += (size_t)n;
+    }
+}
+
+/**
+* fsyncs a file or directory by name.
+*/
+template<class Key, class Value>
+void DurableTree<Key, Value>::syncPath(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    int synced = ::fsync(fd);
+    ::close(fd);
+    if (synced != 0) {
+        throw std::runtime_error("Cannot sync " + path);
+    }
+}
+
+#endif
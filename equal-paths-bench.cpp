@@ -0,0 +1,171 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "equal-paths.h"
+#include "equal-paths-ext.h"
+
+using namespace std;
+
+/*
+  Times equalPaths on generated trees, sequentially and with threads.
+
+    equal-paths-bench [nodes]       (default 100000000)
+
+  Trees are built level by level into one array; every tree is freed
+  before the next is built, so peak memory is one tree (24 bytes a node).
+
+    equal       every leaf at the same depth: the whole tree is walked
+    equal/index the same tree as left/right child index arrays
+    early-miss  the leftmost path is cut short, found almost at once
+    late-miss   the rightmost path is cut short, found at the very end
+    chain       a single path as deep as the tree is large
+*/
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Builds an equal-depth tree of about n nodes. Levels double until they
+* reach the width that spreads the rest of the nodes over `depth` more
+* levels; after that every node has a single child. Returns the levels'
+* start offsets in nodes (the last entry is the end).
+*/
+static vector<size_t> buildEqualTree(vector<Node>& nodes, size_t n)
+{
+    const size_t tailLevels = 32;
+    size_t width = 1;
+    vector<size_t> starts;
+    nodes.clear();
+    nodes.reserve(n);
+    size_t cap = n / (tailLevels + 1);
+    if (cap == 0) {
+        cap = 1;
+    }
+    while (nodes.size() + width <= n) {
+        starts.push_back(nodes.size());
+        for (size_t i = 0; i < width; i++) {
+            nodes.push_back(Node((int)nodes.size()));
+        }
+        size_t next = width * 2 <= cap ? width * 2 : width;
+        if (nodes.size() + next > n) {
+            break;
+        }
+        width = next;
+    }
+    starts.push_back(nodes.size());
+
+    // link level l to level l + 1: the first (w' - w) parents get two children
+    for (size_t l = 0; l + 2 < starts.size(); l++) {
+        size_t parents = starts[l + 1] - starts[l];
+        size_t children = starts[l + 2] - starts[l + 1];
+        size_t twoChildren = children - parents;
+        size_t c = starts[l + 1];
+        for (size_t p = 0; p < parents; p++) {
+            Node& parent = nodes[starts[l] + p];
+            parent.left = &nodes[c++];
+            if (p < twoChildren) {
+                parent.right = &nodes[c++];
+            }
+        }
+    }
+    return starts;
+}
+
+static void buildChain(vector<Node>& nodes, size_t n)
+{
+    nodes.clear();
+    nodes.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        nodes.push_back(Node((int)i));
+    }
+    for (size_t i = 0; i + 1 < n; i++) {
+        nodes[i].right = &nodes[i + 1];
+    }
+}
+
+// Makes the first or last inner node of the middle level a leaf
+static void cutPath(vector<Node>& nodes, const vector<size_t>& starts, bool leftmost)
+{
+    size_t l = (starts.size() - 1) / 2;
+    Node& n = nodes[leftmost ? starts[l] : starts[l + 1] - 1];
+    n.left = nullptr;
+    n.right = nullptr;
+}
+
+static void timeTree(const char* name, Node* root, size_t n)
+{
+    unsigned hardware = thread::hardware_concurrency();
+    unsigned counts[] = { 1, 2, 4, 8, 16 };
+    for (unsigned t : counts) {
+        if (t > 1 && t > hardware * 2) {
+            break;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool equal = (t == 1) ? equalPaths(root) : equalPaths(root, t);
+        double secs = secondsSince(start);
+        cout << setw(11) << name << setw(12) << n << setw(8) << t << setw(7) << equal
+             << fixed << setprecision(4) << setw(10) << secs
+             << setprecision(1) << setw(12) << n / secs / 1e6 << endl;
+        cout.unsetf(ios::floatfield);
+        cout.precision(6);
+    }
+}
+
+/**
+* The same check on left/right child index arrays; the generated trees
+* are numbered in level order, so this takes the allocation-free path.
+*/
+static void timeIndexArrays(const char* name, const vector<Node>& nodes)
+{
+    vector<int> left(nodes.size(), -1);
+    vector<int> right(nodes.size(), -1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].left != nullptr) {
+            left[i] = (int)(nodes[i].left - &nodes[0]);
+        }
+        if (nodes[i].right != nullptr) {
+            right[i] = (int)(nodes[i].right - &nodes[0]);
+        }
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool equal = equalPaths(&left[0], &right[0], nodes.size(), 0);
+    double secs = secondsSince(start);
+    cout << setw(11) << name << setw(12) << nodes.size() << setw(8) << "index" << setw(7) << equal
+         << fixed << setprecision(4) << setw(10) << secs
+         << setprecision(1) << setw(12) << nodes.size() / secs / 1e6 << endl;
+    cout.unsetf(ios::floatfield);
+    cout.precision(6);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 100000000;
+    if (n == 0) {
+        cerr << "need at least one node" << endl;
+        return 1;
+    }
+    cout << setw(11) << "tree" << setw(12) << "nodes" << setw(8) << "threads" << setw(7) << "equal"
+         << setw(10) << "seconds" << setw(12) << "Mnodes/s" << endl;
+
+    vector<Node> nodes;
+    vector<size_t> starts = buildEqualTree(nodes, n);
+    timeTree("equal", &nodes[0], nodes.size());
+    timeIndexArrays("equal", nodes);
+
+    if (starts.size() > 3) {
+        cutPath(nodes, starts, true);
+        timeTree("early-miss", &nodes[0], nodes.size());
+        starts = buildEqualTree(nodes, n);
+        cutPath(nodes, starts, false);
+        timeTree("late-miss", &nodes[0], nodes.size());
+    }
+
+    buildChain(nodes, n);
+    timeTree("chain", &nodes[0], nodes.size());
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef EQUAL_PATHS_EXT_H
+#define EQUAL_PATHS_EXT_H
+
+#include <cstddef>
+#include "equal-paths.h"
+
+/**
+ * @brief equalPaths that splits the tree below the root into subtrees and
+ *        checks them on up to threads threads (0 = one per hardware
+ *        thread). A mismatch found by any thread stops the others. Small
+ *        trees are checked on the calling thread.
+ *
+ * @param root Pointer to the root of the tree to check for equal paths
+ * @param threads Maximum number of threads to use
+ */
+bool equalPaths(Node * root, unsigned threads);
+
+/**
+ * @brief equalPaths for a tree stored in level order as an implicit heap:
+ *        the children of keys[i] are keys[2i+1] and keys[2i+2], and
+ *        entries equal to absent are missing nodes. Reads the array level
+ *        by level, front to back, and allocates nothing; levels below the
+ *        first one holding a leaf are never read. Throws
+ *        std::invalid_argument if a level it reads has a node under a
+ *        missing one.
+ *
+ * @param keys Level-order keys
+ * @param count Number of entries in keys
+ * @param absent Key value that marks a missing node
+ */
+bool equalPaths(const int * keys, size_t count, int absent);
+
+/**
+ * @brief equalPaths for a tree given as child index arrays: the children
+ *        of node i are left[i] and right[i], -1 for none. When nodes are
+ *        numbered in level order from root (as level-order serializers
+ *        do), every level is a contiguous range and the check is a single
+ *        allocation-free pass; other numberings fall back to a walk with
+ *        an explicit stack. Throws std::invalid_argument for indices out
+ *        of range or child links that loop.
+ *
+ * @param left Left child index of every node
+ * @param right Right child index of every node
+ * @param count Number of nodes
+ * @param root Index of the root, or -1 for an empty tree
+ */
+bool equalPaths(const int * left, const int * right, size_t count, int root);
+
+#endif
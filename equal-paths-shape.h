@@ -0,0 +1,19 @@
+#ifndef EQUAL_PATHS_SHAPE_H
+#define EQUAL_PATHS_SHAPE_H
+
+#include "equal-paths.h"
+#include "tree_shape.h"
+
+/**
+* Shape report for a tree of equal-paths Nodes; see tree_shape.h.
+* equalPaths(root) holds exactly when treeShape(root).leafDepthSpread()
+* is 0.
+*/
+inline TreeShape treeShape(Node* root)
+{
+    return measureShape(root,
+                        [](Node* n) { return n->left; },
+                        [](Node* n) { return n->right; });
+}
+
+#endif
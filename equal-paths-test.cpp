@@ -1,6 +1,12 @@
 #include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
 #include <cstdlib>
 #include "equal-paths.h"
+#include "equal-paths-ext.h"
+#include "equal-paths-shape.h"
 using namespace std;
 
 
@@ -55,6 +61,281 @@ void test5(const char* msg)
   cout << msg << ": " <<   equalPaths(a) << endl;
 }
 
+// Counts failed checks; main() exits non-zero if any failed
+int failures = 0;
+
+void check(bool ok, const char* msg)
+{
+  if (!ok) {
+    cout << "FAIL: " << msg << endl;
+    failures++;
+  }
+}
+
+// Links nodes[0, count) as a heap: the children of i are 2i+1 and 2i+2
+void linkHeap(vector<Node>& nodes, size_t count)
+{
+  nodes.clear();
+  for (size_t i = 0; i < count; i++) {
+    nodes.push_back(Node((int)i));
+  }
+  for (size_t i = 0; i < count; i++) {
+    nodes[i].left = (2 * i + 1 < count) ? &nodes[2 * i + 1] : NULL;
+    nodes[i].right = (2 * i + 2 < count) ? &nodes[2 * i + 2] : NULL;
+  }
+}
+
+// equalPaths(root, threads) must agree with equalPaths(root) for every thread count
+void checkThreads(Node* root, bool expected, const char* msg)
+{
+  unsigned counts[] = { 0, 1, 2, 3, 4, 8, 16 };
+  check(equalPaths(root) == expected, msg);
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    check(equalPaths(root, counts[i]) == expected, msg);
+  }
+}
+
+void testThreads()
+{
+  vector<Node> nodes;
+  checkThreads(NULL, true, "threads: empty tree");
+
+  // 12 full levels: enough subtrees to hand out to every thread count
+  linkHeap(nodes, (1 << 12) - 1);
+  checkThreads(&nodes[0], true, "threads: perfect tree");
+
+  // one leaf grows a child, deep in the last subtree to be handed out
+  Node extra(-1);
+  nodes.back().left = &extra;
+  checkThreads(&nodes[0], false, "threads: one deeper leaf");
+  nodes.back().left = NULL;
+
+  // a leaf one level up, in the first subtree
+  nodes[(1 << 10) - 1].left = NULL;
+  nodes[(1 << 10) - 1].right = NULL;
+  checkThreads(&nodes[0], false, "threads: one shallower leaf");
+
+  // an incomplete last level leaves leaves on two levels
+  linkHeap(nodes, (1 << 12) + 5);
+  checkThreads(&nodes[0], false, "threads: partly filled last level");
+
+  // a long chain never splits and must not overflow any stack
+  nodes.assign(200000, Node(0));
+  for (size_t i = 0; i + 1 < nodes.size(); i++) {
+    nodes[i].right = &nodes[i + 1];
+  }
+  checkThreads(&nodes[0], true, "threads: chain");
+}
+
+// Converts nodes (children inside the same vector) to child index arrays,
+// numbering node i as number[i]
+void toIndexArrays(const vector<Node>& nodes, const vector<int>& number,
+                   vector<int>& left, vector<int>& right)
+{
+  left.assign(nodes.size(), -1);
+  right.assign(nodes.size(), -1);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].left != NULL) {
+      left[number[i]] = number[nodes[i].left - &nodes[0]];
+    }
+    if (nodes[i].right != NULL) {
+      right[number[i]] = number[nodes[i].right - &nodes[0]];
+    }
+  }
+}
+
+template <typename Fn>
+bool throwsInvalid(Fn fn)
+{
+  try {
+    fn();
+  }
+  catch (invalid_argument&) {
+    return true;
+  }
+  return false;
+}
+
+void testHeapArrays()
+{
+  const int X = -1;
+  int full[] = { 1, 2, 3, 4, 5, 6, 7 };
+  int uneven[] = { 1, 2, 3, 4, X, X, X };
+  int chain[] = { 1, 2, X, 3 };
+  int orphan[] = { 1, X, 2, 5, 6, 7, 8 };
+  check(equalPaths(full, 0, X), "heap: empty array");
+  check(equalPaths(uneven, 1, 1), "heap: absent root");
+  check(equalPaths(full, 7, X), "heap: perfect tree");
+  check(!equalPaths(uneven, 7, X), "heap: leaves on two levels");
+  check(equalPaths(chain, 4, X), "heap: left chain");
+  check(!equalPaths(full, 4, X), "heap: partly filled last level");
+  check(throwsInvalid([&]() { equalPaths(orphan, 7, X); }), "heap: node under a missing one");
+
+  // random heap arrays must agree with the pointer walk on the same tree
+  mt19937 rng(49);
+  for (int trial = 0; trial < 2000; trial++) {
+    size_t count = 1 + rng() % 40;
+    vector<int> keys(count);
+    vector<Node> nodes;
+    linkHeap(nodes, count);
+    for (size_t i = 0; i < count; i++) {
+      bool present = i == 0 || (keys[(i - 1) / 2] != X && rng() % 4 != 0);
+      keys[i] = present ? (int)i : X;
+      if (!present && i > 0) {
+        Node& parent = nodes[(i - 1) / 2];
+        (i % 2 == 1 ? parent.left : parent.right) = NULL;
+      }
+    }
+    check(equalPaths(&keys[0], count, X) == equalPaths(&nodes[0]), "heap: matches the pointer walk");
+  }
+}
+
+void testIndexArrays()
+{
+  vector<Node> nodes;
+  vector<int> number;
+  vector<int> left;
+  vector<int> right;
+  check(equalPaths((const int*)NULL, (const int*)NULL, 0, -1), "index: empty tree");
+
+  // level order numbering takes the single pass
+  linkHeap(nodes, 63);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    number.push_back((int)i);
+  }
+  toIndexArrays(nodes, number, left, right);
+  check(equalPaths(&left[0], &right[0], left.size(), 0), "index: perfect tree in level order");
+  left[3] = -1;
+  right[3] = -1;
+  check(!equalPaths(&left[0], &right[0], left.size(), 0), "index: shallower leaf in level order");
+
+  // any other numbering falls back to the stack walk
+  mt19937 rng(490);
+  for (int trial = 0; trial < 500; trial++) {
+    size_t count = 1 + rng() % 60;
+    linkHeap(nodes, count);
+    if (rng() % 2) {
+      Node& cut = nodes[rng() % count];
+      cut.left = NULL;
+      cut.right = NULL;
+    }
+    number.clear();
+    for (size_t i = 0; i < count; i++) {
+      number.push_back((int)i);
+    }
+    shuffle(number.begin(), number.end(), rng);
+    toIndexArrays(nodes, number, left, right);
+    check(equalPaths(&left[0], &right[0], count, number[0]) == equalPaths(&nodes[0]),
+          "index: shuffled numbering matches the pointer walk");
+  }
+
+  int noChildren[] = { -1, -1, -1 };
+  int outOfRange[] = { 1, 5, -1 };
+  int loopLeft[] = { 1, 0, -1 };
+  int loopRight[] = { 2, -1, -1 };
+  int selfLeft[] = { -1, -1, 2 };
+  check(throwsInvalid([&]() { equalPaths(noChildren, noChildren, 3, 3); }), "index: root out of range");
+  check(throwsInvalid([&]() { equalPaths(outOfRange, noChildren, 3, 0); }), "index: child out of range");
+  check(throwsInvalid([&]() { equalPaths(loopLeft, loopRight, 3, 0); }), "index: child cycle");
+  check(throwsInvalid([&]() { equalPaths(selfLeft, noChildren, 3, 2); }), "index: node is its own child");
+}
+
+// Links nodes[0, count) as a random binary search tree over shuffled keys
+void linkRandom(vector<Node>& nodes, size_t count, mt19937& rng)
+{
+  vector<int> keys;
+  for (size_t i = 0; i < count; i++) {
+    keys.push_back((int)i);
+  }
+  shuffle(keys.begin(), keys.end(), rng);
+  nodes.clear();
+  nodes.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    nodes.push_back(Node(keys[i]));
+    if (i == 0) {
+      continue;
+    }
+    Node* n = &nodes[0];
+    while (true) {
+      Node*& child = (keys[i] < n->key) ? n->left : n->right;
+      if (child == NULL) {
+        child = &nodes[i];
+        break;
+      }
+      n = child;
+    }
+  }
+}
+
+void testShape()
+{
+  // treeShape agrees with equalPaths on random trees of both kinds
+  vector<Node> nodes;
+  mt19937 rng(47);
+  int equal = 0;
+  int unequal = 0;
+  for (int trial = 0; trial < 2000; trial++) {
+    size_t count = 1 + rng() % 40;
+    if (trial % 2) {
+      linkRandom(nodes, count, rng);
+    }
+    else {
+      linkHeap(nodes, count);
+      if (rng() % 2) {
+        Node& cut = nodes[rng() % count];
+        cut.left = NULL;
+        cut.right = NULL;
+      }
+    }
+    bool paths = equalPaths(&nodes[0]);
+    TreeShape shape = treeShape(&nodes[0]);
+    check((shape.leafDepthSpread() == 0) == paths, "shape: leaf depth spread 0 exactly when equalPaths");
+    check(shape.minLeafDepth <= shape.maxLeafDepth && shape.maxLeafDepth < shape.height,
+          "shape: leaf depths lie inside the height");
+    equal += paths;
+    unequal += !paths;
+  }
+  check(equal > 100 && unequal > 100, "shape: random trees cover both answers");
+
+  TreeShape empty = treeShape(NULL);
+  check(empty.nodes == 0 && empty.height == 0 && empty.leafDepthSpread() == 0 && equalPaths(NULL),
+        "shape: empty tree");
+
+  // a perfect tree of 10 levels
+  const int levels = 10;
+  const size_t perfect = (1 << levels) - 1;
+  linkHeap(nodes, perfect);
+  TreeShape full = treeShape(&nodes[0]);
+  check(full.nodes == perfect && full.leaves == (size_t)1 << (levels - 1) && full.height == levels,
+        "shape: perfect tree counts");
+  check(full.minLeafDepth == levels - 1 && full.maxLeafDepth == levels - 1 &&
+        full.leafDepths.size() == (size_t)levels && full.leafDepths[levels - 1] == full.leaves,
+        "shape: perfect tree leaf depths");
+  check(full.balances.size() == 1 && full.balances[0] == perfect, "shape: perfect tree is balanced");
+  // sum over levels d of 2^d (d + 1) = (levels - 1) 2^levels + 1
+  check(full.averagePathLength == (double)((levels - 1) * (1 << levels) + 1) / perfect &&
+        full.missPathLength == levels && full.weightedPathLength == full.averagePathLength,
+        "shape: perfect tree path lengths");
+
+  // a right chain: one leaf at the bottom, the node above it leans by
+  // 1, the next by 2, up to n - 1 at the root
+  const size_t n = 1000;
+  nodes.assign(n, Node(0));
+  for (size_t i = 0; i + 1 < n; i++) {
+    nodes[i].right = &nodes[i + 1];
+  }
+  TreeShape chain = treeShape(&nodes[0]);
+  check(chain.nodes == n && chain.leaves == 1 && chain.height == (int)n, "shape: chain counts");
+  check(chain.minLeafDepth == (int)n - 1 && chain.leafDepthSpread() == 0 && equalPaths(&nodes[0]),
+        "shape: chain has equal paths");
+  check(chain.balances.size() == n && chain.balances.begin()->first == 0 &&
+        chain.balances.rbegin()->first == (int)n - 1,
+        "shape: chain balances");
+  check(chain.averagePathLength == (n + 1) / 2.0 &&
+        chain.missPathLength == (double)(n * (n + 1) / 2 + n) / (n + 1),
+        "shape: chain path lengths");
+}
+
 int main()
 {
   a = new Node(1);
@@ -67,10 +348,21 @@ int main()
   test3("Test3");
   test4("Test4");
   test5("Test5");
+
+  testThreads();
+  testHeapArrays();
+  testIndexArrays();
+  testShape();
  
   delete a;
   delete b;
   delete c;
   delete d;
+
+  if (failures > 0) {
+    cout << failures << " checks failed" << endl;
+    return 1;
+  }
+  return 0;
 }
 
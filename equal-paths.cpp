@@ -1,33 +1,86 @@
 #ifndef RECCHECK
 //if you want to add any #includes like <iostream> you must do them here (before the next endif)
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
 #endif
 
 #include "equal-paths.h"
+#include "equal-paths-ext.h"
 using namespace std;
 
-// global var to keep track of all leaf depth
-int uniDepth = -500;
-
 // You may add any prototypes of helper functions here
-// helper function, need node, current depth, and universal depth
-bool equalPathsUtil(Node * curr, int depth) {
-    // handle null ptr case
+
+// Trees with fewer nodes than this in the top levels are not worth threads
+static const size_t MIN_PARALLEL_TASKS = 2;
+
+// Deepest level the tree is split at; below it a thin tree is walked whole
+static const int MAX_SPLIT_DEPTH = 64;
+
+// How many nodes a worker checks between looks at the shared stop flag
+static const unsigned STOP_CHECK_INTERVAL = 4096;
+
+// Records a leaf at depth against the common leaf depth, which is -1
+// until the first leaf is seen. Returns false on a mismatch.
+static bool leafAt(int depth, atomic<int>& leafDepth)
+{
+    int expected = -1;
+    if (leafDepth.load(memory_order_relaxed) == depth) {
+        return true;
+    }
+    return leafDepth.compare_exchange_strong(expected, depth) || expected == depth;
+}
+
+// helper function, need node and its depth; the leaf depth is shared by
+// every subtree being checked. Walks with an explicit stack so deep trees
+// cannot overflow the call stack, and returns as soon as a path is known
+// to differ: a leaf at another depth, or an inner node at or below the
+// leaf depth. stop, when given, is polled so that other threads can end
+// the walk early.
+static bool equalPathsUtil(Node * curr, int depth, atomic<int>& leafDepth,
+                           const atomic<bool>* stop)
+{
     if (curr == nullptr) {
         return true;
     }
+    vector<pair<Node*, int> > pending;
+    pending.push_back(make_pair(curr, depth));
+    unsigned untilCheck = STOP_CHECK_INTERVAL;
+    while (!pending.empty()) {
+        Node* n = pending.back().first;
+        int d = pending.back().second;
+        pending.pop_back();
 
-    // if leaf node, check if same with other elaf deapth
-    if (curr->left == nullptr && curr->right == nullptr) {
-        // check if its the first time uniDepth is updated
-        if (uniDepth < 0) {
-            uniDepth = depth;
+        if (n->left == nullptr && n->right == nullptr) {
+            if (!leafAt(d, leafDepth)) {
+                return false;
+            }
+        }
+        else {
+            int known = leafDepth.load(memory_order_relaxed);
+            if (known >= 0 && d >= known) {
+                // every leaf under n is deeper than the known leaf depth
+                return false;
+            }
+            if (n->right != nullptr) {
+                pending.push_back(make_pair(n->right, d + 1));
+            }
+            if (n->left != nullptr) {
+                pending.push_back(make_pair(n->left, d + 1));
+            }
         }
-        return uniDepth == depth;
-    }
 
-    // not leaf node, increase depth and check left and right sub tree
-    return equalPathsUtil(curr->left, depth + 1) && equalPathsUtil(curr->right, depth + 1);
+        if (stop != nullptr && --untilCheck == 0) {
+            untilCheck = STOP_CHECK_INTERVAL;
+            if (stop->load(memory_order_relaxed)) {
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 
@@ -39,10 +92,203 @@ bool equalPaths(Node * root)
         return true;
     }
 
-    uniDepth = -500;
-    // track depth with each call
-    // if leaf node -> check with a var for universal depth
-    // depth at root is 0 and give dummy var to indicate first depth recording
-    return equalPathsUtil(root, 0);
+    // no leaf seen yet; depth at root is 0
+    atomic<int> leafDepth(-1);
+    return equalPathsUtil(root, 0, leafDepth, nullptr);
+}
+
+bool equalPaths(Node * root, unsigned threads)
+{
+    if (threads == 0) {
+        threads = thread::hardware_concurrency();
+    }
+    if (root == nullptr || threads <= 1) {
+        return equalPaths(root);
+    }
+
+    // expand the top of the tree level by level until there are enough
+    // subtrees to keep every thread busy, checking the leaves met on the way
+    atomic<int> leafDepth(-1);
+    vector<Node*> level(1, root);
+    int depth = 0;
+    while (!level.empty() && level.size() < threads * 8 && depth < MAX_SPLIT_DEPTH) {
+        vector<Node*> next;
+        for (size_t i = 0; i < level.size(); i++) {
+            Node* n = level[i];
+            if (n->left == nullptr && n->right == nullptr) {
+                if (!leafAt(depth, leafDepth)) {
+                    return false;
+                }
+                continue;
+            }
+            int known = leafDepth.load(memory_order_relaxed);
+            if (known >= 0 && depth >= known) {
+                return false;
+            }
+            if (n->left != nullptr) {
+                next.push_back(n->left);
+            }
+            if (n->right != nullptr) {
+                next.push_back(n->right);
+            }
+        }
+        level.swap(next);
+        depth++;
+    }
+    if (level.size() < MIN_PARALLEL_TASKS) {
+        for (size_t i = 0; i < level.size(); i++) {
+            if (!equalPathsUtil(level[i], depth, leafDepth, nullptr)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // workers take subtrees from a shared counter until one fails
+    atomic<size_t> nextTask(0);
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    unsigned count = threads < level.size() ? threads : (unsigned)level.size();
+    for (unsigned t = 0; t < count; t++) {
+        workers.push_back(thread([&]() {
+            size_t i;
+            while (!failed.load(memory_order_relaxed) &&
+                   (i = nextTask.fetch_add(1)) < level.size()) {
+                if (!equalPathsUtil(level[i], depth, leafDepth, &failed)) {
+                    failed.store(true);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    return !failed.load();
+}
+
+bool equalPaths(const int * keys, size_t count, int absent)
+{
+    if (count == 0 || keys[0] == absent) {
+        return true;
+    }
+    size_t begin = 0;
+    size_t width = 1;
+    // a level is keys[begin, begin + width) and its children are the next
+    // one; the first level holding a leaf must hold nothing else
+    while (begin < count) {
+        size_t end = (count - begin < width) ? count : begin + width;
+        bool leaves = false;
+        bool inner = false;
+        for (size_t i = begin; i < end; i++) {
+            if (keys[i] == absent) {
+                continue;
+            }
+            if (i > 0 && keys[(i - 1) / 2] == absent) {
+                throw invalid_argument("Level-order tree has a node under a missing one");
+            }
+            size_t l = 2 * i + 1;
+            bool hasLeft = l < count && keys[l] != absent;
+            bool hasRight = l + 1 < count && keys[l + 1] != absent;
+            if (!hasLeft && !hasRight) {
+                leaves = true;
+            }
+            else {
+                inner = true;
+            }
+            if (leaves && inner) {
+                return false;
+            }
+        }
+        if (leaves) {
+            // every node of this level was a leaf, so nothing lies below
+            return true;
+        }
+        begin = end;
+        width *= 2;
+    }
+    return true;
+}
+
+// equalPaths on index arrays in any numbering; the walk takes at most
+// count steps, so a cycle is reported instead of looping
+static bool equalPathsIndexed(const int * left, const int * right, size_t count, int root)
+{
+    int leafDepth = -1;
+    size_t steps = 0;
+    vector<pair<int, int> > pending;
+    pending.push_back(make_pair(root, 0));
+    while (!pending.empty()) {
+        int n = pending.back().first;
+        int d = pending.back().second;
+        pending.pop_back();
+        if (++steps > count) {
+            throw invalid_argument("Child indices do not form a tree");
+        }
+        if (left[n] < 0 && right[n] < 0) {
+            if (leafDepth < 0) {
+                leafDepth = d;
+            }
+            else if (leafDepth != d) {
+                return false;
+            }
+            continue;
+        }
+        if (leafDepth >= 0 && d >= leafDepth) {
+            return false;
+        }
+        if (right[n] >= 0) {
+            pending.push_back(make_pair(right[n], d + 1));
+        }
+        if (left[n] >= 0) {
+            pending.push_back(make_pair(left[n], d + 1));
+        }
+    }
+    return true;
 }
 
+bool equalPaths(const int * left, const int * right, size_t count, int root)
+{
+    if (root < 0) {
+        return true;
+    }
+    if ((size_t)root >= count) {
+        throw invalid_argument("Root index out of range");
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (left[i] >= (long long)count || right[i] >= (long long)count) {
+            throw invalid_argument("Child index out of range");
+        }
+    }
+
+    // in level order the children of level [begin, end) are exactly
+    // [end, next) in order; anything else needs the general walk
+    int leafDepth = -1;
+    int depth = 0;
+    size_t begin = root;
+    size_t end = begin + 1;
+    size_t next = end;
+    while (begin < end) {
+        for (size_t i = begin; i < end; i++) {
+            if (left[i] < 0 && right[i] < 0) {
+                if (leafDepth < 0) {
+                    leafDepth = depth;
+                }
+                else if (leafDepth != depth) {
+                    return false;
+                }
+                continue;
+            }
+            if (leafDepth >= 0) {
+                return false;
+            }
+            if ((left[i] >= 0 && (size_t)left[i] != next++) ||
+                (right[i] >= 0 && (size_t)right[i] != next++)) {
+                return equalPathsIndexed(left, right, count, root);
+            }
+        }
+        begin = end;
+        end = next;
+        depth++;
+    }
+    return true;
+}
@@ -0,0 +1,158 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "aggregate_avl.h"
+
+/**
+* A half-open interval [start, end), ordered by start and then by end.
+*/
+template <typename Key>
+struct Interval
+{
+    Key start;
+    Key end;
+
+    Interval(const Key& s, const Key& e) : start(s), end(e) {}
+
+    bool operator==(const Interval& rhs) const { return start == rhs.start && end == rhs.end; }
+    bool operator<(const Interval& rhs) const
+    {
+        return start < rhs.start || (start == rhs.start && end < rhs.end);
+    }
+    bool operator>(const Interval& rhs) const { return rhs < *this; }
+    bool operator>=(const Interval& rhs) const { return !(*this < rhs); }
+};
+
+template <typename Key>
+std::ostream& operator<<(std::ostream& os, const Interval<Key>& interval)
+{
+    return os << "[" << interval.start << ", " << interval.end << ")";
+}
+
+/**
+* Snapshots store an interval as its two end points.
+*/
+template <typename Key>
+struct SnapshotTraits<Interval<Key> >
+{
+    static void write(std::ostream& out, const Interval<Key>& interval)
+    {
+        SnapshotTraits<Key>::write(out, interval.start);
+        SnapshotTraits<Key>::write(out, interval.end);
+    }
+    static Interval<Key> read(std::istream& in)
+    {
+        Key start = SnapshotTraits<Key>::read(in);
+        Key end = SnapshotTraits<Key>::read(in);
+        return Interval<Key>(start, end);
+    }
+};
+
+/**
+* Largest end point in a subtree of intervals.
+*/
+template <typename Key, typename Value>
+struct IntervalEndMonoid
+{
+    typedef Key value_type;
+    static Key identity() { return std::numeric_limits<Key>::lowest(); }
+    static Key lift(const Interval<Key>& interval, const Value&) { return interval.end; }
+    static Key combine(const Key& a, const Key& b) { return (a < b) ? b : a; }
+};
+
+/**
+* An interval tree over half-open [start, end) intervals. Intervals are
+* ordered by (start, end) in an AVL tree whose nodes keep the largest end
+* point of their subtree, which rotations maintain through the aggregate
+* hooks. Inserting the same interval twice overwrites its value.
+*/
+template <typename Key, typename Value>
+class IntervalTree : public AggregateAVLTree<Interval<Key>, Value, IntervalEndMonoid<Key, Value> >
+{
+public:
+    typedef std::pair<const Interval<Key>, Value> Item;
+
+    void insert(const Key& start, const Key& end, const Value& value);
+    void remove(const Key& start, const Key& end);
+
+    template<typename Fn>
+    void overlapping(const Key& lo, const Key& hi, Fn fn) const;
+    template<typename Fn>
+    void stab(const Key& point, Fn fn) const;
+
+protected:
+    template<typename Fn>
+    void overlapHelper(Node<Interval<Key>, Value>* current, const Key& lo, const Key& hi,
+                       bool closedHi, Fn& fn) const;
+};
+
+/**
+* Adds [start, end) with the given value. Empty intervals are rejected.
+*/
+template<class Key, class Value>
+void IntervalTree<Key, Value>::insert(const Key& start, const Key& end, const Value& value)
+{
+    if (!(start < end)) throw std::invalid_argument("Interval must have start < end");
+    AVLTree<Interval<Key>, Value>::insert(Item(Interval<Key>(start, end), value));
+}
+
+template<class Key, class Value>
+void IntervalTree<Key, Value>::remove(const Key& start, const Key& end)
+{
+    AVLTree<Interval<Key>, Value>::remove(Interval<Key>(start, end));
+}
+
+/**
+* Calls fn(item) for every interval that overlaps [lo, hi), in order of
+* start. Subtrees whose largest end is <= lo and right subtrees of nodes
+* starting at or after hi are skipped, so the cost is O(log n) plus the
+* paths to the reported intervals. An empty query (hi <= lo) overlaps
+* nothing and returns at once; use stab() for a single point.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void IntervalTree<Key, Value>::overlapping(const Key& lo, const Key& hi, Fn fn) const
+{
+    if (!(lo < hi)) {
+        return;
+    }
+    overlapHelper(this->root_, lo, hi, false, fn);
+}
+
+/**
+* Calls fn(item) for every interval with start <= point < end.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void IntervalTree<Key, Value>::stab(const Key& point, Fn fn) const
+{
+    overlapHelper(this->root_, point, point, true, fn);
+}
+
+template<class Key, class Value>
+template<typename Fn>
+void IntervalTree<Key, Value>::overlapHelper(Node<Interval<Key>, Value>* current, const Key& lo, const Key& hi,
+                                             bool closedHi, Fn& fn) const
+{
+    // nothing in this subtree ends after lo
+    if (current == nullptr || !(lo < this->aggregateOf(current))) {
+        return;
+    }
+    overlapHelper(current->getLeft(), lo, hi, closedHi, fn);
+
+    const Interval<Key>& interval = current->getKey();
+    bool startsInRange = closedHi ? !(hi < interval.start) : (interval.start < hi);
+    if (!startsInRange) {
+        // everything to the right starts even later
+        return;
+    }
+    if (lo < interval.end) {
+        fn(current->getItem());
+    }
+    overlapHelper(current->getRight(), lo, hi, closedHi, fn);
+}
+
+#endif
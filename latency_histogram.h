@@ -0,0 +1,262 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define LATENCY_USE_RDTSC 1
+#endif
+
+/**
+* Cheap timestamps for latency measurement. On x86 this reads the time
+* stamp counter, calibrated once against steady_clock; elsewhere it is
+* steady_clock itself. Only differences between two now() calls on the
+* same thread are meaningful.
+*/
+class LatencyClock
+{
+public:
+    static uint64_t now()
+    {
+#ifdef LATENCY_USE_RDTSC
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static uint64_t toNanos(uint64_t ticks)
+    {
+#ifdef LATENCY_USE_RDTSC
+        return static_cast<uint64_t>(ticks * nanosPerTick());
+#else
+        return ticks;
+#endif
+    }
+
+private:
+#ifdef LATENCY_USE_RDTSC
+    static double nanosPerTick()
+    {
+        static const double rate = calibrate();
+        return rate;
+    }
+    static double calibrate()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t ticks = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t elapsedTicks = __rdtsc() - ticks;
+        double elapsedNanos = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        return elapsedTicks == 0 ? 1.0 : elapsedNanos / elapsedTicks;
+    }
+#endif
+};
+
+/**
+* An HDR-style log-linear histogram of latencies in nanoseconds. Every
+* power of two is split into SUB_BUCKETS linear buckets, so any recorded
+* value is reported within about 3% using a fixed 15KB of counts, from
+* one nanosecond up to the full 64-bit range. Not thread-safe; give each
+* thread its own and merge() them.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t nanos);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+    // Smallest value v such that at least p percent of samples are <= v
+    uint64_t percentile(double p) const;
+
+    // One summary line; writeJson also lists the non-empty buckets
+    void writeText(std::ostream& out, const char* name) const;
+    void writeJson(std::ostream& out) const;
+
+private:
+    static const unsigned SUB_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1ULL << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucketOf(uint64_t v);
+    static uint64_t bucketLow(size_t index);
+    static uint64_t bucketHigh(size_t index);
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t min_;
+    uint64_t max_;
+    double sum_;
+};
+
+inline LatencyHistogram::LatencyHistogram() :
+    counts_(BUCKETS, 0), total_(0), min_(UINT64_MAX), max_(0), sum_(0)
+{
+
+}
+
+/**
+* Values below SUB_BUCKETS get a bucket each; above that the bucket is
+* picked by the top SUB_BITS + 1 significant bits.
+*/
+inline size_t LatencyHistogram::bucketOf(uint64_t v)
+{
+    if (v < SUB_BUCKETS) {
+        return static_cast<size_t>(v);
+    }
+    unsigned shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+    return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((v >> shift) - SUB_BUCKETS));
+}
+
+inline uint64_t LatencyHistogram::bucketLow(size_t index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index / SUB_BUCKETS) - 1;
+    return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+inline uint64_t LatencyHistogram::bucketHigh(size_t index)
+{
+    if (index + 1 >= BUCKETS) {
+        return UINT64_MAX;
+    }
+    return bucketLow(index + 1) - 1;
+}
+
+inline void LatencyHistogram::record(uint64_t nanos)
+{
+    counts_[bucketOf(nanos)]++;
+    total_++;
+    sum_ += static_cast<double>(nanos);
+    if (nanos < min_) {
+        min_ = nanos;
+    }
+    if (nanos > max_) {
+        max_ = nanos;
+    }
+}
+
+inline void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    sum_ += other.sum_;
+    if (other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+}
+
+inline void LatencyHistogram::reset()
+{
+    counts_.assign(BUCKETS, 0);
+    total_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+    sum_ = 0;
+}
+
+inline uint64_t LatencyHistogram::count() const
+{
+    return total_;
+}
+
+inline uint64_t LatencyHistogram::min() const
+{
+    return total_ == 0 ? 0 : min_;
+}
+
+inline uint64_t LatencyHistogram::max() const
+{
+    return max_;
+}
+
+inline double LatencyHistogram::mean() const
+{
+    return total_ == 0 ? 0.0 : sum_ / total_;
+}
+
+/**
+* Reports the top of the bucket holding the requested rank, clamped to
+* the largest value seen, so the answer never understates the latency.
+*/
+inline uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (total_ == 0) {
+        return 0;
+    }
+    if (p < 0) {
+        p = 0;
+    }
+    if (p > 100) {
+        p = 100;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total_ + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            uint64_t high = bucketHigh(i);
+            return high < max_ ? (high > min_ ? high : min_) : max_;
+        }
+    }
+    return max_;
+}
+
+inline void LatencyHistogram::writeText(std::ostream& out, const char* name) const
+{
+    out << name << ": count=" << count() << " min=" << min()
+        << "ns mean=" << static_cast<uint64_t>(mean() + 0.5)
+        << "ns p50=" << percentile(50) << "ns p90=" << percentile(90)
+        << "ns p99=" << percentile(99) << "ns p999=" << percentile(99.9)
+        << "ns max=" << max() << "ns" << std::endl;
+}
+
+/**
+* {"count":..,"min":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,
+*  "max":..,"buckets":[[low,high,count],...]} with times in nanoseconds.
+*/
+inline void LatencyHistogram::writeJson(std::ostream& out) const
+{
+    out << "{\"count\":" << count() << ",\"min\":" << min() << ",\"mean\":" << mean()
+        << ",\"p50\":" << percentile(50) << ",\"p90\":" << percentile(90)
+        << ",\"p99\":" << percentile(99) << ",\"p999\":" << percentile(99.9)
+        << ",\"max\":" << max() << ",\"buckets\":[";
+    bool first = true;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        if (counts_[i] == 0) {
+            continue;
+        }
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "[" << bucketLow(i) << "," << bucketHigh(i) << "," << counts_[i] << "]";
+    }
+    out << "]}";
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include "lsm_tree.h"
+
+using namespace std;
+
+// Prints and counts a failed check; main() exits non-zero if any failed
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+static string makeTempDir()
+{
+    char name[] = "/tmp/lsm-tree-test.XXXXXX";
+    if (::mkdtemp(name) == nullptr) {
+        throw runtime_error("Cannot create a temporary directory");
+    }
+    return name;
+}
+
+static void removeDir(const string& dir)
+{
+    DIR* d = ::opendir(dir.c_str());
+    if (d != nullptr) {
+        while (struct dirent* entry = ::readdir(d)) {
+            string name = entry->d_name;
+            if (name != "." && name != "..") {
+                ::unlink((dir + "/" + name).c_str());
+            }
+        }
+        ::closedir(d);
+    }
+    ::rmdir(dir.c_str());
+}
+
+static bool fileExists(const string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
+
+static void copyFile(const string& from, const string& to)
+{
+    ifstream in(from.c_str(), ios::binary);
+    ofstream out(to.c_str(), ios::binary);
+    out << in.rdbuf();
+}
+
+// Every key in [0, keys) answers find() as m does, and scans of random
+// ranges return exactly m's entries in them
+static bool sameContents(const LSMTree<int, int>& t, const map<int, int>& m, int keys, mt19937& rng)
+{
+    for (int k = -1; k <= keys; k++) {
+        int value = 0;
+        bool found = t.find(k, value);
+        map<int, int>::const_iterator it = m.find(k);
+        if (found != (it != m.end()) || (found && value != it->second)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < 50; i++) {
+        int lo = (int)(rng() % (keys + 2)) - 1;
+        int hi = lo + (int)(rng() % (keys / 4 + 1));
+        if (i == 0) {
+            lo = -1;
+            hi = keys + 1;
+        }
+        vector<pair<int, int> > got;
+        t.scan(lo, hi, [&got](const int& k, const int& v) { got.push_back(make_pair(k, v)); });
+        vector<pair<int, int> > want(m.lower_bound(lo), m.lower_bound(hi));
+        if (got != want) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Random inserts and removes through many flushes and compactions, then
+// a reopen
+static void testAgainstMap()
+{
+    string dir = makeTempDir();
+    mt19937 rng(41);
+    map<int, int> m;
+    const int keys = 2000;
+    {
+        LSMTree<int, int> t(dir);
+        t.setMemtableLimit(100);
+        t.setFanout(3);
+        for (int i = 0; i < 20000; i++) {
+            int k = (int)(rng() % keys);
+            if (rng() % 4 == 0) {
+                t.remove(k);
+                m.erase(k);
+            }
+            else {
+                t.insert(make_pair(k, i));
+                m[k] = i;
+            }
+            if (i % 5000 == 4999) {
+                check(sameContents(t, m, keys, rng), "contents match while compacting");
+            }
+        }
+        t.waitForCompaction();
+        check(t.runCount() < 3 * 5, "compaction keeps a few runs per level");
+        check(sameContents(t, m, keys, rng), "contents match after compaction");
+        check(t.bloomSkips() > 0, "Bloom filters skip runs");
+    }
+    {
+        LSMTree<int, int> t(dir);
+        check(sameContents(t, m, keys, rng), "contents match after reopen");
+
+        // a deletion shadows values in every older run until compaction
+        t.setFanout(100);
+        for (int k = 0; k < keys; k += 3) {
+            t.remove(k);
+            m.erase(k);
+        }
+        t.flush();
+        check(sameContents(t, m, keys, rng), "tombstones hide older runs");
+        t.setFanout(2);
+        t.waitForCompaction();
+        check(sameContents(t, m, keys, rng), "tombstones survive compaction");
+    }
+    {
+        LSMTree<int, int> t(dir);
+        check(sameContents(t, m, keys, rng), "contents match after the last reopen");
+    }
+    removeDir(dir);
+}
+
+// Leftovers of a crash: an unfinished .tmp file and a compaction input
+// that was not yet deleted when its output had been installed
+static void testCrashLeftovers()
+{
+    string dir = makeTempDir();
+    mt19937 rng(42);
+    map<int, int> m;
+    const int keys = 200;
+    {
+        LSMTree<int, int> t(dir);
+        t.setMemtableLimit(1000);
+        t.setFanout(100);
+        for (int k = 0; k < keys; k++) {
+            t.insert(make_pair(k, k));
+            m[k] = k;
+        }
+        t.flush();
+        for (int k = 0; k < keys / 2; k++) {
+            t.remove(k);
+            m.erase(k);
+        }
+        t.flush();
+        check(fileExists(dir + "/run-1-0.sst"), "first flush writes run 1");
+        copyFile(dir + "/run-1-0.sst", dir + "/saved");
+
+        // merging to the deepest level drops the deletions with the values
+        t.setFanout(2);
+        t.waitForCompaction();
+        check(t.runCount() == 1, "both runs compacted into one");
+    }
+    check(!fileExists(dir + "/run-1-0.sst"), "compaction deletes its inputs");
+    ::rename((dir + "/saved").c_str(), (dir + "/run-1-0.sst").c_str());
+    ofstream torn((dir + "/run-3-0.sst.tmp").c_str(), ios::binary);
+    torn << "LSMRUN01 torn";
+    torn.close();
+    {
+        LSMTree<int, int> t(dir);
+        check(sameContents(t, m, keys, rng), "a leftover input does not bring deleted keys back");
+        check(t.runCount() == 1, "the leftover input is not loaded");
+        t.insert(make_pair(-5, 5));
+        m[-5] = 5;
+    }
+    check(!fileExists(dir + "/run-3-0.sst.tmp"), "unfinished .tmp files are removed");
+    check(!fileExists(dir + "/run-1-0.sst"), "the leftover input is removed");
+    {
+        LSMTree<int, int> t(dir);
+        check(sameContents(t, m, keys, rng), "writes after recovery survive");
+    }
+    removeDir(dir);
+}
+
+// Writers fill memtables while earlier ones are written out; every write
+// is visible as soon as insert() returns
+static void testConcurrentFlush()
+{
+    string dir = makeTempDir();
+    const int threads = 4;
+    const int perThread = 3000;
+    atomic<int> missing(0);
+    atomic<int> unsorted(0);
+    {
+        LSMTree<int, int> t(dir);
+        t.setMemtableLimit(64);
+        t.setFanout(4);
+        vector<thread> workers;
+        for (int w = 0; w < threads; w++) {
+            workers.push_back(thread([&t, &missing, w]() {
+                for (int i = 0; i < perThread; i++) {
+                    int k = i * threads + w;
+                    t.insert(make_pair(k, w));
+                    int value;
+                    if (!t.find(k, value) || value != w) {
+                        missing++;
+                    }
+                }
+            }));
+        }
+        workers.push_back(thread([&t, &unsorted]() {
+            for (int i = 0; i < 200; i++) {
+                int last = -1;
+                bool sorted = true;
+                t.scan(0, threads * perThread, [&last, &sorted](const int& k, const int&) {
+                    sorted = sorted && last < k;
+                    last = k;
+                });
+                unsorted += !sorted;
+            }
+        }));
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].join();
+        }
+    }
+    check(missing.load() == 0, "writes are visible while their memtable is written");
+    check(unsorted.load() == 0, "scans during flushes are in order");
+    {
+        LSMTree<int, int> t(dir);
+        size_t count = 0;
+        t.scan(0, threads * perThread, [&count](const int&, const int&) { count++; });
+        check(count == (size_t)(threads * perThread), "every concurrent write is in a run");
+    }
+    removeDir(dir);
+}
+
+int main()
+{
+    testAgainstMap();
+    testCrashLeftovers();
+    testConcurrentFlush();
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "lsm-tree-test: all checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,952 @@
+#ifndef LSM_TREE_H
+#define LSM_TREE_H
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "avlbst.h"
+#include "snapshot.h"
+#include "bloom.h"
+
+/*
+  A run file, run-<seq>-<level>.sst, host byte order:
+
+    char     magic[8]        "LSMRUN01"
+    records, sorted by key:
+      uint8_t  tombstone
+      Key [, Value]          as written by SnapshotTraits
+    uint64_t fence count, then per fence: Key, uint64_t record offset
+    BloomFilter
+    uint64_t count, data end, fence index start
+    char     magic[8]
+
+  A fence marks the first record of each block of about BLOCK_BYTES, so a
+  lookup reads one block. Higher seq means newer data; a compaction's
+  output takes the newest seq of its inputs and sorts ahead of them.
+*/
+static const char LSM_RUN_MAGIC[8] = { 'L', 'S', 'M', 'R', 'U', 'N', '0', '1' };
+
+/**
+* What the memtable and the runs keep per key: a value or a deletion.
+*/
+template <typename Value>
+struct LSMEntry
+{
+    Value value;
+    bool tombstone;
+
+    LSMEntry() : value(), tombstone(false) {}
+    LSMEntry(const Value& v, bool dead) : value(v), tombstone(dead) {}
+};
+
+template <typename Value>
+std::ostream& operator<<(std::ostream& os, const LSMEntry<Value>& entry)
+{
+    if (entry.tombstone) {
+        return os << "(deleted)";
+    }
+    return os << entry.value;
+}
+
+/**
+* A log-structured key-value store. Writes go to an AVLTree memtable; a
+* full memtable is frozen, replaced by an empty one, and written out in
+* key order as an immutable run without holding the lock. Runs are
+* grouped in tiers: when a level holds `fanout` runs, a background thread
+* merges them into one run on the next level, dropping shadowed versions
+* (and deletions, once nothing older is left below).
+*
+* find() checks the memtable and then each run, newest first, skipping
+* runs whose Bloom filter rules the key out and reading a single block
+* located through the run's fence index. scan() k-way merges the
+* memtable with cursors over every run. A frozen memtable is searched
+* like the newest run until its run is installed.
+*
+* Reopening removes unfinished .tmp files and the inputs of a compaction
+* whose output was installed before a crash.
+*
+* The memtable is not logged: call flush() (the destructor does) to make
+* it durable, or put a DurableTree in front. Uses std::thread, so link
+* with -pthread.
+*/
+template <typename Key, typename Value>
+class LSMTree
+{
+public:
+    explicit LSMTree(const std::string& dir);
+    ~LSMTree();
+
+    void insert(const std::pair<const Key, Value>& item);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    template<typename Fn>
+    void scan(const Key& lo, const Key& hi, Fn fn) const;
+
+    void flush();
+    void waitForCompaction();
+
+    void setMemtableLimit(size_t entries);
+    void setFanout(size_t runs);
+    void setBitsPerKey(double bits);
+    size_t runCount() const;
+    size_t bloomSkips() const;
+    size_t blockReads() const;
+
+private:
+    // Not copyable: owns files and a thread
+    LSMTree(const LSMTree&);
+    LSMTree& operator=(const LSMTree&);
+
+    typedef AVLTree<Key, LSMEntry<Value> > Memtable;
+    static const size_t BLOCK_BYTES = 4096;
+
+    struct Run
+    {
+        uint64_t seq;
+        int level;
+        std::string path;
+        int fd;
+        uint64_t count;
+        uint64_t dataEnd;
+        std::vector<Key> fenceKeys;
+        std::vector<uint64_t> fenceOffsets;
+        BloomFilter bloom;
+        bool obsolete;
+
+        Run() : seq(0), level(0), fd(-1), count(0), dataEnd(0), obsolete(false) {}
+        ~Run();
+        size_t blockFor(const Key& key) const;
+        void readBlock(size_t block, std::string& out) const;
+    };
+    typedef std::shared_ptr<Run> RunPtr;
+
+    // Walks one run, or the memtable, in key order
+    struct Cursor
+    {
+        RunPtr run;
+        size_t block;
+        std::string buffer;
+        std::istringstream in;
+        typename Memtable::iterator memIt;
+        typename Memtable::iterator memEnd;
+        bool valid;
+        Key key;
+        LSMEntry<Value> entry;
+
+        void seek(const Key* lo);
+        void next();
+        bool decode();
+    };
+
+    struct RunBuilder
+    {
+        std::string path;
+        std::ofstream out;
+        uint64_t offset;
+        uint64_t blockStart;
+        uint64_t count;
+        std::vector<Key> fenceKeys;
+        std::vector<uint64_t> fenceOffsets;
+        BloomFilter bloom;
+    };
+
+    void flushLocked(std::unique_lock<std::mutex>& lock, size_t atLeast);
+    void beginRun(RunBuilder& builder, const std::string& path, size_t expected) const;
+    static void addToRun(RunBuilder& builder, const Key& key, const LSMEntry<Value>& entry);
+    RunPtr finishRun(RunBuilder& builder, uint64_t seq, int level) const;
+    RunPtr openRun(const std::string& path, uint64_t seq, int level) const;
+    static bool findInRun(const Run& run, const Key& key, LSMEntry<Value>& entry);
+    template<typename Fn>
+    static void merge(std::vector<Cursor*>& cursors, const Key* hi, bool dropTombstones, Fn emit);
+
+    void compactionLoop();
+    bool pickCompaction(std::vector<RunPtr>& inputs, int& level, bool& dropTombstones) const;
+    void compact(const std::vector<RunPtr>& inputs, int level, bool dropTombstones);
+    void addRun(const RunPtr& run);
+    std::string runPath(uint64_t seq, int level) const;
+    static void syncPath(const std::string& path);
+
+    std::string dir_;
+    std::shared_ptr<Memtable> memtable_;
+    // The memtable being written out as a run, or null
+    std::shared_ptr<Memtable> frozen_;
+    // Newest first: by seq, then by level
+    std::vector<RunPtr> runs_;
+    uint64_t nextSeq_;
+    size_t memtableLimit_;
+    size_t fanout_;
+    double bitsPerKey_;
+
+    // Guards the memtables, runs_ and the settings above
+    mutable std::mutex mutex_;
+    std::condition_variable frozenDone_;
+    std::condition_variable compactionWanted_;
+    std::condition_variable compactionDone_;
+    bool compacting_;
+    bool stopping_;
+    std::thread compactor_;
+
+    mutable std::atomic<size_t> bloomSkips_;
+    mutable std::atomic<size_t> blockReads_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the LSMTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Opens or creates the store in dir and starts the compaction thread.
+*/
+template<class Key, class Value>
+LSMTree<Key, Value>::LSMTree(const std::string& dir) :
+    dir_(dir), memtable_(new Memtable()), nextSeq_(1), memtableLimit_(1 << 16), fanout_(4), bitsPerKey_(10),
+    compacting_(false), stopping_(false), bloomSkips_(0), blockReads_(0)
+{
+    if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create " + dir_);
+    }
+    DIR* d = ::opendir(dir_.c_str());
+    if (d == nullptr) throw std::runtime_error("Cannot read " + dir_);
+    while (struct dirent* entry = ::readdir(d)) {
+        unsigned long long seq;
+        int level;
+        int used = 0;
+        if (std::sscanf(entry->d_name, "run-%llu-%d.sst%n", &seq, &level, &used) == 2 &&
+            entry->d_name[used] == '\0') {
+            runs_.push_back(openRun(dir_ + "/" + entry->d_name, seq, level));
+            nextSeq_ = std::max<uint64_t>(nextSeq_, seq + 1);
+        }
+        else if (std::string(entry->d_name).find(".tmp") != std::string::npos) {
+            // an unfinished flush or compaction
+            ::unlink((dir_ + "/" + entry->d_name).c_str());
+        }
+    }
+    ::closedir(d);
+    std::vector<RunPtr> found;
+    found.swap(runs_);
+    for (size_t i = 0; i < found.size(); i++) {
+        // a compaction output takes the newest seq of its inputs, so a run
+        // with a deeper run at the same or a later seq was one of them
+        bool merged = false;
+        for (size_t j = 0; j < found.size() && !merged; j++) {
+            merged = found[j]->level > found[i]->level && found[j]->seq >= found[i]->seq;
+        }
+        if (merged) {
+            found[i]->obsolete = true;
+            continue;
+        }
+        addRun(found[i]);
+    }
+    compactor_ = std::thread(&LSMTree<Key, Value>::compactionLoop, this);
+}
+
+/**
+* Stops compaction and flushes the memtable.
+*/
+template<class Key, class Value>
+LSMTree<Key, Value>::~LSMTree()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    compactionWanted_.notify_all();
+    compactor_.join();
+    try {
+        flush();
+    }
+    catch (...) {
+        // nothing to report to from a destructor
+    }
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::insert(const std::pair<const Key, Value>& item)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    memtable_->insert(std::make_pair(item.first, LSMEntry<Value>(item.second, false)));
+    if (memtable_->size() >= memtableLimit_) {
+        flushLocked(lock, memtableLimit_);
+    }
+}
+
+/**
+* Records a deletion; older versions in the runs stay hidden until a
+* compaction drops them.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    memtable_->insert(std::make_pair(key, LSMEntry<Value>(Value(), true)));
+    if (memtable_->size() >= memtableLimit_) {
+        flushLocked(lock, memtableLimit_);
+    }
+}
+
+/**
+* Copies the newest value for key into value. Returns false if key is
+* absent or deleted. Runs are searched without holding the lock.
+*/
+template<class Key, class Value>
+bool LSMTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::vector<RunPtr> runs;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int m = 0; m < 2; m++) {
+            Memtable* table = (m == 0) ? memtable_.get() : frozen_.get();
+            if (table == nullptr) {
+                continue;
+            }
+            typename Memtable::iterator it = table->find(key);
+            if (it != table->end()) {
+                if (it->second.tombstone) {
+                    return false;
+                }
+                value = it->second.value;
+                return true;
+            }
+        }
+        runs = runs_;
+    }
+
+    uint64_t hash = bloomHash(key);
+    LSMEntry<Value> entry;
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (!runs[i]->bloom.mayContain(hash)) {
+            bloomSkips_++;
+            continue;
+        }
+        blockReads_++;
+        if (findInRun(*runs[i], key, entry)) {
+            if (entry.tombstone) {
+                return false;
+            }
+            value = entry.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Calls fn(key, value) for every live key in [lo, hi), in order. Writers
+* wait while a scan runs.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void LSMTree<Key, Value>::scan(const Key& lo, const Key& hi, Fn fn) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // cursors 0 and 1 are the memtable and the frozen one, then the runs
+    // from newest to oldest
+    std::vector<Cursor> cursors(runs_.size() + 2);
+    std::vector<Cursor*> order;
+    for (int m = 0; m < 2; m++) {
+        Memtable* table = (m == 0) ? memtable_.get() : frozen_.get();
+        if (table != nullptr) {
+            cursors[m].memIt = table->lower_bound(lo);
+            cursors[m].memEnd = table->end();
+            cursors[m].seek(nullptr);
+            order.push_back(&cursors[m]);
+        }
+    }
+    for (size_t i = 0; i < runs_.size(); i++) {
+        cursors[i + 2].run = runs_[i];
+        cursors[i + 2].seek(&lo);
+        order.push_back(&cursors[i + 2]);
+    }
+    merge(order, &hi, true, [&fn](const Key& key, const LSMEntry<Value>& entry) {
+        fn(key, entry.value);
+    });
+}
+
+/**
+* Writes the memtable out as a level-0 run.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushLocked(lock, 1);
+}
+
+/**
+* Blocks until no level is due for compaction.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::waitForCompaction()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<RunPtr> inputs;
+    int level;
+    bool drop;
+    while (compacting_ || pickCompaction(inputs, level, drop)) {
+        compactionWanted_.notify_all();
+        compactionDone_.wait(lock);
+    }
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::setMemtableLimit(size_t entries)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    memtableLimit_ = std::max<size_t>(entries, 1);
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::setFanout(size_t runs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    fanout_ = std::max<size_t>(runs, 2);
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::setBitsPerKey(double bits)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bitsPerKey_ = bits;
+}
+
+template<class Key, class Value>
+size_t LSMTree<Key, Value>::runCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return runs_.size();
+}
+
+/**
+* Run probes answered by a Bloom filter without reading the run.
+*/
+template<class Key, class Value>
+size_t LSMTree<Key, Value>::bloomSkips() const
+{
+    return bloomSkips_;
+}
+
+template<class Key, class Value>
+size_t LSMTree<Key, Value>::blockReads() const
+{
+    return blockReads_;
+}
+
+/**
+* Freezes the memtable once it holds atLeast entries and writes it out
+* in a single in-order walk. Called with lock held on mutex_; the lock is
+* dropped while the run is written, so writers fill a fresh memtable
+* meanwhile. One memtable is frozen at a time: a writer that fills the
+* next one first waits here. If the run cannot be written, the frozen
+* entries go back under the newer ones and the error is rethrown.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::flushLocked(std::unique_lock<std::mutex>& lock, size_t atLeast)
+{
+    while (frozen_) {
+        frozenDone_.wait(lock);
+    }
+    if (memtable_->empty() || memtable_->size() < atLeast) {
+        return;
+    }
+    frozen_ = memtable_;
+    memtable_.reset(new Memtable());
+    uint64_t seq = nextSeq_++;
+    try {
+        RunBuilder builder;
+        beginRun(builder, runPath(seq, 0), frozen_->size());
+        lock.unlock();
+        for (typename Memtable::iterator it = frozen_->begin(); it != frozen_->end(); ++it) {
+            addToRun(builder, it->first, it->second);
+        }
+        RunPtr run = finishRun(builder, seq, 0);
+        lock.lock();
+        addRun(run);
+    }
+    catch (...) {
+        if (!lock.owns_lock()) {
+            lock.lock();
+        }
+        for (typename Memtable::iterator it = frozen_->begin(); it != frozen_->end(); ++it) {
+            if (memtable_->find(it->first) == memtable_->end()) {
+                memtable_->insert(std::make_pair(it->first, it->second));
+            }
+        }
+        frozen_.reset();
+        frozenDone_.notify_all();
+        throw;
+    }
+    frozen_.reset();
+    frozenDone_.notify_all();
+    compactionWanted_.notify_all();
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::beginRun(RunBuilder& builder, const std::string& path, size_t expected) const
+{
+    builder.path = path;
+    builder.out.open((path + ".tmp").c_str(), std::ios::binary | std::ios::trunc);
+    if (!builder.out) throw std::runtime_error("Cannot open " + path + ".tmp");
+    builder.out.write(LSM_RUN_MAGIC, sizeof(LSM_RUN_MAGIC));
+    builder.offset = sizeof(LSM_RUN_MAGIC);
+    builder.blockStart = 0;
+    builder.count = 0;
+    builder.bloom.reset(expected, bitsPerKey_);
+}
+
+/**
+* Appends one record; keys must arrive in increasing order.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::addToRun(RunBuilder& builder, const Key& key, const LSMEntry<Value>& entry)
+{
+    if (builder.fenceKeys.empty() || builder.offset - builder.blockStart >= BLOCK_BYTES) {
+        builder.fenceKeys.push_back(key);
+        builder.fenceOffsets.push_back(builder.offset);
+        builder.blockStart = builder.offset;
+    }
+    std::ostringstream record;
+    record.put(entry.tombstone ? 1 : 0);
+    SnapshotTraits<Key>::write(record, key);
+    if (!entry.tombstone) {
+        SnapshotTraits<Value>::write(record, entry.value);
+    }
+    std::string bytes = record.str();
+    builder.out.write(bytes.data(), bytes.size());
+    builder.offset += bytes.size();
+    builder.bloom.add(bloomHash(key));
+    builder.count++;
+}
+
+/**
+* Writes the fence index, filter and footer, syncs the file and renames
+* it into place.
+*/
+template<class Key, class Value>
+typename LSMTree<Key, Value>::RunPtr LSMTree<Key, Value>::finishRun(RunBuilder& builder, uint64_t seq, int level) const
+{
+    uint64_t dataEnd = builder.offset;
+    uint64_t fences = builder.fenceKeys.size();
+    builder.out.write(reinterpret_cast<const char*>(&fences), sizeof(fences));
+    for (size_t i = 0; i < builder.fenceKeys.size(); i++) {
+        SnapshotTraits<Key>::write(builder.out, builder.fenceKeys[i]);
+        builder.out.write(reinterpret_cast<const char*>(&builder.fenceOffsets[i]), sizeof(uint64_t));
+    }
+    builder.bloom.write(builder.out);
+    uint64_t footer[3] = { builder.count, dataEnd, dataEnd };
+    builder.out.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+    builder.out.write(LSM_RUN_MAGIC, sizeof(LSM_RUN_MAGIC));
+    builder.out.close();
+    if (!builder.out) throw std::runtime_error("Error writing " + builder.path + ".tmp");
+    syncPath(builder.path + ".tmp");
+    if (std::rename((builder.path + ".tmp").c_str(), builder.path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename " + builder.path + ".tmp");
+    }
+    syncPath(dir_);
+    return openRun(builder.path, seq, level);
+}
+
+/**
+* Loads a run's footer, fence index and filter; records stay on disk.
+*/
+template<class Key, class Value>
+typename LSMTree<Key, Value>::RunPtr LSMTree<Key, Value>::openRun(const std::string& path, uint64_t seq, int level) const
+{
+    RunPtr run(new Run());
+    run->seq = seq;
+    run->level = level;
+    run->path = path;
+    std::ifstream in(path.c_str(), std::ios::binary);
+    uint64_t footer[3];
+    char magic[sizeof(LSM_RUN_MAGIC)];
+    in.seekg(-(std::streamoff)(sizeof(footer) + sizeof(magic)), std::ios::end);
+    in.read(reinterpret_cast<char*>(footer), sizeof(footer));
+    in.read(magic, sizeof(magic));
+    if (!in || !std::equal(magic, magic + sizeof(magic), LSM_RUN_MAGIC)) {
+        throw std::runtime_error("Not a run file: " + path);
+    }
+    run->count = footer[0];
+    run->dataEnd = footer[1];
+    in.seekg((std::streamoff)footer[2]);
+    uint64_t fences = 0;
+    in.read(reinterpret_cast<char*>(&fences), sizeof(fences));
+    for (uint64_t i = 0; i < fences && in; i++) {
+        run->fenceKeys.push_back(SnapshotTraits<Key>::read(in));
+        uint64_t offset = 0;
+        in.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+        run->fenceOffsets.push_back(offset);
+    }
+    if (!in || !run->bloom.read(in)) {
+        throw std::runtime_error("Corrupt run file: " + path);
+    }
+    run->fd = ::open(path.c_str(), O_RDONLY);
+    if (run->fd < 0) throw std::runtime_error("Cannot open " + path);
+    return run;
+}
+
+/**
+* Reads the one block that could hold key.
+*/
+template<class Key, class Value>
+bool LSMTree<Key, Value>::findInRun(const Run& run, const Key& key, LSMEntry<Value>& entry)
+{
+    if (run.fenceKeys.empty() || key < run.fenceKeys[0]) {
+        return false;
+    }
+    std::string buffer;
+    run.readBlock(run.blockFor(key), buffer);
+    std::istringstream in(buffer);
+    while (in.peek() != std::char_traits<char>::eof()) {
+        bool tombstone = in.get() != 0;
+        Key k = SnapshotTraits<Key>::read(in);
+        if (!tombstone) {
+            entry.value = SnapshotTraits<Value>::read(in);
+        }
+        if (!in || key < k) {
+            return false;
+        }
+        if (!(k < key)) {
+            entry.tombstone = tombstone;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Repeatedly takes the smallest key over all cursors. The cursor listed
+* first wins ties, so cursors must come newest first; the others with the
+* same key are stepped past it.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void LSMTree<Key, Value>::merge(std::vector<Cursor*>& cursors, const Key* hi, bool dropTombstones, Fn emit)
+{
+    struct Later
+    {
+        const std::vector<Cursor*>* cursors;
+        bool operator()(size_t a, size_t b) const
+        {
+            const Key& ka = (*cursors)[a]->key;
+            const Key& kb = (*cursors)[b]->key;
+            if (ka < kb) return false;
+            if (kb < ka) return true;
+            return a > b;
+        }
+    };
+    Later later = { &cursors };
+    std::priority_queue<size_t, std::vector<size_t>, Later> heap(later);
+    for (size_t i = 0; i < cursors.size(); i++) {
+        if (cursors[i]->valid) {
+            heap.push(i);
+        }
+    }
+    while (!heap.empty()) {
+        size_t top = heap.top();
+        heap.pop();
+        Cursor* c = cursors[top];
+        if (hi != nullptr && !(c->key < *hi)) {
+            break;
+        }
+        if (!(dropTombstones && c->entry.tombstone)) {
+            emit(c->key, c->entry);
+        }
+        Key key = c->key;
+        while (!heap.empty() && !(key < cursors[heap.top()]->key)) {
+            size_t shadowed = heap.top();
+            heap.pop();
+            cursors[shadowed]->next();
+            if (cursors[shadowed]->valid) {
+                heap.push(shadowed);
+            }
+        }
+        c->next();
+        if (c->valid) {
+            heap.push(top);
+        }
+    }
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::compactionLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        std::vector<RunPtr> inputs;
+        int level;
+        bool dropTombstones;
+        if (!pickCompaction(inputs, level, dropTombstones)) {
+            compactionDone_.notify_all();
+            compactionWanted_.wait(lock);
+            continue;
+        }
+        compacting_ = true;
+        lock.unlock();
+        try {
+            compact(inputs, level, dropTombstones);
+        }
+        catch (...) {
+            // the inputs stay in place; try again after the next flush
+            lock.lock();
+            compacting_ = false;
+            compactionDone_.notify_all();
+            if (!stopping_) {
+                compactionWanted_.wait(lock);
+            }
+            continue;
+        }
+        lock.lock();
+        compacting_ = false;
+        compactionDone_.notify_all();
+    }
+}
+
+/**
+* Picks the lowest level holding fanout_ runs. Deletions can be dropped
+* when nothing lives below that level. Called with mutex_ held.
+*/
+template<class Key, class Value>
+bool LSMTree<Key, Value>::pickCompaction(std::vector<RunPtr>& inputs, int& level, bool& dropTombstones) const
+{
+    int deepest = -1;
+    std::vector<size_t> perLevel;
+    for (size_t i = 0; i < runs_.size(); i++) {
+        int l = runs_[i]->level;
+        deepest = std::max(deepest, l);
+        if ((size_t)l >= perLevel.size()) {
+            perLevel.resize(l + 1, 0);
+        }
+        perLevel[l]++;
+    }
+    for (size_t l = 0; l < perLevel.size(); l++) {
+        if (perLevel[l] >= fanout_) {
+            inputs.clear();
+            for (size_t i = 0; i < runs_.size(); i++) {
+                if (runs_[i]->level == (int)l) {
+                    inputs.push_back(runs_[i]);
+                }
+            }
+            level = (int)l;
+            dropTombstones = (deepest == (int)l);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Merges inputs (newest first) into one run on the next level, then swaps
+* it in. Readers holding the old runs keep using them; their files are
+* deleted when the last reference goes.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::compact(const std::vector<RunPtr>& inputs, int level, bool dropTombstones)
+{
+    uint64_t seq = 0;
+    size_t expected = 0;
+    std::vector<Cursor> cursors(inputs.size());
+    std::vector<Cursor*> order;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        seq = std::max(seq, inputs[i]->seq);
+        expected += inputs[i]->count;
+        cursors[i].run = inputs[i];
+        cursors[i].seek(nullptr);
+        order.push_back(&cursors[i]);
+    }
+
+    RunBuilder builder;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        beginRun(builder, runPath(seq, level + 1), expected);
+    }
+    merge(order, nullptr, dropTombstones, [&builder](const Key& key, const LSMEntry<Value>& entry) {
+        addToRun(builder, key, entry);
+    });
+    RunPtr output = finishRun(builder, seq, level + 1);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<RunPtr> kept;
+    for (size_t i = 0; i < runs_.size(); i++) {
+        if (std::find(inputs.begin(), inputs.end(), runs_[i]) == inputs.end()) {
+            kept.push_back(runs_[i]);
+        }
+        else {
+            runs_[i]->obsolete = true;
+        }
+    }
+    runs_.swap(kept);
+    addRun(output);
+}
+
+/**
+* Inserts run keeping runs_ newest first.
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::addRun(const RunPtr& run)
+{
+    typename std::vector<RunPtr>::iterator pos = runs_.begin();
+    while (pos != runs_.end() &&
+           ((*pos)->seq > run->seq || ((*pos)->seq == run->seq && (*pos)->level > run->level))) {
+        ++pos;
+    }
+    runs_.insert(pos, run);
+}
+
+template<class Key, class Value>
+std::string LSMTree<Key, Value>::runPath(uint64_t seq, int level) const
+{
+    std::ostringstream path;
+    path << dir_ << "/run-" << seq << "-" << level << ".sst";
+    return path.str();
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::syncPath(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    int synced = ::fsync(fd);
+    ::close(fd);
+    if (synced != 0) {
+        throw std::runtime_error("Cannot sync " + path);
+    }
+}
+
+/*
+  -----------------------------------------------
+  Begin implementations for Run and Cursor.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+LSMTree<Key, Value>::Run::~Run()
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (obsolete) {
+        ::unlink(path.c_str());
+    }
+}
+
+/**
+* Index of the last block whose first key is <= key.
+*/
+template<class Key, class Value>
+size_t LSMTree<Key, Value>::Run::blockFor(const Key& key) const
+{
+    typename std::vector<Key>::const_iterator it = std::upper_bound(fenceKeys.begin(), fenceKeys.end(), key);
+    return (it == fenceKeys.begin()) ? 0 : (size_t)(it - fenceKeys.begin()) - 1;
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::Run::readBlock(size_t block, std::string& out) const
+{
+    uint64_t start = fenceOffsets[block];
+    uint64_t end = (block + 1 < fenceOffsets.size()) ? fenceOffsets[block + 1] : dataEnd;
+    out.resize((size_t)(end - start));
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = ::pread(fd, &out[done], out.size() - done, (off_t)(start + done));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Cannot read " + path);
+        }
+        done += (size_t)n;
+    }
+}
+
+/**
+* Positions the cursor on the first key >= *lo (or the first key).
+*/
+template<class Key, class Value>
+void LSMTree<Key, Value>::Cursor::seek(const Key* lo)
+{
+    if (!run) {
+        // the memtable cursor was positioned by lower_bound
+        valid = (memIt != memEnd);
+        if (valid) {
+            key = memIt->first;
+            entry = memIt->second;
+        }
+        return;
+    }
+    valid = !run->fenceKeys.empty();
+    if (!valid) {
+        return;
+    }
+    block = (lo == nullptr) ? 0 : run->blockFor(*lo);
+    run->readBlock(block, buffer);
+    in.str(buffer);
+    in.clear();
+    next();
+    while (valid && lo != nullptr && key < *lo) {
+        next();
+    }
+}
+
+template<class Key, class Value>
+void LSMTree<Key, Value>::Cursor::next()
+{
+    if (!run) {
+        ++memIt;
+        valid = (memIt != memEnd);
+        if (valid) {
+            key = memIt->first;
+            entry = memIt->second;
+        }
+        return;
+    }
+    if (decode()) {
+        return;
+    }
+    // end of this block
+    if (++block >= run->fenceOffsets.size()) {
+        valid = false;
+        return;
+    }
+    run->readBlock(block, buffer);
+    in.str(buffer);
+    in.clear();
+    valid = decode();
+}
+
+template<class Key, class Value>
+bool LSMTree<Key, Value>::Cursor::decode()
+{
+    if (in.peek() == std::char_traits<char>::eof()) {
+        return false;
+    }
+    entry.tombstone = in.get() != 0;
+    key = SnapshotTraits<Key>::read(in);
+    entry.value = entry.tombstone ? Value() : SnapshotTraits<Value>::read(in);
+    if (!in) {
+        throw std::runtime_error("Corrupt run file: " + run->path);
+    }
+    valid = true;
+    return true;
+}
+
+#endif
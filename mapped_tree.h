@@ -0,0 +1,464 @@
+#ifndef MAPPED_TREE_H
+#define MAPPED_TREE_H
+
+#include <iterator>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bst.h"
+
+/*
+  On-disk layout written by MappedTree::write, host byte order:
+
+    MappedTreeHeader                   64 bytes
+    MappedRecord<Key, Value>[count]    Eytzinger order
+
+  Record k (1-based) has its children at 2k and 2k + 1, so the file holds
+  no pointers and the top levels of every search share the first pages.
+*/
+struct MappedTreeHeader
+{
+    char magic[8];
+    uint64_t count;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t recordSize;
+    uint32_t reserved;
+    char padding[32];
+};
+
+static const char MAPPED_TREE_MAGIC[8] = { 'A', 'V', 'L', 'M', 'A', 'P', '0', '1' };
+
+/**
+* One item as stored in the file. The member names match std::pair so
+* iterators read like the ones of BinarySearchTree.
+*/
+template <typename Key, typename Value>
+struct MappedRecord
+{
+    Key first;
+    Value second;
+};
+
+/**
+* A read-only tree queried straight from an mmapped file. Opening it is
+* O(1): nothing is read until a query touches the pages, and processes
+* mapping the same file share the page cache. Key and Value must be
+* trivially copyable, since records are used in place.
+*/
+template <typename Key, typename Value>
+class MappedTree
+{
+public:
+    typedef MappedRecord<Key, Value> Record;
+
+    explicit MappedTree(const std::string& path);
+    ~MappedTree();
+
+    static void write(const BinarySearchTree<Key, Value>& tree, const std::string& path);
+
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Record value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Record* pointer;
+        typedef const Record& reference;
+
+        const_iterator();
+
+        const Record& operator*() const;
+        const Record* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class MappedTree<Key, Value>;
+        const_iterator(size_t index, const MappedTree<Key, Value>* tree);
+        size_t index_;
+        const MappedTree<Key, Value>* tree_;
+    };
+    typedef const_iterator iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+
+private:
+    // Not copyable: the mapping is owned
+    MappedTree(const MappedTree&);
+    MappedTree& operator=(const MappedTree&);
+
+    const Record& record(size_t k) const;
+    size_t lowerBoundIndex(const Key& key) const;
+    static size_t firstIndex(size_t count);
+    static size_t lastIndex(size_t count);
+    static size_t nextIndex(size_t k, size_t count);
+    static size_t prevIndex(size_t k, size_t count);
+
+    void* map_;
+    size_t mapBytes_;
+    const Record* records_;
+    size_t count_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the MappedTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Maps the file read-only and checks its header. Throws std::runtime_error
+* if the file cannot be mapped or was written for other Key/Value types.
+*/
+template<class Key, class Value>
+MappedTree<Key, Value>::MappedTree(const std::string& path) :
+    map_(nullptr), mapBytes_(0), records_(nullptr), count_(0)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedTree needs trivially copyable keys and values");
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MappedTreeHeader)) {
+        ::close(fd);
+        throw std::runtime_error("Not a mapped tree: " + path);
+    }
+    mapBytes_ = (size_t)st.st_size;
+    map_ = ::mmap(nullptr, mapBytes_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw std::runtime_error("Cannot map " + path);
+    }
+
+    const MappedTreeHeader* header = static_cast<const MappedTreeHeader*>(map_);
+    if (std::memcmp(header->magic, MAPPED_TREE_MAGIC, sizeof(MAPPED_TREE_MAGIC)) != 0 ||
+        header->keySize != sizeof(Key) || header->valueSize != sizeof(Value) ||
+        header->recordSize != sizeof(Record) ||
+        header->count > (mapBytes_ - sizeof(MappedTreeHeader)) / sizeof(Record)) {
+        ::munmap(map_, mapBytes_);
+        map_ = nullptr;
+        throw std::runtime_error("Not a mapped tree for these types: " + path);
+    }
+    count_ = (size_t)header->count;
+    records_ = reinterpret_cast<const Record*>(static_cast<const char*>(map_) + sizeof(MappedTreeHeader));
+}
+
+template<class Key, class Value>
+MappedTree<Key, Value>::~MappedTree()
+{
+    if (map_ != nullptr) {
+        ::munmap(map_, mapBytes_);
+    }
+}
+
+/**
+* Writes tree to path. The file is sized up front and filled through a
+* writable mapping: the tree is walked in order while the Eytzinger slots
+* are visited in order, so no intermediate copy is made. The records go to
+* path + ".tmp", which is synced and renamed over path, so processes that
+* still map the old file keep reading it instead of having it truncated
+* under them.
+*/
+template<class Key, class Value>
+void MappedTree<Key, Value>::write(const BinarySearchTree<Key, Value>& tree, const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedTree needs trivially copyable keys and values");
+
+    size_t count = tree.size();
+    size_t bytes = sizeof(MappedTreeHeader) + count * sizeof(Record);
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot open " + tmp + " for writing");
+    if (::ftruncate(fd, (off_t)bytes) != 0) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("Cannot size " + tmp);
+    }
+    void* map = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("Cannot map " + tmp);
+    }
+
+    MappedTreeHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAPPED_TREE_MAGIC, sizeof(MAPPED_TREE_MAGIC));
+    header.count = count;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.recordSize = sizeof(Record);
+    std::memcpy(map, &header, sizeof(header));
+
+    Record* records = reinterpret_cast<Record*>(static_cast<char*>(map) + sizeof(MappedTreeHeader));
+    size_t k = firstIndex(count);
+    for (typename BinarySearchTree<Key, Value>::const_iterator it = tree.cbegin(); it != tree.cend(); ++it) {
+        Record& r = records[k - 1];
+        std::memcpy(&r.first, &it->first, sizeof(Key));
+        std::memcpy(&r.second, &it->second, sizeof(Value));
+        k = nextIndex(k, count);
+    }
+
+    bool synced = ::msync(map, bytes, MS_SYNC) == 0;
+    ::munmap(map, bytes);
+    synced = ::fsync(fd) == 0 && synced;
+    ::close(fd);
+    if (!synced) {
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("Error writing " + tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("Cannot rename " + tmp);
+    }
+
+    // make the rename itself durable
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(dir.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+template<class Key, class Value>
+const typename MappedTree<Key, Value>::Record& MappedTree<Key, Value>::record(size_t k) const
+{
+    return records_[k - 1];
+}
+
+/**
+* Branch-free descent: every step goes to 2k or 2k + 1, and the slots
+* four levels below are prefetched so their cache line is already on its
+* way. At the bottom, the lowest zero bit of k marks the
+* last left turn, which is the answer (0 = past the end).
+*/
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::lowerBoundIndex(const Key& key) const
+{
+    size_t k = 1;
+    while (k <= count_) {
+        if (16 * k <= count_) {
+            BST_PREFETCH(&records_[16 * k - 1]);
+        }
+        k = 2 * k + (record(k).first < key ? 1 : 0);
+    }
+    return k >> (__builtin_ctzll(~(unsigned long long)k) + 1);
+}
+
+/**
+* Leftmost slot: keep taking left children.
+*/
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::firstIndex(size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    size_t k = 1;
+    while (2 * k <= count) {
+        k = 2 * k;
+    }
+    return k;
+}
+
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::lastIndex(size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    size_t k = 1;
+    while (2 * k + 1 <= count) {
+        k = 2 * k + 1;
+    }
+    return k;
+}
+
+/**
+* In-order successor: the leftmost slot of the right subtree if there is
+* one, otherwise the parent of the nearest ancestor reached from the left.
+*/
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::nextIndex(size_t k, size_t count)
+{
+    if (2 * k + 1 <= count) {
+        k = 2 * k + 1;
+        while (2 * k <= count) {
+            k = 2 * k;
+        }
+        return k;
+    }
+    return k >> (__builtin_ctzll(~(unsigned long long)k) + 1);
+}
+
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::prevIndex(size_t k, size_t count)
+{
+    if (2 * k <= count) {
+        k = 2 * k;
+        while (2 * k + 1 <= count) {
+            k = 2 * k + 1;
+        }
+        return k;
+    }
+    return k >> (__builtin_ctzll((unsigned long long)k) + 1);
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator MappedTree<Key, Value>::begin() const
+{
+    return const_iterator(firstIndex(count_), this);
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator MappedTree<Key, Value>::end() const
+{
+    return const_iterator(0, this);
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator MappedTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundIndex(key), this);
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator MappedTree<Key, Value>::find(const Key& key) const
+{
+    size_t k = lowerBoundIndex(key);
+    if (k == 0 || key < record(k).first) {
+        return end();
+    }
+    return const_iterator(k, this);
+}
+
+template<class Key, class Value>
+const Value& MappedTree<Key, Value>::operator[](const Key& key) const
+{
+    size_t k = lowerBoundIndex(key);
+    if (k == 0 || key < record(k).first) throw std::out_of_range("Invalid key");
+    return record(k).second;
+}
+
+template<class Key, class Value>
+size_t MappedTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+template<class Key, class Value>
+bool MappedTree<Key, Value>::empty() const
+{
+    return count_ == 0;
+}
+
+/*
+  -----------------------------------------------
+  Begin implementations for the const_iterator class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+MappedTree<Key, Value>::const_iterator::const_iterator() :
+    index_(0), tree_(nullptr)
+{
+
+}
+
+template<class Key, class Value>
+MappedTree<Key, Value>::const_iterator::const_iterator(size_t index, const MappedTree<Key, Value>* tree) :
+    index_(index), tree_(tree)
+{
+
+}
+
+template<class Key, class Value>
+const typename MappedTree<Key, Value>::Record&
+MappedTree<Key, Value>::const_iterator::operator*() const
+{
+    return tree_->record(index_);
+}
+
+template<class Key, class Value>
+const typename MappedTree<Key, Value>::Record*
+MappedTree<Key, Value>::const_iterator::operator->() const
+{
+    return &tree_->record(index_);
+}
+
+template<class Key, class Value>
+bool MappedTree<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<class Key, class Value>
+bool MappedTree<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator&
+MappedTree<Key, Value>::const_iterator::operator++()
+{
+    index_ = nextIndex(index_, tree_->count_);
+    return *this;
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator
+MappedTree<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Decrementing end() gives the last item.
+*/
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator&
+MappedTree<Key, Value>::const_iterator::operator--()
+{
+    index_ = (index_ == 0) ? lastIndex(tree_->count_) : prevIndex(index_, tree_->count_);
+    return *this;
+}
+
+template<class Key, class Value>
+typename MappedTree<Key, Value>::const_iterator
+MappedTree<Key, Value>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+#endif
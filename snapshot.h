@@ -0,0 +1,72 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdint>
+
+/*
+  SnapshotTraits<T> tells AVLTree::save/load how to put a key or value on
+  disk:
+
+    static void write(std::ostream& out, const T& value);
+    static T read(std::istream& in);
+
+  read must consume exactly what write produced. The default handles
+  trivially copyable types by copying their bytes in host byte order, so
+  snapshots are only portable between machines of the same endianness and
+  ABI. Specialize it for anything that owns memory.
+*/
+template <typename T>
+struct SnapshotTraits
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SnapshotTraits must be specialized for this type");
+
+    static void write(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static T read(std::istream& in)
+    {
+        T value;
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+};
+
+/**
+* Strings are stored as a 64-bit length followed by the bytes.
+*/
+template <>
+struct SnapshotTraits<std::string>
+{
+    static void write(std::ostream& out, const std::string& value)
+    {
+        uint64_t length = value.size();
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(value.data(), value.size());
+    }
+    static std::string read(std::istream& in)
+    {
+        uint64_t length = 0;
+        in.read(reinterpret_cast<char*>(&length), sizeof(length));
+        if (!in) {
+            return std::string();
+        }
+        std::string value;
+        // grow as the bytes arrive so a corrupt length cannot force a huge allocation
+        char buffer[4096];
+        while (length > 0 && in) {
+            size_t chunk = (length < sizeof(buffer)) ? (size_t)length : sizeof(buffer);
+            in.read(buffer, chunk);
+            value.append(buffer, (size_t)in.gcount());
+            length -= chunk;
+        }
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef TIMED_TREE_H
+#define TIMED_TREE_H
+
+#include <iostream>
+#include <stdexcept>
+#include "avlbst.h"
+#include "latency_histogram.h"
+
+/**
+* A tree that records how long its operations take. Tree is the engine
+* to measure (AVLTree by default, or BinarySearchTree); insert, remove,
+* find and forEach are timed into one LatencyHistogram each. A remove
+* that cascades through removeFix shows up in the tail of removeLatency().
+*
+* With setSampleRate(n) only every n-th call of each operation is timed,
+* which keeps the clock reads off the fast path; the others run untimed.
+*/
+template <typename Key, typename Value, template <typename, typename> class Tree = AVLTree>
+class TimedTree : public Tree<Key, Value>
+{
+public:
+    typedef typename Tree<Key, Value>::iterator iterator;
+
+    TimedTree();
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair) override;
+    virtual void remove(const Key& key) override;
+    using Tree<Key, Value>::find;
+    iterator find(const Key& key) const;
+
+    // Visits every item in order, timing each step of the iteration
+    template <typename Visit>
+    void forEach(Visit visit);
+
+    void setSampleRate(unsigned every);
+    unsigned getSampleRate() const;
+
+    const LatencyHistogram& insertLatency() const;
+    const LatencyHistogram& removeLatency() const;
+    const LatencyHistogram& findLatency() const;
+    const LatencyHistogram& iterateLatency() const;
+    void resetLatency();
+
+    void writeLatencyText(std::ostream& out) const;
+    void writeLatencyJson(std::ostream& out) const;
+
+private:
+    // Counts down to the next timed call of one operation
+    bool sampleNow(unsigned& countdown) const;
+
+    unsigned sampleEvery_;
+    unsigned untilInsert_;
+    unsigned untilRemove_;
+    mutable unsigned untilFind_;
+    unsigned untilIterate_;
+    LatencyHistogram insertLatency_;
+    LatencyHistogram removeLatency_;
+    mutable LatencyHistogram findLatency_;
+    LatencyHistogram iterateLatency_;
+};
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+TimedTree<Key, Value, Tree>::TimedTree() :
+    Tree<Key, Value>(), sampleEvery_(1), untilInsert_(1), untilRemove_(1),
+    untilFind_(1), untilIterate_(1)
+{
+
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+bool TimedTree<Key, Value, Tree>::sampleNow(unsigned& countdown) const
+{
+    if (--countdown != 0) {
+        return false;
+    }
+    countdown = sampleEvery_;
+    return true;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (!sampleNow(untilInsert_)) {
+        Tree<Key, Value>::insert(keyValuePair);
+        return;
+    }
+    uint64_t start = LatencyClock::now();
+    Tree<Key, Value>::insert(keyValuePair);
+    insertLatency_.record(LatencyClock::toNanos(LatencyClock::now() - start));
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::remove(const Key& key)
+{
+    if (!sampleNow(untilRemove_)) {
+        Tree<Key, Value>::remove(key);
+        return;
+    }
+    uint64_t start = LatencyClock::now();
+    Tree<Key, Value>::remove(key);
+    removeLatency_.record(LatencyClock::toNanos(LatencyClock::now() - start));
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+typename TimedTree<Key, Value, Tree>::iterator
+TimedTree<Key, Value, Tree>::find(const Key& key) const
+{
+    if (!sampleNow(untilFind_)) {
+        return Tree<Key, Value>::find(key);
+    }
+    uint64_t start = LatencyClock::now();
+    iterator it = Tree<Key, Value>::find(key);
+    findLatency_.record(LatencyClock::toNanos(LatencyClock::now() - start));
+    return it;
+}
+
+/**
+* A step is one iterator increment; visit itself is not timed.
+*/
+template <typename Key, typename Value, template <typename, typename> class Tree>
+template <typename Visit>
+void TimedTree<Key, Value, Tree>::forEach(Visit visit)
+{
+    iterator it = this->begin();
+    while (it != this->end()) {
+        visit(*it);
+        if (!sampleNow(untilIterate_)) {
+            ++it;
+            continue;
+        }
+        uint64_t start = LatencyClock::now();
+        ++it;
+        iterateLatency_.record(LatencyClock::toNanos(LatencyClock::now() - start));
+    }
+}
+
+/**
+* Times one call in every `every` of each operation; 1 times them all.
+*/
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::setSampleRate(unsigned every)
+{
+    if (every == 0) throw std::invalid_argument("Sample rate must be at least 1");
+    sampleEvery_ = every;
+    untilInsert_ = untilRemove_ = untilFind_ = untilIterate_ = every;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+unsigned TimedTree<Key, Value, Tree>::getSampleRate() const
+{
+    return sampleEvery_;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+const LatencyHistogram& TimedTree<Key, Value, Tree>::insertLatency() const
+{
+    return insertLatency_;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+const LatencyHistogram& TimedTree<Key, Value, Tree>::removeLatency() const
+{
+    return removeLatency_;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+const LatencyHistogram& TimedTree<Key, Value, Tree>::findLatency() const
+{
+    return findLatency_;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+const LatencyHistogram& TimedTree<Key, Value, Tree>::iterateLatency() const
+{
+    return iterateLatency_;
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::resetLatency()
+{
+    insertLatency_.reset();
+    removeLatency_.reset();
+    findLatency_.reset();
+    iterateLatency_.reset();
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::writeLatencyText(std::ostream& out) const
+{
+    insertLatency_.writeText(out, "insert");
+    removeLatency_.writeText(out, "remove");
+    findLatency_.writeText(out, "find");
+    iterateLatency_.writeText(out, "iterate");
+}
+
+/**
+* {"sample_rate":n,"insert":{...},"remove":{...},"find":{...},"iterate":{...}}
+*/
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void TimedTree<Key, Value, Tree>::writeLatencyJson(std::ostream& out) const
+{
+    out << "{\"sample_rate\":" << sampleEvery_ << ",\"insert\":";
+    insertLatency_.writeJson(out);
+    out << ",\"remove\":";
+    removeLatency_.writeJson(out);
+    out << ",\"find\":";
+    findLatency_.writeJson(out);
+    out << ",\"iterate\":";
+    iterateLatency_.writeJson(out);
+    out << "}";
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include "avlbst.h"
+#include "snapshot.h"
+
+/*
+  Operation trace format, host byte order:
+
+    char     magic[8]      "BSTTRACE"
+    uint32_t version       1
+    uint8_t  keyKind       TRACE_KEY_SIGNED, TRACE_KEY_UNSIGNED or TRACE_KEY_OTHER
+    uint8_t  keyBytes      sizeof(Key)
+    uint16_t reserved
+    records until end of file:
+        uint8_t  op        a TraceOp
+        key                (not present for TRACE_ITERATE)
+
+  Integer keys are stored as the zigzag varint of their difference from
+  the previous record's key, so clustered or ascending keys take one or
+  two bytes each. Other keys go through SnapshotTraits. Values are not
+  recorded; a replay inserts Value().
+*/
+
+enum TraceOp
+{
+    TRACE_INSERT = 1,
+    TRACE_REMOVE = 2,
+    TRACE_FIND = 3,
+    TRACE_ITERATE = 4
+};
+
+enum TraceKeyKind
+{
+    TRACE_KEY_OTHER = 0,
+    TRACE_KEY_SIGNED = 1,
+    TRACE_KEY_UNSIGNED = 2
+};
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint8_t keyKind;
+    uint8_t keyBytes;
+    uint16_t reserved;
+};
+
+/**
+* Key encoding for traces: delta varints for integers, SnapshotTraits for
+* everything else. prev is the previous key in the same trace.
+*/
+template <typename Key, bool Integral = std::is_integral<Key>::value>
+struct TraceKeyCodec
+{
+    static const uint8_t kind = TRACE_KEY_OTHER;
+
+    static void write(std::ostream& out, const Key& key, Key&)
+    {
+        SnapshotTraits<Key>::write(out, key);
+    }
+    static Key read(std::istream& in, Key&)
+    {
+        return SnapshotTraits<Key>::read(in);
+    }
+};
+
+template <typename Key>
+struct TraceKeyCodec<Key, true>
+{
+    static const uint8_t kind = std::is_signed<Key>::value ? TRACE_KEY_SIGNED : TRACE_KEY_UNSIGNED;
+
+    static void write(std::ostream& out, const Key& key, Key& prev)
+    {
+        // wrapping difference, then zigzag so small negative steps stay small
+        uint64_t delta = static_cast<uint64_t>(key) - static_cast<uint64_t>(prev);
+        if (sizeof(Key) < sizeof(uint64_t)) {
+            // sign-extend the narrow wrapped difference
+            unsigned bits = sizeof(Key) * 8;
+            delta = static_cast<uint64_t>(static_cast<int64_t>(delta << (64 - bits)) >> (64 - bits));
+        }
+        uint64_t zigzag = (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+        prev = key;
+        char buffer[10];
+        size_t length = 0;
+        while (zigzag >= 0x80) {
+            buffer[length++] = static_cast<char>(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        buffer[length++] = static_cast<char>(zigzag);
+        out.write(buffer, length);
+    }
+    static Key read(std::istream& in, Key& prev)
+    {
+        uint64_t zigzag = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if (byte < 0) {
+                return prev;
+            }
+            zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                uint64_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+                prev = static_cast<Key>(static_cast<uint64_t>(prev) + delta);
+                return prev;
+            }
+        }
+        in.setstate(std::ios::failbit);
+        return prev;
+    }
+};
+
+/**
+* Appends operations to a trace file.
+*/
+template <typename Key>
+class TraceWriter
+{
+public:
+    explicit TraceWriter(const std::string& path);
+
+    void record(TraceOp op, const Key& key);
+    void recordIterate();
+    void flush();
+    size_t recordCount() const;
+
+private:
+    std::ofstream out_;
+    Key prev_;
+    size_t records_;
+};
+
+template <typename Key>
+TraceWriter<Key>::TraceWriter(const std::string& path) :
+    out_(path.c_str(), std::ios::binary | std::ios::trunc), prev_(), records_(0)
+{
+    if (!out_) {
+        throw std::runtime_error("Cannot open trace " + path);
+    }
+    TraceHeader header;
+    std::memcpy(header.magic, "BSTTRACE", 8);
+    header.version = 1;
+    header.keyKind = TraceKeyCodec<Key>::kind;
+    header.keyBytes = static_cast<uint8_t>(sizeof(Key));
+    header.reserved = 0;
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+template <typename Key>
+void TraceWriter<Key>::record(TraceOp op, const Key& key)
+{
+    out_.put(static_cast<char>(op));
+    TraceKeyCodec<Key>::write(out_, key, prev_);
+    records_++;
+}
+
+template <typename Key>
+void TraceWriter<Key>::recordIterate()
+{
+    out_.put(static_cast<char>(TRACE_ITERATE));
+    records_++;
+}
+
+template <typename Key>
+void TraceWriter<Key>::flush()
+{
+    out_.flush();
+    if (!out_) {
+        throw std::runtime_error("Cannot write trace");
+    }
+}
+
+template <typename Key>
+size_t TraceWriter<Key>::recordCount() const
+{
+    return records_;
+}
+
+/**
+* Reads a trace back one record at a time. The file's key type must match
+* Key exactly; see TraceHeader.
+*/
+template <typename Key>
+class TraceReader
+{
+public:
+    explicit TraceReader(const std::string& path);
+
+    // false at the end of the trace; throws on a truncated record
+    bool next(TraceOp& op, Key& key);
+
+    static TraceHeader readHeader(std::istream& in);
+
+private:
+    std::ifstream in_;
+    Key prev_;
+};
+
+template <typename Key>
+TraceHeader TraceReader<Key>::readHeader(std::istream& in)
+{
+    TraceHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, "BSTTRACE", 8) != 0 || header.version != 1) {
+        throw std::runtime_error("Not a trace file");
+    }
+    return header;
+}
+
+template <typename Key>
+TraceReader<Key>::TraceReader(const std::string& path) :
+    in_(path.c_str(), std::ios::binary), prev_()
+{
+    if (!in_) {
+        throw std::runtime_error("Cannot open trace " + path);
+    }
+    TraceHeader header = readHeader(in_);
+    if (header.keyKind != TraceKeyCodec<Key>::kind || header.keyBytes != sizeof(Key)) {
+        throw std::invalid_argument("Trace was recorded with a different key type");
+    }
+}
+
+template <typename Key>
+bool TraceReader<Key>::next(TraceOp& op, Key& key)
+{
+    int byte = in_.get();
+    if (byte < 0) {
+        return false;
+    }
+    if (byte < TRACE_INSERT || byte > TRACE_ITERATE) {
+        throw std::runtime_error("Corrupt trace");
+    }
+    op = static_cast<TraceOp>(byte);
+    if (op == TRACE_ITERATE) {
+        return true;
+    }
+    key = TraceKeyCodec<Key>::read(in_, prev_);
+    if (!in_) {
+        throw std::runtime_error("Truncated trace");
+    }
+    return true;
+}
+
+/**
+* A tree that logs every insert, remove, find and forEach to a trace file
+* as it runs them, for replay with bst-replay. Tree is the engine
+* underneath (AVLTree by default). Operations that bypass these four
+* (erase by iterator, erase_range, operator[]) are not recorded.
+*/
+template <typename Key, typename Value, template <typename, typename> class Tree = AVLTree>
+class RecordingTree : public Tree<Key, Value>
+{
+public:
+    typedef typename Tree<Key, Value>::iterator iterator;
+
+    explicit RecordingTree(const std::string& tracePath);
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair) override;
+    virtual void remove(const Key& key) override;
+    using Tree<Key, Value>::find;
+    iterator find(const Key& key) const;
+
+    template <typename Visit>
+    void forEach(Visit visit);
+
+    void flushTrace();
+    size_t traceRecords() const;
+
+private:
+    mutable TraceWriter<Key> trace_;
+};
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+RecordingTree<Key, Value, Tree>::RecordingTree(const std::string& tracePath) :
+    Tree<Key, Value>(), trace_(tracePath)
+{
+
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void RecordingTree<Key, Value, Tree>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    trace_.record(TRACE_INSERT, keyValuePair.first);
+    Tree<Key, Value>::insert(keyValuePair);
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void RecordingTree<Key, Value, Tree>::remove(const Key& key)
+{
+    trace_.record(TRACE_REMOVE, key);
+    Tree<Key, Value>::remove(key);
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+typename RecordingTree<Key, Value, Tree>::iterator
+RecordingTree<Key, Value, Tree>::find(const Key& key) const
+{
+    trace_.record(TRACE_FIND, key);
+    return Tree<Key, Value>::find(key);
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+template <typename Visit>
+void RecordingTree<Key, Value, Tree>::forEach(Visit visit)
+{
+    trace_.recordIterate();
+    for (iterator it = this->begin(); it != this->end(); ++it) {
+        visit(*it);
+    }
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+void RecordingTree<Key, Value, Tree>::flushTrace()
+{
+    trace_.flush();
+}
+
+template <typename Key, typename Value, template <typename, typename> class Tree>
+size_t RecordingTree<Key, Value, Tree>::traceRecords() const
+{
+    return trace_.recordCount();
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef TREE_EXPORT_H
+#define TREE_EXPORT_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+/**
+* What exportTree() writes and how much of the tree it keeps.
+*/
+struct TreeExportOptions
+{
+    enum Format { DOT, JSON };
+
+    Format format;
+    int maxDepth;           // deepest level written (the root is 0); -1 for no limit
+    double sampleRate;      // chance that each child subtree is written; 1 writes all
+    uint64_t seed;          // for sampleRate < 1, so a dump can be reproduced
+    bool values;            // write values next to keys
+    bool balance;           // annotate height(right) - height(left)
+    bool size;              // annotate subtree sizes
+
+    TreeExportOptions();
+};
+
+inline TreeExportOptions::TreeExportOptions() :
+    format(DOT), maxDepth(-1), sampleRate(1.0), seed(1),
+    values(false), balance(false), size(false)
+{
+
+}
+
+/**
+* Writes s with the characters JSON and DOT strings cannot hold escaped.
+*/
+inline void writeExportEscaped(std::ostream& out, const std::string& s)
+{
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (c == '\n') {
+            out << "\\n";
+        }
+        else if ((unsigned char)c < 0x20) {
+            out << ' ';
+        }
+        else {
+            out << c;
+        }
+    }
+}
+
+/**
+* Streams one key or value through operator<<, quoted and escaped.
+* Numbers go into JSON bare. The formatting buffer is reused, so a dump
+* does not allocate per node.
+*/
+class TreeExportScalars
+{
+public:
+    template <typename T>
+    void writeEscaped(std::ostream& out, const T& v)
+    {
+        buffer_.str(std::string());
+        buffer_ << v;
+        writeExportEscaped(out, buffer_.str());
+    }
+
+    template <typename T>
+    void writeQuoted(std::ostream& out, const T& v)
+    {
+        out << '"';
+        writeEscaped(out, v);
+        out << '"';
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>::type
+    writeJson(std::ostream& out, const T& v)
+    {
+        out << +v;
+    }
+
+    template <typename T>
+    typename std::enable_if<!std::is_arithmetic<T>::value || std::is_same<T, bool>::value>::type
+    writeJson(std::ostream& out, const T& v)
+    {
+        writeQuoted(out, v);
+    }
+
+private:
+    std::ostringstream buffer_;
+};
+
+/**
+* Streams the tree at root as Graphviz DOT or JSON. left(n) and right(n)
+* return a node's children (a null NodePtr for none); key(n) and value(n)
+* return anything with operator<<.
+*
+* Nothing is buffered: output goes straight to out as the walk moves,
+* and the only memory used is one small frame per level of the path
+* being walked. Subtrees cut off by maxDepth or sampling are written
+* as a single "elided" placeholder. When balance or size is asked for,
+* cut subtrees are still walked (not written) so the numbers above them
+* are exact; otherwise they are skipped.
+*
+* DOT nodes are numbered in pre-order from 0, and edges leave from the
+* sw/se corners so that dot keeps left children on the left. JSON nodes
+* look like {"key":k,"value":v,"left":{..},"right":{..},"balance":b,
+* "size":s}, with absent children left out and cut ones written as
+* {"elided":true,"size":s}.
+*/
+template <typename NodePtr, typename Left, typename Right, typename KeyOf, typename ValueOf>
+void exportTree(std::ostream& out, NodePtr root, Left left, Right right,
+                KeyOf key, ValueOf value, const TreeExportOptions& options)
+{
+    if (options.maxDepth < -1) {
+        throw std::invalid_argument("maxDepth must be -1 or at least 0");
+    }
+    if (!(options.sampleRate > 0 && options.sampleRate <= 1)) {
+        throw std::invalid_argument("sampleRate must be in (0, 1]");
+    }
+    bool dot = options.format == TreeExportOptions::DOT;
+    bool measure = options.balance || options.size;
+    if (dot) {
+        out << "digraph tree {\n  node [shape=box];\n";
+    }
+    if (root == nullptr) {
+        out << (dot ? "}\n" : "null\n");
+        return;
+    }
+
+    enum Mode { WRITE, ELIDED, COUNT };
+    struct Frame
+    {
+        NodePtr node;
+        int depth;
+        int stage;          // 0: left child next, 1: right child next, 2: done
+        Mode mode;
+        size_t id;
+        int leftHeight;
+        size_t leftSize;
+    };
+    std::vector<Frame> stack;
+    Frame start = { root, 0, 0, WRITE, 0, 0, 0 };
+    stack.push_back(start);
+
+    TreeExportScalars scalars;
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    size_t nextId = 1;
+    int childHeight = 0;    // height and size of the subtree just finished
+    size_t childSize = 0;
+    // a JSON object is opened on the way down and closed once its size is known
+    auto openJson = [&](NodePtr n) {
+        out << "{\"key\":";
+        scalars.writeJson(out, key(n));
+        if (options.values) {
+            out << ",\"value\":";
+            scalars.writeJson(out, value(n));
+        }
+    };
+    if (!dot) {
+        openJson(root);
+    }
+
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        if (f.stage < 2) {
+            bool isLeft = f.stage == 0;
+            if (!isLeft) {
+                f.leftHeight = childHeight;
+                f.leftSize = childSize;
+            }
+            f.stage++;
+            childHeight = 0;
+            childSize = 0;
+            NodePtr c = isLeft ? left(f.node) : right(f.node);
+            if (c == nullptr) {
+                continue;
+            }
+
+            Frame next = { c, f.depth + 1, 0, COUNT, 0, 0, 0 };
+            if (f.mode == WRITE) {
+                bool keep = (options.maxDepth < 0 || next.depth <= options.maxDepth) &&
+                            (options.sampleRate >= 1 || coin(rng) < options.sampleRate);
+                next.mode = keep ? WRITE : ELIDED;
+                next.id = nextId++;
+                if (dot) {
+                    out << "  n" << f.id << (isLeft ? ":sw" : ":se") << " -> n" << next.id
+                        << (keep ? ";\n" : " [style=dashed];\n");
+                }
+                else {
+                    out << (isLeft ? ",\"left\":" : ",\"right\":");
+                }
+                if (keep && !dot) {
+                    openJson(c);
+                }
+                if (!keep && !measure) {
+                    // nothing to count, so the subtree need not be walked
+                    if (dot) {
+                        out << "  n" << next.id << " [shape=plaintext,label=\"...\"];\n";
+                    }
+                    else {
+                        out << "{\"elided\":true}";
+                    }
+                    continue;
+                }
+            }
+            stack.push_back(next);
+            continue;
+        }
+
+        // both subtrees done; childHeight and childSize are the right one's
+        int height = 1 + (f.leftHeight > childHeight ? f.leftHeight : childHeight);
+        size_t size = 1 + f.leftSize + childSize;
+        int balance = childHeight - f.leftHeight;
+        if (f.mode == WRITE && dot) {
+            out << "  n" << f.id << " [label=\"";
+            scalars.writeEscaped(out, key(f.node));
+            if (options.values) {
+                out << ": ";
+                scalars.writeEscaped(out, value(f.node));
+            }
+            if (options.balance) {
+                out << "\\nbf=" << balance;
+            }
+            if (options.size) {
+                out << "\\nsize=" << size;
+            }
+            out << "\"];\n";
+        }
+        else if (f.mode == WRITE) {
+            if (options.balance) {
+                out << ",\"balance\":" << balance;
+            }
+            if (options.size) {
+                out << ",\"size\":" << size;
+            }
+            out << "}";
+        }
+        else if (f.mode == ELIDED && dot) {
+            out << "  n" << f.id << " [shape=plaintext,label=\"... " << size << " nodes\"];\n";
+        }
+        else if (f.mode == ELIDED) {
+            out << "{\"elided\":true,\"size\":" << size << "}";
+        }
+        childHeight = height;
+        childSize = size;
+        stack.pop_back();
+    }
+    out << (dot ? "}\n" : "\n");
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef TREE_SHAPE_H
+#define TREE_SHAPE_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+/**
+* Shape statistics of a binary tree, gathered in one O(n) pass by
+* measureShape(). Depths count edges from the root (the root has depth
+* 0, as in equalPaths); path lengths count the nodes a search compares
+* against, so a hit on the root costs 1.
+*/
+struct TreeShape
+{
+    size_t nodes;
+    size_t leaves;
+    int height;                         // levels; 0 for an empty tree
+    int minLeafDepth;
+    int maxLeafDepth;
+    std::vector<size_t> leafDepths;     // leafDepths[d] = leaves at depth d
+    std::map<int, size_t> balances;     // height(right) - height(left) -> nodes
+    double averagePathLength;           // successful search, every node equally likely
+    double weightedPathLength;          // successful search, nodes weighted by the caller
+    double missPathLength;              // unsuccessful search, every gap equally likely
+
+    TreeShape();
+
+    // 0 exactly when equalPaths() would be true
+    int leafDepthSpread() const;
+    void writeText(std::ostream& out) const;
+};
+
+inline TreeShape::TreeShape() :
+    nodes(0), leaves(0), height(0), minLeafDepth(0), maxLeafDepth(0),
+    averagePathLength(0), weightedPathLength(0), missPathLength(0)
+{
+
+}
+
+inline int TreeShape::leafDepthSpread() const
+{
+    return maxLeafDepth - minLeafDepth;
+}
+
+inline void TreeShape::writeText(std::ostream& out) const
+{
+    out << "nodes=" << nodes << " leaves=" << leaves << " height=" << height
+        << " leaf depth=[" << minLeafDepth << ", " << maxLeafDepth << "]"
+        << " avg path=" << averagePathLength << " weighted path=" << weightedPathLength
+        << " miss path=" << missPathLength << std::endl;
+    out << "leaf depths:";
+    for (size_t d = 0; d < leafDepths.size(); d++) {
+        if (leafDepths[d] != 0) {
+            out << " " << d << ":" << leafDepths[d];
+        }
+    }
+    out << std::endl << "balances:";
+    for (std::map<int, size_t>::const_iterator it = balances.begin(); it != balances.end(); ++it) {
+        out << " " << it->first << ":" << it->second;
+    }
+    out << std::endl;
+}
+
+/**
+* Gives every node the same weight.
+*/
+struct UnitShapeWeight
+{
+    template <typename NodePtr>
+    double operator()(NodePtr) const
+    {
+        return 1.0;
+    }
+};
+
+/**
+* Measures the tree at root. left(n) and right(n) return a node's
+* children (a null NodePtr for none) and weight(n) its access weight, so
+* this works on any pointer-linked node type. The walk keeps its own
+* stack, so degenerate trees of any depth are fine.
+*/
+template <typename NodePtr, typename Left, typename Right, typename Weight>
+TreeShape measureShape(NodePtr root, Left left, Right right, Weight weight)
+{
+    TreeShape shape;
+    if (root == nullptr) {
+        return shape;
+    }
+
+    struct Frame
+    {
+        NodePtr node;
+        int depth;
+        int leftHeight;
+        int stage;  // 0: left child next, 1: right child next, 2: done
+    };
+    std::vector<Frame> stack;
+    Frame start = { root, 0, 0, 0 };
+    stack.push_back(start);
+
+    double depthSum = 0;
+    double weightedSum = 0;
+    double weightTotal = 0;
+    double missSum = 0;
+    int minLeaf = -1;
+    int childHeight = 0;    // height of the subtree just finished
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        if (f.stage == 0) {
+            f.stage = 1;
+            NodePtr l = left(f.node);
+            if (l != nullptr) {
+                Frame next = { l, f.depth + 1, 0, 0 };
+                stack.push_back(next);
+                continue;
+            }
+            childHeight = 0;
+        }
+        if (f.stage == 1) {
+            f.leftHeight = childHeight;
+            f.stage = 2;
+            NodePtr r = right(f.node);
+            if (r != nullptr) {
+                Frame next = { r, f.depth + 1, 0, 0 };
+                stack.push_back(next);
+                continue;
+            }
+            childHeight = 0;
+        }
+
+        // both subtrees done; childHeight is the right one's height
+        int cost = f.depth + 1;
+        double w = weight(f.node);
+        shape.nodes++;
+        depthSum += cost;
+        weightedSum += w * cost;
+        weightTotal += w;
+        int missing = (f.leftHeight == 0) + (childHeight == 0);
+        missSum += (double)missing * cost;
+        if (missing == 2) {
+            shape.leaves++;
+            if ((size_t)f.depth >= shape.leafDepths.size()) {
+                shape.leafDepths.resize(f.depth + 1, 0);
+            }
+            shape.leafDepths[f.depth]++;
+            if (minLeaf < 0 || f.depth < minLeaf) {
+                minLeaf = f.depth;
+            }
+        }
+        shape.balances[childHeight - f.leftHeight]++;
+        childHeight = 1 + (f.leftHeight > childHeight ? f.leftHeight : childHeight);
+        stack.pop_back();
+    }
+
+    shape.height = childHeight;
+    shape.minLeafDepth = minLeaf;
+    shape.maxLeafDepth = (int)shape.leafDepths.size() - 1;
+    shape.averagePathLength = depthSum / shape.nodes;
+    shape.weightedPathLength = weightTotal > 0 ? weightedSum / weightTotal : 0;
+    shape.missPathLength = missSum / (shape.nodes + 1);
+    return shape;
+}
+
+template <typename NodePtr, typename Left, typename Right>
+TreeShape measureShape(NodePtr root, Left left, Right right)
+{
+    return measureShape(root, left, right, UnitShapeWeight());
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <cstdint>
+
+/*
+  Operation counters for BinarySearchTree, AVLTree and the trees built on
+  them. They are compiled in only when BST_STATS is defined (see DEFS in
+  the Makefile); otherwise every BST_STAT* macro expands to nothing and
+  the trees carry no extra code or data.
+
+  Counters are per thread and shared by every tree used on that thread,
+  so const lookups from several threads never write to shared memory.
+  Read them with BinarySearchTree<K,V>::stats() (or treeStats()) and
+  clear them with resetStats().
+*/
+struct TreeStats
+{
+    // Operations
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t lookups;           // keyed searches, including the one remove() makes
+
+    // Work done by those operations
+    uint64_t comparisons;       // key comparisons while descending
+    uint64_t nodesVisited;
+
+    // Restructuring
+    uint64_t rotateLefts;
+    uint64_t rotateRights;
+    uint64_t nodeSwaps;
+    uint64_t insertFixCalls;
+    uint64_t removeFixCalls;
+    uint64_t maxInsertFixDepth; // deepest insertFix/removeFix recursion seen
+    uint64_t maxRemoveFixDepth;
+    uint64_t insertFixDepth;    // current recursion depth
+    uint64_t removeFixDepth;
+
+    // Node memory
+    uint64_t allocations;
+    uint64_t frees;
+
+    void reset()
+    {
+        *this = TreeStats();
+    }
+    double comparisonsPerOp() const
+    {
+        uint64_t ops = inserts + removes + lookups;
+        return ops == 0 ? 0.0 : static_cast<double>(comparisons) / ops;
+    }
+};
+
+/**
+* The calling thread's counters.
+*/
+inline TreeStats& treeStats()
+{
+    static thread_local TreeStats stats = TreeStats();
+    return stats;
+}
+
+/**
+* Tracks one level of a recursive fix-up: bumps depth for the lifetime of
+* the guard and records the deepest level reached in maxDepth.
+*/
+class TreeStatsDepth
+{
+public:
+    TreeStatsDepth(uint64_t& depth, uint64_t& maxDepth) : depth_(depth)
+    {
+        if (++depth_ > maxDepth) {
+            maxDepth = depth_;
+        }
+    }
+    ~TreeStatsDepth()
+    {
+        --depth_;
+    }
+
+private:
+    TreeStatsDepth(const TreeStatsDepth&);
+    TreeStatsDepth& operator=(const TreeStatsDepth&);
+
+    uint64_t& depth_;
+};
+
+#ifdef BST_STATS
+#define BST_STAT(field) (treeStats().field++)
+#define BST_STAT_ADD(field, n) (treeStats().field += (n))
+#define BST_STAT_DEPTH(depth, maxDepth) \
+    TreeStatsDepth bstStatsDepth_(treeStats().depth, treeStats().maxDepth)
+#else
+#define BST_STAT(field) ((void)0)
+#define BST_STAT_ADD(field, n) ((void)0)
+#define BST_STAT_DEPTH(depth, maxDepth) ((void)0)
+#endif
+
+#endif